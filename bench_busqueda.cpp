@@ -0,0 +1,58 @@
+#include "servidor_core.hpp"
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+// Prueba de rendimiento del índice de búsqueda: indexa mensajes sintéticos de
+// 8 palabras con frecuencias tipo Zipf y mide la latencia de consultas de una
+// y dos palabras, como las que resuelve procesar_buscar.
+int main(int argc, char* argv[]) {
+    size_t total = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t consultas = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+    size_t capacidad = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : total;
+
+    std::mt19937 rng(42);
+    std::vector<std::string> vocabulario;
+    for (size_t i = 0; i < 50000; i++) {
+        vocabulario.push_back("w" + std::to_string(i));
+    }
+    std::vector<double> pesos;
+    for (size_t i = 0; i < vocabulario.size(); i++) {
+        pesos.push_back(1.0 / (i + 1));
+    }
+    std::discrete_distribution<size_t> palabra(pesos.begin(), pesos.end());
+    std::uniform_int_distribution<int> usuario(0, 999);
+
+    IndiceBusqueda indice;
+    indice.configurar_capacidad(capacidad);
+    auto inicio = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < total; i++) {
+        std::string contenido;
+        for (int j = 0; j < 8; j++) {
+            contenido += vocabulario[palabra(rng)] + " ";
+        }
+        std::string destino = i % 2 == 0 ? "~" : "u" + std::to_string(usuario(rng));
+        indice.indexar(Mensaje("u" + std::to_string(usuario(rng)), destino, contenido));
+    }
+    auto indexado = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicio).count();
+
+    std::vector<double> latencias;
+    size_t resultados = 0;
+    for (size_t i = 0; i < consultas; i++) {
+        std::string consulta = vocabulario[palabra(rng)];
+        if (i % 2 == 1) {
+            consulta += " " + vocabulario[palabra(rng)];
+        }
+        std::string solicitante = "u" + std::to_string(usuario(rng));
+        auto t0 = std::chrono::steady_clock::now();
+        indice.buscar(consulta, solicitante, 0, 20, [&](const ResultadoBusqueda&) { resultados++; });
+        latencias.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+    }
+    std::sort(latencias.begin(), latencias.end());
+
+    std::cout << "mensajes indexados: " << total << " (retenidos " << indice.size() << ", capacidad " << capacidad << ")\n"
+              << "indexado: " << indexado << " s, memoria del índice: " << indice.bytes() / (1024 * 1024) << " MB\n"
+              << "consultas: " << consultas << ", resultados: " << resultados << "\n"
+              << "latencia p50: " << latencias[latencias.size() / 2] << " us, p99: "
+              << latencias[latencias.size() * 99 / 100] << " us, máx: " << latencias.back() << " us" << std::endl;
+}
@@ -0,0 +1,128 @@
+#define CHAT_SIN_MAIN
+#include "servidor.cpp"
+#include <cstdlib>
+#include <new>
+
+// Prueba de rendimiento del envío de mensajes en el servidor: llama a
+// procesar_enviar_mensaje con clientes reales conectados por un socket Unix y
+// cuenta las reservas de memoria por mensaje, tanto las de todo el proceso
+// (incluye hilos de envío y log) como los buffers de trama que el pool no
+// pudo reutilizar. La salida del log del servidor se descarta.
+
+static std::atomic<size_t> reservas{0};
+
+void* operator new(std::size_t tam) {
+    reservas.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(tam ? tam : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+struct Cliente {
+    net::io_context ioc;
+    websocket::stream<net::local::stream_protocol::socket> ws{ioc};
+    std::atomic<size_t> recibidos{0};
+
+    Cliente(const std::string& ruta, const std::string& nombre) {
+        ws.next_layer().connect(net::local::stream_protocol::endpoint(ruta));
+        ws.handshake("localhost", "/?name=" + nombre);
+        ws.binary(true);
+        std::thread([this]() {
+            beast::flat_buffer buffer;
+            try {
+                while (true) {
+                    ws.read(buffer);
+                    if (buffer.size() > 0 && static_cast<const uint8_t*>(buffer.data().data())[0] == SERVER_MESSAGE) {
+                        recibidos++;
+                    }
+                    buffer.consume(buffer.size());
+                }
+            } catch (const std::exception&) {
+            }
+        }).detach();
+    }
+};
+
+std::vector<uint8_t> trama_envio(const std::string& destino, const std::string& texto) {
+    std::vector<uint8_t> trama = {CLIENT_SEND_MESSAGE};
+    agregar_cadena(trama, destino);
+    agregar_cadena(trama, texto);
+    agregar_entero(trama, 0, 4);
+    return trama;
+}
+
+bool esperar(const std::vector<std::pair<Cliente*, size_t>>& esperados) {
+    auto limite = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    for (auto& [cliente, cantidad] : esperados) {
+        while (cliente->recibidos < cantidad) {
+            if (std::chrono::steady_clock::now() > limite) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return true;
+}
+
+void medir(std::ostream& salida, ChatServer& servidor, const char* nombre, const std::vector<uint8_t>& trama,
+           size_t mensajes, const std::vector<Cliente*>& receptores) {
+    ArenaSolicitud arena;
+    auto enviar = [&](size_t cantidad) {
+        std::vector<std::pair<Cliente*, size_t>> esperados;
+        for (auto* receptor : receptores) {
+            esperados.emplace_back(receptor, receptor->recibidos + cantidad);
+        }
+        for (size_t i = 0; i < cantidad; i++) {
+            servidor.procesar_enviar_mensaje("emisor", trama, arena);
+            arena.reiniciar();
+        }
+        return esperados;
+    };
+
+    if (!esperar(enviar(1000))) {
+        std::cerr << nombre << ": no llegaron los mensajes de calentamiento" << std::endl;
+        return;
+    }
+    size_t reservas_inicio = reservas.load();
+    uint64_t pool_inicio = PoolBuffers::reservas();
+    auto inicio = std::chrono::steady_clock::now();
+    bool completo = esperar(enviar(mensajes));
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - inicio).count();
+    // Los hilos de envío devuelven el buffer justo después de escribir
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    salida << nombre << ": " << double(reservas.load() - reservas_inicio) / mensajes << " reservas/mensaje, "
+           << double(PoolBuffers::reservas() - pool_inicio) / mensajes << " buffers de trama nuevos/mensaje, "
+           << us / mensajes << " us/mensaje" << (completo ? "" : " (incompleto)") << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t mensajes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    std::string ruta = argc > 2 ? argv[2] : "/tmp/bench_envio.sock";
+
+    std::ostream salida(std::cout.rdbuf());
+    std::cout.rdbuf(nullptr);
+
+    ChatServer servidor;
+    escuchar_unix(servidor, ruta);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    Cliente emisor(ruta, "emisor");
+    Cliente receptor(ruta, "receptor");
+    Cliente oyente(ruta, "oyente");
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    const std::string texto(120, 'x');
+    medir(salida, servidor, "chat general", trama_envio("~", texto), mensajes, {&receptor, &oyente});
+    medir(salida, servidor, "mensaje directo", trama_envio("receptor", texto), mensajes, {&emisor, &receptor});
+    std::_Exit(0);
+}
@@ -0,0 +1,73 @@
+#include "servidor_core.hpp"
+#include <iostream>
+#include <memory>
+#include <random>
+#include <cstdlib>
+
+// Prueba de rendimiento del registro de usuarios frente a std::unordered_map:
+// búsquedas de nombres leídos de una trama (la mitad no existen) y recorrido
+// completo, como hacen procesar_obtener_usuario y el listado de usuarios.
+template <typename F>
+double medir(F&& f) {
+    auto inicio = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t usuarios = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    size_t busquedas = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000000;
+
+    std::unordered_map<std::string, std::shared_ptr<int>> mapa;
+    RegistroNombres<std::shared_ptr<int>> registro;
+    for (size_t i = 0; i < usuarios; i++) {
+        auto valor = std::make_shared<int>(static_cast<int>(i));
+        mapa.emplace("usuario" + std::to_string(i), valor);
+        registro.emplace("usuario" + std::to_string(i), valor);
+    }
+
+    // Las tramas llevan el nombre con su longitud delante; se buscan por su porción
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<size_t> nombre(0, usuarios * 2 - 1);
+    std::string trama;
+    std::vector<std::pair<size_t, size_t>> porciones;
+    for (size_t i = 0; i < busquedas; i++) {
+        std::string n = "usuario" + std::to_string(nombre(rng));
+        trama.push_back(static_cast<char>(n.size()));
+        porciones.emplace_back(trama.size(), n.size());
+        trama += n;
+    }
+
+    size_t encontrados_mapa = 0, encontrados_registro = 0;
+    double t_mapa = medir([&] {
+        for (const auto& [offset, len] : porciones) {
+            encontrados_mapa += mapa.count(std::string(trama, offset, len));
+        }
+    });
+    double t_registro = medir([&] {
+        for (const auto& [offset, len] : porciones) {
+            encontrados_registro += registro.find(std::string_view(trama).substr(offset, len)) != registro.end();
+        }
+    });
+
+    long suma_mapa = 0, suma_registro = 0;
+    double r_mapa = medir([&] {
+        for (const auto& [n, valor] : mapa) {
+            suma_mapa += *valor;
+        }
+    });
+    double r_registro = medir([&] {
+        for (const auto& [n, valor] : registro) {
+            suma_registro += *valor;
+        }
+    });
+
+    if (encontrados_mapa != encontrados_registro || suma_mapa != suma_registro) {
+        std::cerr << "Resultados distintos entre mapa y registro" << std::endl;
+        return 1;
+    }
+    std::cout << "usuarios: " << usuarios << ", búsquedas: " << busquedas << " (" << encontrados_mapa << " aciertos)\n"
+              << "búsqueda  unordered_map: " << t_mapa * 1e6 / busquedas << " ns, registro: "
+              << t_registro * 1e6 / busquedas << " ns\n"
+              << "recorrido unordered_map: " << r_mapa << " ms, registro: " << r_registro << " ms" << std::endl;
+}
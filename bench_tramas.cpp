@@ -0,0 +1,59 @@
+#include "cliente_core.hpp"
+#include <cstdlib>
+#include <new>
+
+// Prueba de rendimiento de los constructores de mensajes del cliente: cuenta las
+// reservas de memoria por trama cuando el buffer se descarta tras enviarlo (como
+// antes de FramePool) y cuando se devuelve al pool, como hace NetworkEngine.
+
+static std::atomic<size_t> reservas{0};
+
+void* operator new(std::size_t tam) {
+    reservas.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(tam ? tam : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+template <typename F>
+void medir(const char* nombre, size_t tramas, F&& construir) {
+    for (bool devolver : {false, true}) {
+        size_t antes = reservas.load();
+        auto inicio = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < tramas; i++) {
+            auto trama = construir(i);
+            if (devolver) {
+                FramePool::Release(trama);
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - inicio).count();
+        std::cout << nombre << (devolver ? " con pool:   " : " sin pool:   ")
+                  << double(reservas.load() - antes) / tramas << " reservas/trama, " << ns / tramas << " ns/trama"
+                  << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t tramas = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    const std::string destino = "usuario_destino";
+    const std::string texto(120, 'x');
+
+    medir("CLIENT_SEND_MESSAGE", tramas, [&](size_t i) {
+        return CreateSendMessageMessage(destino, texto, static_cast<uint32_t>(i));
+    });
+    medir("CLIENT_GET_HISTORY ", tramas, [&](size_t i) {
+        return CreateGetHistoryMessage(destino, static_cast<uint32_t>(i));
+    });
+    medir("CLIENT_PING        ", tramas, [&](size_t i) {
+        return CreatePingMessage(i);
+    });
+}
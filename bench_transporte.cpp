@@ -0,0 +1,104 @@
+#include "cliente_core.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+
+// Prueba de rendimiento del transporte: la misma sesión WebSocket por loopback
+// TCP y por el socket Unix del servidor (--unix). Cada petición CLIENT_GET_USER
+// se envía y se espera su respuesta antes de la siguiente. Con el PID del
+// servidor también informa el tiempo de CPU que gastó por petición.
+
+double cpu_proceso_us(int pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string linea;
+    if (pid <= 0 || !std::getline(stat, linea)) {
+        return 0;
+    }
+    std::istringstream campos(linea.substr(linea.rfind(')') + 2));
+    std::string campo;
+    unsigned long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && campos >> campo; i++) {
+        if (i == 14) utime = std::stoul(campo);
+        if (i == 15) stime = std::stoul(campo);
+    }
+    return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+// Descarta los avisos de presencia que lleguen entre medio
+template <typename Stream>
+void esperar_respuesta(websocket::stream<Stream>& ws, beast::flat_buffer& buffer) {
+    while (true) {
+        buffer.clear();
+        ws.read(buffer);
+        uint8_t tipo = buffer.size() > 0 ? static_cast<const uint8_t*>(buffer.data().data())[0] : 0;
+        if (tipo == SERVER_USER_INFO) {
+            return;
+        }
+        if (tipo == SERVER_ERROR) {
+            throw std::runtime_error("el servidor respondió con error; ¿límites de tasa sin desactivar?");
+        }
+    }
+}
+
+template <typename Stream>
+void medir(const std::string& nombre, websocket::stream<Stream>& ws, size_t peticiones, int pid) {
+    ws.binary(true);
+    auto peticion = CreateGetUserMessage("bench");
+    beast::flat_buffer buffer;
+    for (size_t i = 0; i < 1000; i++) {
+        ws.write(net::buffer(peticion));
+        esperar_respuesta(ws, buffer);
+    }
+
+    std::vector<double> latencias;
+    double cpu_inicio = cpu_proceso_us(pid);
+    for (size_t i = 0; i < peticiones; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        ws.write(net::buffer(peticion));
+        esperar_respuesta(ws, buffer);
+        latencias.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+    }
+    double cpu = cpu_proceso_us(pid) - cpu_inicio;
+    std::sort(latencias.begin(), latencias.end());
+
+    std::cout << nombre << ": p50 " << latencias[latencias.size() / 2] << " us, p99 "
+              << latencias[latencias.size() * 99 / 100] << " us";
+    if (pid > 0) {
+        std::cout << ", CPU del servidor " << cpu / peticiones << " us/petición";
+    }
+    std::cout << std::endl;
+    ws.close(websocket::close_code::normal);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Uso: " << argv[0] << " <puerto> <ruta_unix> [peticiones] [pid_servidor]" << std::endl;
+        return 1;
+    }
+    size_t peticiones = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 20000;
+    int pid = argc > 4 ? std::atoi(argv[4]) : 0;
+
+    try {
+        net::io_context ioc;
+        // El usuario consultado existe mientras dure la prueba
+        websocket::stream<tcp::socket> dueno(ioc);
+        net::connect(dueno.next_layer(), tcp::resolver(ioc).resolve("127.0.0.1", argv[1]));
+        dueno.handshake("127.0.0.1", "/?name=bench");
+
+        websocket::stream<tcp::socket> ws_tcp(ioc);
+        net::connect(ws_tcp.next_layer(), tcp::resolver(ioc).resolve("127.0.0.1", argv[1]));
+        ws_tcp.handshake("127.0.0.1", "/?name=bench_tcp");
+        medir("TCP loopback", ws_tcp, peticiones, pid);
+
+        websocket::stream<net::local::stream_protocol::socket> ws_unix(ioc);
+        ws_unix.next_layer().connect(net::local::stream_protocol::endpoint(argv[2]));
+        ws_unix.handshake("localhost", "/?name=bench_unix");
+        medir("Socket Unix ", ws_unix, peticiones, pid);
+
+        dueno.close(websocket::close_code::normal);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
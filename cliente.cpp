@@ -1,60 +1,37 @@
 #include <wx/wx.h>
-#include <wx/listbox.h>
 #include <wx/stattext.h>
 #include <wx/choice.h>
-#include <boost/asio.hpp>
-#include <boost/beast.hpp>
-#include <iostream>
-#include <vector>
-#include <thread>
-#include <unordered_map>
-#include <mutex>
-
-namespace beast = boost::beast;
-namespace websocket = beast::websocket;
-namespace net = boost::asio;
-using tcp = net::ip::tcp;
-
-enum MessageType : uint8_t {
-    CLIENT_LIST_USERS = 1,
-    CLIENT_GET_USER = 2,
-    CLIENT_CHANGE_STATUS = 3,
-    CLIENT_SEND_MESSAGE = 4,
-    CLIENT_GET_HISTORY = 5,
-
-    SERVER_ERROR = 50,
-    SERVER_LIST_USERS = 51,
-    SERVER_USER_INFO = 52,
-    SERVER_NEW_USER = 53,
-    SERVER_STATUS_CHANGE = 54,
-    SERVER_MESSAGE = 55,
-    SERVER_HISTORY = 56
-};
-
-enum ErrorCode : uint8_t {
-    ERROR_USER_NOT_FOUND = 1,
-    ERROR_INVALID_STATUS = 2,
-    ERROR_EMPTY_MESSAGE = 3,
-    ERROR_DISCONNECTED_USER = 4
-};
-
-enum class EstadoUsuario : uint8_t {
-    DESCONECTADO = 0,
-    ACTIVO = 1,
-    OCUPADO = 2,
-    INACTIVO = 3
-};
+#include <wx/listctrl.h>
+#include <wx/vlbox.h>
+#include <wx/dcclient.h>
+#include "cliente_core.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <unordered_set>
+#include <array>
+#include <fstream>
+#include <filesystem>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+
+namespace bip = boost::interprocess;
 
 class ContactInfo {
 public:
     std::string nombre;
     EstadoUsuario estado;
+    bool esSala;
 
-    ContactInfo() : nombre(""), estado(EstadoUsuario::DESCONECTADO) {}
+    ContactInfo() : nombre(""), estado(EstadoUsuario::DESCONECTADO), esSala(false) {}
     
-    ContactInfo(std::string n, EstadoUsuario e) : nombre(std::move(n)), estado(e) {}
+    ContactInfo(std::string n, EstadoUsuario e, bool sala = false) : nombre(std::move(n)), estado(e), esSala(sala) {}
     
     wxString FormatName() const {
+        if (esSala) {
+            return wxString("[S] " + nombre);
+        }
         std::string statusIndicator;
         switch (estado) {
             case EstadoUsuario::ACTIVO: statusIndicator = "[A] "; break;
@@ -66,6 +43,678 @@ public:
     }
 };
 
+// Cola SPSC sin bloqueo entre el hilo de red (productor) y el de la interfaz (consumidor).
+// Los elementos se intercambian con swap, así los buffers de cada ranura se reutilizan.
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "N debe ser potencia de 2");
+
+public:
+    bool Push(T& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        std::swap(slots_[tail & (N - 1)], value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::swap(slots_[head & (N - 1)], value);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, N> slots_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+// Orden de la lista de contactos: chat general, salas y luego usuarios por nombre
+int ContactGroup(const std::string& name) {
+    if (name == "~") return 0;
+    return (!name.empty() && name[0] == '#') ? 1 : 2;
+}
+
+bool ContactOrder(const std::string& a, const std::string& b) {
+    int groupA = ContactGroup(a);
+    int groupB = ContactGroup(b);
+    return groupA != groupB ? groupA < groupB : a < b;
+}
+
+// Lista de contactos virtual: el control solo pide el texto de las filas visibles
+class ContactListCtrl : public wxListCtrl {
+public:
+    using RowText = std::function<wxString(long)>;
+
+    ContactListCtrl(wxWindow* parent, RowText rowText)
+        : wxListCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize,
+                     wxLC_REPORT | wxLC_VIRTUAL | wxLC_SINGLE_SEL | wxLC_NO_HEADER),
+          rowText_(std::move(rowText)) {
+        InsertColumn(0, "");
+        Bind(wxEVT_SIZE, [this](wxSizeEvent& evt) {
+            SetColumnWidth(0, GetClientSize().GetWidth());
+            evt.Skip();
+        });
+    }
+
+protected:
+    wxString OnGetItemText(long item, long) const override {
+        return rowText_(item);
+    }
+
+private:
+    RowText rowText_;
+};
+
+const size_t TRANSCRIPT_LINES = 1000;
+const size_t TRANSCRIPT_PAGED_LINES = 5000;
+const size_t HISTORY_PAGE = 255;
+
+// Transcripción de una conversación: anillo acotado con las líneas recientes y, solo en la
+// conversación abierta, las páginas anteriores pedidas al servidor al llegar arriba.
+class Transcript {
+public:
+    void Append(std::string text, uint32_t id = 0) {
+        Entry entry{std::move(text), id};
+        if (ring_.size() < TRANSCRIPT_LINES) {
+            ring_.push_back(std::move(entry));
+            return;
+        }
+        if (!older_.empty()) {
+            older_.push_back(std::move(ring_[head_]));
+            TrimOlder();
+        } else {
+            complete_ = false;
+        }
+        ring_[head_] = std::move(entry);
+        head_ = (head_ + 1) % ring_.size();
+    }
+
+    void Hold(std::string text) {
+        held_.push_back(std::move(text));
+    }
+
+    bool RevealHeld() {
+        if (held_.empty()) return false;
+        for (auto& text : held_) {
+            Append(std::move(text));
+        }
+        held_.clear();
+        return true;
+    }
+
+    void ReplaceRecent(std::vector<std::pair<std::string, uint32_t>> lines) {
+        ring_.clear();
+        older_.clear();
+        head_ = 0;
+        complete_ = lines.size() < HISTORY_PAGE;
+        for (auto& [text, id] : lines) {
+            Append(std::move(text), id);
+        }
+    }
+
+    size_t PrependOlder(std::vector<std::pair<std::string, uint32_t>> lines) {
+        uint32_t oldest = OldestId();
+        size_t added = 0;
+        for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+            if (oldest == 0 || (it->second != 0 && it->second < oldest)) {
+                older_.push_front({std::move(it->first), it->second});
+                added++;
+            }
+        }
+        if (added == 0) {
+            complete_ = true;
+        }
+        return added;
+    }
+
+    void DropOlder() {
+        if (!older_.empty()) {
+            older_.clear();
+            complete_ = false;
+        }
+    }
+
+    size_t Size() const {
+        return older_.size() + ring_.size();
+    }
+
+    const std::string& Line(size_t row) const {
+        if (row < older_.size()) {
+            return older_[row].text;
+        }
+        return ring_[(head_ + row - older_.size()) % ring_.size()].text;
+    }
+
+    uint32_t OldestId() const {
+        for (const auto& entry : older_) {
+            if (entry.id != 0) return entry.id;
+        }
+        for (size_t i = 0; i < ring_.size(); i++) {
+            uint32_t id = ring_[(head_ + i) % ring_.size()].id;
+            if (id != 0) return id;
+        }
+        return 0;
+    }
+
+    bool HasOlder() const {
+        return !complete_ && OldestId() > 1;
+    }
+
+private:
+    struct Entry {
+        std::string text;
+        uint32_t id;
+    };
+
+    void TrimOlder() {
+        if (older_.size() > TRANSCRIPT_PAGED_LINES) {
+            older_.erase(older_.begin(), older_.begin() + (older_.size() - TRANSCRIPT_PAGED_LINES));
+            complete_ = false;
+        }
+    }
+
+    std::vector<Entry> ring_;
+    size_t head_ = 0;
+    std::deque<Entry> older_;
+    std::vector<std::string> held_;
+    bool complete_ = false;
+};
+
+// Caché local del historial, un archivo por servidor y usuario. Los registros solo se agregan
+// al final; al abrir se mapea el archivo, se conservan las últimas líneas de cada conversación
+// y, si la mayor parte de los registros ya no se usa, se reescribe solo con esas líneas.
+// Las conversaciones se devuelven de la más reciente a la más antigua.
+// Registro: [tipo][len][chat][id (4 bytes)][len (2 bytes)][línea]; el tipo 2 vacía la conversación.
+class HistoryCache {
+public:
+    using Lines = std::vector<std::pair<std::string, uint32_t>>;
+    using Kept = std::unordered_map<std::string, std::deque<std::pair<std::string, uint32_t>>>;
+
+    bool Open(const std::string& path, std::vector<std::pair<std::string, Lines>>& chats) {
+        path_ = path;
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path_).parent_path(), ec);
+
+        Kept kept;
+        std::vector<std::string> order;
+        size_t records = Load(kept, order);
+
+        size_t lines = 0;
+        for (const auto& [chat, entries] : kept) {
+            lines += entries.size();
+        }
+        if (records > 2 * lines + TRANSCRIPT_LINES) {
+            Compact(kept, order);
+        }
+
+        out_.open(path_, std::ios::binary | std::ios::app);
+        if (!out_) {
+            std::cerr << "No se pudo abrir la caché de historial " << path_ << std::endl;
+            return false;
+        }
+        if (std::filesystem::file_size(path_, ec) == 0) {
+            out_.write(MAGIC, sizeof(MAGIC));
+            out_.flush();
+        }
+
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            auto& entries = kept[*it];
+            if (entries.empty()) continue;
+            chats.emplace_back(*it, Lines(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end())));
+        }
+        return true;
+    }
+
+    void Append(const std::string& chat, const std::string& line, uint32_t id) {
+        if (!out_.is_open()) return;
+        Write(out_, LINE, chat, line, id);
+        out_.flush();
+    }
+
+    void Reset(const std::string& chat, const Lines& lines) {
+        if (!out_.is_open()) return;
+        Write(out_, RESET, chat, "", 0);
+        for (const auto& [line, id] : lines) {
+            Write(out_, LINE, chat, line, id);
+        }
+        out_.flush();
+    }
+
+private:
+    static constexpr uint8_t LINE = 1;
+    static constexpr uint8_t RESET = 2;
+    static constexpr char MAGIC[4] = {'C', 'H', 'C', '1'};
+
+    size_t Load(Kept& kept, std::vector<std::string>& order) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(path_, ec);
+        if (ec || size == 0) return 0;
+
+        std::unordered_map<std::string, size_t> last;
+        size_t records = 0;
+        size_t valid = 0;
+        try {
+            bip::file_mapping file(path_.c_str(), bip::read_only);
+            bip::mapped_region region(file, bip::read_only);
+            const uint8_t* data = static_cast<const uint8_t*>(region.get_address());
+            size_t end = region.get_size();
+
+            if (end < sizeof(MAGIC) || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+                std::cerr << "Caché de historial con formato desconocido, se descarta" << std::endl;
+            } else {
+                size_t offset = sizeof(MAGIC);
+                valid = offset;
+                while (offset + 2 <= end) {
+                    uint8_t type = data[offset];
+                    uint8_t chatLen = data[offset + 1];
+                    size_t header = offset + 2 + chatLen + 6;
+                    if (header > end) break;
+                    size_t lineLen = (data[header - 2] << 8) | data[header - 1];
+                    if (header + lineLen > end || (type != LINE && type != RESET)) break;
+
+                    std::string chat(reinterpret_cast<const char*>(data + offset + 2), chatLen);
+                    auto& entries = kept[chat];
+                    if (type == RESET) {
+                        entries.clear();
+                    } else {
+                        uint32_t id = 0;
+                        for (size_t i = header - 6; i < header - 2; i++) {
+                            id = (id << 8) | data[i];
+                        }
+                        entries.emplace_back(std::string(reinterpret_cast<const char*>(data + header), lineLen), id);
+                        if (entries.size() > TRANSCRIPT_LINES) {
+                            entries.pop_front();
+                        }
+                    }
+                    last[chat] = records++;
+                    offset = header + lineLen;
+                    valid = offset;
+                }
+            }
+        } catch (const bip::interprocess_exception& e) {
+            std::cerr << "No se pudo mapear la caché de historial: " << e.what() << std::endl;
+        }
+
+        // Un registro cortado por un cierre abrupto se descarta
+        if (valid < size) {
+            std::filesystem::resize_file(path_, valid, ec);
+        }
+
+        for (const auto& [chat, record] : last) {
+            order.push_back(chat);
+        }
+        std::sort(order.begin(), order.end(), [&last](const std::string& a, const std::string& b) {
+            return last[a] < last[b];
+        });
+        return records;
+    }
+
+    void Compact(const Kept& kept, const std::vector<std::string>& order) {
+        std::string temp = path_ + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out) return;
+            out.write(MAGIC, sizeof(MAGIC));
+            for (const auto& chat : order) {
+                for (const auto& [line, id] : kept.at(chat)) {
+                    Write(out, LINE, chat, line, id);
+                }
+            }
+            if (!out.flush()) return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, path_, ec);
+    }
+
+    static void Write(std::ostream& out, uint8_t type, const std::string& chat, const std::string& line, uint32_t id) {
+        size_t chatLen = std::min(chat.size(), size_t(255));
+        size_t lineLen = std::min(line.size(), size_t(65535));
+        uint8_t header[2] = {type, static_cast<uint8_t>(chatLen)};
+        uint8_t trailer[6] = {static_cast<uint8_t>(id >> 24), static_cast<uint8_t>(id >> 16),
+                              static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id),
+                              static_cast<uint8_t>(lineLen >> 8), static_cast<uint8_t>(lineLen)};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(chat.data(), chatLen);
+        out.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+        out.write(line.data(), lineLen);
+    }
+
+    std::string path_;
+    std::ofstream out_;
+};
+
+// Vista virtual de la transcripción: solo mide y dibuja las líneas visibles
+class TranscriptView : public wxVListBox {
+public:
+    TranscriptView(wxWindow* parent, std::function<void()> onReachTop)
+        : wxVListBox(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_SUNKEN),
+          transcript_(nullptr),
+          onReachTop_(std::move(onReachTop)) {
+        auto onScroll = [this](wxScrollWinEvent& evt) {
+            evt.Skip();
+            CallAfter([this]() { CheckTop(); });
+        };
+        Bind(wxEVT_SCROLLWIN_TOP, onScroll);
+        Bind(wxEVT_SCROLLWIN_LINEUP, onScroll);
+        Bind(wxEVT_SCROLLWIN_THUMBTRACK, onScroll);
+        Bind(wxEVT_MOUSEWHEEL, [this](wxMouseEvent& evt) {
+            evt.Skip();
+            CallAfter([this]() { CheckTop(); });
+        });
+    }
+
+    void ShowTranscript(const Transcript* transcript) {
+        transcript_ = transcript;
+        size_t count = transcript_ ? transcript_->Size() : 0;
+        SetItemCount(count);
+        ScrollToRow(count > 0 ? count - 1 : 0);
+        RefreshAll();
+    }
+
+    void Sync() {
+        size_t count = transcript_ ? transcript_->Size() : 0;
+        bool atBottom = GetVisibleRowsEnd() >= GetItemCount();
+        SetItemCount(count);
+        if (atBottom && count > 0) {
+            ScrollToRow(count - 1);
+        }
+        RefreshAll();
+    }
+
+    void SyncPrepended(size_t added) {
+        size_t top = GetVisibleRowsBegin();
+        SetItemCount(transcript_ ? transcript_->Size() : 0);
+        ScrollToRow(top + added);
+        RefreshAll();
+    }
+
+protected:
+    void OnDrawItem(wxDC& dc, const wxRect& rect, size_t n) const override {
+        if (!transcript_ || n >= transcript_->Size()) return;
+        dc.SetFont(GetFont());
+        dc.DrawText(wxString(transcript_->Line(n)), rect.GetX() + 4, rect.GetY() + 2);
+    }
+
+    int OnMeasureItem(size_t) const override {
+        return GetCharHeight() + 4;
+    }
+
+private:
+    void CheckTop() {
+        if (transcript_ && GetItemCount() > 0 && GetVisibleRowsBegin() == 0) {
+            onReachTop_();
+        }
+    }
+
+    const Transcript* transcript_;
+    std::function<void()> onReachTop_;
+};
+
+const size_t DIAGNOSTICS_MAX_SAMPLES = 3600;
+const auto DIAGNOSTICS_PENDING_TIMEOUT = std::chrono::seconds(10);
+
+// Métricas del panel de diagnóstico. El RTT y las latencias de LIST_USERS y GET_HISTORY se
+// miden desde que el motor termina de escribir la solicitud, sin la espera en su cola, hasta
+// que llega la respuesta al hilo de red, sin la espera del hilo de la interfaz; esa espera se
+// mide aparte como el retraso entre recibir y despachar.
+class Diagnostics {
+public:
+    // Valores negativos: sin medición en el intervalo
+    struct Sample {
+        std::chrono::system_clock::time_point when;
+        double rttMs;
+        double listUsersMs;
+        double historyMs;
+        double uiLagMs;
+        double framesInPerSec;
+        double bytesInPerSec;
+        double framesOutPerSec;
+        double bytesOutPerSec;
+    };
+
+    // Se llama desde el motor al completar la escritura; pingPayload es la carga de CLIENT_PING
+    void RequestWritten(uint8_t type, uint64_t pingPayload = 0) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (type == CLIENT_LIST_USERS) {
+            pendingListUsers_.push_back(now);
+        } else if (type == CLIENT_GET_HISTORY) {
+            pendingHistory_.push_back(now);
+        } else if (type == CLIENT_PING) {
+            pendingPings_.emplace_back(pingPayload, now);
+        }
+    }
+
+    void FrameReceived(const std::vector<uint8_t>& frame) {
+        if (frame.empty()) return;
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        switch (frame[0]) {
+            case SERVER_PONG: {
+                uint64_t sentAt;
+                if (!DecodePong(frame, sentAt)) return;
+                auto sent = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(sentAt));
+                while (!pendingPings_.empty() && pendingPings_.front().first != sentAt) {
+                    pendingPings_.pop_front();
+                }
+                if (!pendingPings_.empty()) {
+                    sent = pendingPings_.front().second;
+                    pendingPings_.pop_front();
+                }
+                rtt_.Add(Milliseconds(now - sent));
+                break;
+            }
+            // Una solicitud rechazada no tendrá respuesta: se descarta sin contarla
+            case SERVER_ERROR: {
+                ServerError error;
+                if (!DecodeError(frame, error)) return;
+                if (error.request == CLIENT_LIST_USERS && !pendingListUsers_.empty()) {
+                    pendingListUsers_.pop_front();
+                } else if (error.request == CLIENT_GET_HISTORY && !pendingHistory_.empty()) {
+                    pendingHistory_.pop_front();
+                } else if (error.request == CLIENT_PING && !pendingPings_.empty()) {
+                    pendingPings_.pop_front();
+                }
+                break;
+            }
+            case SERVER_LIST_USERS:
+                Match(pendingListUsers_, listUsers_, now);
+                break;
+            case SERVER_HISTORY:
+                Match(pendingHistory_, history_, now);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void UiLag(std::chrono::steady_clock::duration lag) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uiLag_.Add(std::max(0.0, Milliseconds(lag)));
+    }
+
+    void Reset(const NetworkEngine::Traffic& traffic) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rtt_ = listUsers_ = history_ = uiLag_ = Accumulator();
+        lastTraffic_ = traffic;
+        lastSampleAt_ = std::chrono::steady_clock::now();
+    }
+
+    Sample TakeSample(const NetworkEngine::Traffic& traffic) {
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        double seconds = std::max(1e-3, std::chrono::duration<double>(now - lastSampleAt_).count());
+        Sample sample;
+        sample.when = std::chrono::system_clock::now();
+        sample.rttMs = rtt_.TakeMean();
+        sample.listUsersMs = listUsers_.TakeMean();
+        sample.historyMs = history_.TakeMean();
+        sample.uiLagMs = uiLag_.TakeMax();
+        sample.framesInPerSec = (traffic.framesIn - lastTraffic_.framesIn) / seconds;
+        sample.bytesInPerSec = (traffic.bytesIn - lastTraffic_.bytesIn) / seconds;
+        sample.framesOutPerSec = (traffic.framesOut - lastTraffic_.framesOut) / seconds;
+        sample.bytesOutPerSec = (traffic.bytesOut - lastTraffic_.bytesOut) / seconds;
+        lastTraffic_ = traffic;
+        lastSampleAt_ = now;
+
+        samples_.push_back(sample);
+        if (samples_.size() > DIAGNOSTICS_MAX_SAMPLES) {
+            samples_.pop_front();
+        }
+        return sample;
+    }
+
+    bool ExportCsv(const std::string& path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) return false;
+
+        out << "hora,rtt_ms,lista_usuarios_ms,historial_ms,retraso_interfaz_ms,"
+               "mensajes_entrada_s,bytes_entrada_s,mensajes_salida_s,bytes_salida_s\n";
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& sample : samples_) {
+            std::time_t time = std::chrono::system_clock::to_time_t(sample.when);
+            std::tm local = *std::localtime(&time);
+            out << std::put_time(&local, "%Y-%m-%d %H:%M:%S");
+            for (double value : {sample.rttMs, sample.listUsersMs, sample.historyMs, sample.uiLagMs}) {
+                out << ',';
+                if (value >= 0) out << std::fixed << std::setprecision(2) << value;
+            }
+            for (double value : {sample.framesInPerSec, sample.bytesInPerSec, sample.framesOutPerSec, sample.bytesOutPerSec}) {
+                out << ',' << std::fixed << std::setprecision(1) << value;
+            }
+            out << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct Accumulator {
+        double total = 0;
+        double max = -1;
+        unsigned count = 0;
+
+        void Add(double ms) {
+            total += ms;
+            max = std::max(max, ms);
+            count++;
+        }
+        double TakeMean() {
+            double mean = count ? total / count : -1;
+            *this = Accumulator();
+            return mean;
+        }
+        double TakeMax() {
+            double result = max;
+            *this = Accumulator();
+            return result;
+        }
+    };
+
+    static double Milliseconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    // Las respuestas de un mismo tipo llegan en el orden de las solicitudes; las que no
+    // llegan (por ejemplo, tras perder la conexión) caducan
+    static void Match(std::deque<std::chrono::steady_clock::time_point>& pending, Accumulator& latency,
+                      std::chrono::steady_clock::time_point now) {
+        while (!pending.empty() && now - pending.front() > DIAGNOSTICS_PENDING_TIMEOUT) {
+            pending.pop_front();
+        }
+        if (pending.empty()) return;
+        latency.Add(Milliseconds(now - pending.front()));
+        pending.pop_front();
+    }
+
+    mutable std::mutex mutex_;
+    std::deque<std::chrono::steady_clock::time_point> pendingListUsers_;
+    std::deque<std::chrono::steady_clock::time_point> pendingHistory_;
+    std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> pendingPings_;
+    Accumulator rtt_;
+    Accumulator listUsers_;
+    Accumulator history_;
+    Accumulator uiLag_;
+    NetworkEngine::Traffic lastTraffic_;
+    std::chrono::steady_clock::time_point lastSampleAt_;
+    std::deque<Sample> samples_;
+};
+
+class DiagnosticsDialog : public wxDialog {
+public:
+    DiagnosticsDialog(wxWindow* parent, const Diagnostics& diagnostics)
+        : wxDialog(parent, wxID_ANY, "Diagnóstico de la conexión"), diagnostics_(diagnostics) {
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        wxFlexGridSizer* grid = new wxFlexGridSizer(2, 5, 15);
+
+        const char* labels[] = {"RTT (ping):", "Lista de usuarios:", "Historial:", "Retraso de la interfaz:",
+                                "Entrada:", "Salida:"};
+        for (size_t i = 0; i < values_.size(); i++) {
+            grid->Add(new wxStaticText(this, wxID_ANY, wxString::FromUTF8(labels[i])), 0, wxALIGN_CENTER_VERTICAL);
+            values_[i] = new wxStaticText(this, wxID_ANY, "-");
+            grid->Add(values_[i], 0, wxALIGN_CENTER_VERTICAL);
+        }
+        sizer->Add(grid, 0, wxALL, 10);
+
+        sizer->Add(new wxStaticText(this, wxID_ANY,
+            "RTT alto: red o servidor saturado. Latencias altas con RTT bajo: el servidor tarda en\n"
+            "responder. Retraso de la interfaz alto: el cliente no alcanza a procesar lo recibido."),
+            0, wxLEFT | wxRIGHT | wxBOTTOM, 10);
+
+        wxBoxSizer* buttons = new wxBoxSizer(wxHORIZONTAL);
+        wxButton* exportButton = new wxButton(this, wxID_ANY, "Exportar CSV");
+        buttons->Add(exportButton, 0, wxALL, 5);
+        buttons->Add(new wxButton(this, wxID_CLOSE, "Cerrar"), 0, wxALL, 5);
+        sizer->Add(buttons, 0, wxALIGN_CENTER | wxBOTTOM, 5);
+
+        exportButton->Bind(wxEVT_BUTTON, &DiagnosticsDialog::OnExport, this);
+        Bind(wxEVT_BUTTON, [this](wxCommandEvent&) { Close(); }, wxID_CLOSE);
+
+        SetSizerAndFit(sizer);
+    }
+
+    void ShowSample(const Diagnostics::Sample& sample) {
+        auto latency = [](double ms) {
+            return ms < 0 ? wxString("-") : wxString::Format("%.1f ms", ms);
+        };
+        values_[0]->SetLabel(latency(sample.rttMs));
+        values_[1]->SetLabel(latency(sample.listUsersMs));
+        values_[2]->SetLabel(latency(sample.historyMs));
+        values_[3]->SetLabel(latency(sample.uiLagMs));
+        values_[4]->SetLabel(wxString::Format("%.0f mensajes/s, %.1f KB/s", sample.framesInPerSec, sample.bytesInPerSec / 1024));
+        values_[5]->SetLabel(wxString::Format("%.0f mensajes/s, %.1f KB/s", sample.framesOutPerSec, sample.bytesOutPerSec / 1024));
+        Layout();
+    }
+
+private:
+    void OnExport(wxCommandEvent&) {
+        wxFileDialog dialog(this, "Exportar métricas", "", "diagnostico.csv", "CSV (*.csv)|*.csv",
+                            wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (dialog.ShowModal() != wxID_OK) {
+            return;
+        }
+        if (!diagnostics_.ExportCsv(dialog.GetPath().ToStdString())) {
+            wxMessageBox("No se pudo escribir el archivo", "Error", wxOK | wxICON_ERROR);
+        }
+    }
+
+    const Diagnostics& diagnostics_;
+    std::array<wxStaticText*, 6> values_;
+};
+
 class ChatFrame;
 class MyFrame;
 
@@ -78,58 +727,144 @@ wxIMPLEMENT_APP(MyApp);
 
 
 enum {
-    ID_CHAT_TITLE = wxID_HIGHEST + 1
+    ID_CHAT_TITLE = wxID_HIGHEST + 1,
+    ID_DRAIN_TIMER,
+    ID_PREFETCH_TIMER,
+    ID_INACTIVITY_TIMER,
+    ID_DIAGNOSTICS_TIMER
 };
 
+const int DRAIN_INTERVAL_MS = 16;
+const int DRAIN_MAX_EVENTS = 512;
+const int PREFETCH_INTERVAL_MS = 1000;
+const size_t PREFETCH_MAX_IN_FLIGHT = 2;
+const size_t PREFETCH_BUDGET_BYTES = 512 * 1024;
+const size_t PREFETCH_RECENT = 8;
+const auto PREFETCH_TIMEOUT = std::chrono::seconds(10);
+// Estimación local del límite `historial` del servidor (2 por segundo, ráfaga de 10), que
+// también cuenta CLIENT_RESUME. La precarga deja siempre PREFETCH_RESERVE para el usuario
+const double HISTORY_RATE = 2.0;
+const double HISTORY_BURST = 10.0;
+const double PREFETCH_RESERVE = 6.0;
+const auto INACTIVITY_TIMEOUT = std::chrono::seconds(20);
+const int DIAGNOSTICS_INTERVAL_MS = 1000;
+
 class ChatFrame : public wxFrame {
 public:
-    ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const std::string& usuario);
+    ChatFrame(std::shared_ptr<NetworkEngine> engine, const std::string& usuario, const std::string& servidor);
     ~ChatFrame();
 
 private:
-    wxListBox* contactList;
-    wxTextCtrl* chatBox;
+    ContactListCtrl* contactList;
+    TranscriptView* chatBox;
     wxTextCtrl* messageInput;
     wxButton* sendButton;
     wxButton* addContactButton;
     wxButton* checkUserInfoButton;
     wxButton* refreshUsersButton;
+    wxButton* roomsButton;
+    wxButton* searchButton;
     wxChoice* statusChoice;
     wxStaticText* chatTitle;
     wxStaticText* statusText;
     wxStaticText* connectionInfoText;  
     wxButton* logoutButton;
+    wxButton* diagnosticsButton;
     
-    std::shared_ptr<websocket::stream<tcp::socket>> ws_;
+    std::shared_ptr<NetworkEngine> engine_;
     std::string usuario_;
     std::string chatPartner_;
-    bool running_;
+    std::atomic<bool> running_;
     std::mutex chatHistoryMutex_;
     EstadoUsuario currentStatus_;
     bool canSendMessages_;
     bool forceCanSend_;
 
     std::unordered_map<std::string, ContactInfo> contacts_;
-    std::unordered_map<std::string, std::vector<std::pair<std::string, bool>>> chatHistory_;    
+    std::unordered_map<std::string, Transcript> transcripts_;
+    HistoryCache historyCache_;
+    std::string olderHistoryChat_;
+    uint32_t olderHistoryBefore_;
+    std::vector<std::string> presenceSubscription_;
+    std::string searchQuery_;
+    ClientSession session_;
+    std::atomic<bool> ackScheduled_;
+    wxString reconnectInfo_;
+    std::atomic<bool> dropNoticeScheduled_;
+
+    SpscQueue<std::vector<uint8_t>, 1024> inbox_;
+    std::atomic<bool> drainScheduled_;
+    wxTimer drainTimer_;
+    wxTimer prefetchTimer_;
+    std::deque<std::string> prefetchQueue_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> prefetchInFlight_;
+    std::unordered_set<std::string> syncedChats_;
+    size_t prefetchBytes_;
+    std::deque<std::string> pendingHistory_;
+    double historyTokens_;
+    std::chrono::steady_clock::time_point historyTokensAt_;
+    std::vector<uint8_t> drainBuffer_;
+    bool transcriptDirty_;
+    bool transcriptReset_;
+    size_t transcriptPrepended_;
+    bool contactListReset_;
+    std::vector<std::string> changedContacts_;
+    std::vector<std::string> contactRows_;
+    bool restoringSelection_;
+    bool statusDirty_;
+    bool subscriptionDirty_;
+    void SendRequest(std::vector<uint8_t> request, const std::string& errorMessage, bool showDialog = true,
+                     const std::string& prefetchChat = "");
+    double HistoryTokens();
+    std::string PopPendingHistory();
     void RequestUserList();
+    void ScheduleAcks();
+    void FlushAcks();
+    void RequestResume();
+    void SendPresenceSubscription();
+    std::vector<std::string> LoadHistoryCache(const std::string& servidor);
     void LoadChatHistory();
     void RequestChatHistory();
+    bool NeedsFullHistory(const std::string& chat);
+    void SchedulePrefetch(const std::string& chat);
+    void OnPrefetchTimer(wxTimerEvent&);
+    void CompletePrefetch(const std::string& chat, size_t bytes);
+    void OnTyping(wxCommandEvent&);
     void OnSend(wxCommandEvent&);
     void StartReceivingMessages();
+    void QueueMessage(std::vector<uint8_t>& message);
+    void OnDrainTimer(wxTimerEvent&);
+    void DispatchMessage(std::vector<uint8_t>& message);
+    void AddTranscriptLine(const std::string& chat, std::string line, uint32_t id = 0, bool visible = true);
+    void RequestOlderHistory();
+    void ApplyPendingUpdates();
     void OnAddContact(wxCommandEvent&);
-    void OnSelectContact(wxCommandEvent& evt);
+    void OnSelectContact(wxListEvent& evt);
     void OnCheckUserInfo(wxCommandEvent&);
     void OnRefreshUsers(wxCommandEvent&);
+    void OnRooms(wxCommandEvent&);
+    void OnSearch(wxCommandEvent&);
+    void RequestSearch(uint32_t beforeId);
     void OnChangeStatus(wxCommandEvent&);
-    void MonitorearInactividad();
+    void ApplyStatus(EstadoUsuario newStatus, bool automatic);
+    void RegistrarActividad();
+    void ArmInactivityTimer();
+    void OnInactivityTimer(wxTimerEvent&);
     void OnLogout(wxCommandEvent&);
 
-    std::vector<uint8_t> CreateListUsersMessage();
-    std::vector<uint8_t> CreateGetUserMessage(const std::string& username);
-    std::vector<uint8_t> CreateChangeStatusMessage(EstadoUsuario status);
-    std::vector<uint8_t> CreateSendMessageMessage(const std::string& dest, const std::string& message);
-    std::vector<uint8_t> CreateGetHistoryMessage(const std::string& chat);
-    std::chrono::steady_clock::time_point ultimaActividad_;
+    // Marca de la última interacción (ticks de steady_clock); el temporizador de
+    // inactividad se arma una sola vez y al vencer recalcula el plazo restante
+    std::atomic<std::chrono::steady_clock::rep> ultimaActividad_;
+    std::atomic<bool> inactivoAutomatico_;
+    wxTimer inactivityTimer_;
+
+    void OnDiagnostics(wxCommandEvent&);
+    void OnDiagnosticsTimer(wxTimerEvent&);
+
+    Diagnostics diagnostics_;
+    DiagnosticsDialog* diagnosticsDialog_;
+    wxTimer diagnosticsTimer_;
+    std::atomic<std::chrono::steady_clock::rep> drainQueuedAt_;
 
     void ProcessErrorMessage(const std::vector<uint8_t>& data);
     void ProcessListUsersMessage(const std::vector<uint8_t>& data);
@@ -138,35 +873,66 @@ private:
     void ProcessStatusChangeMessage(const std::vector<uint8_t>& data);
     void ProcessMessageMessage(const std::vector<uint8_t>& data);
     void ProcessHistoryMessage(const std::vector<uint8_t>& data);
+    void ProcessRoomMessage(const std::vector<uint8_t>& data);
+    void ProcessRoomUpdateMessage(const std::vector<uint8_t>& data);
+    void ProcessSearchResultsMessage(const std::vector<uint8_t>& data);
+    void ProcessMailboxMessage(const std::vector<uint8_t>& data);
+    void ProcessResumeMessage(const std::vector<uint8_t>& data);
+    void ProcessSessionMessage(const std::vector<uint8_t>& data);
 
     void UpdateContactListUI();
+    void RefreshContactRow(const std::string& name);
+    long FindContactRow(const std::string& name) const;
+    void SelectContactRow(const std::string& name);
     void UpdateStatusDisplay();
     bool CanSendMessage() const;
-    bool IsWebSocketConnected();
-    bool ReiniciarConexion();
-    bool VerificarConexion();
+    void MostrarReconexion(unsigned attempt, std::chrono::milliseconds delay, const std::string& error);
+    void MostrarDescartados();
+    void OnReconnected();
     void ActualizarInfoConexion();
     void OnHelp(wxCommandEvent&);
 };
 
-ChatFrame::ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const std::string& usuario)
+ChatFrame::ChatFrame(std::shared_ptr<NetworkEngine> engine, const std::string& usuario, const std::string& servidor)
     : wxFrame(nullptr, wxID_ANY, "Chat - " + usuario, wxDefaultPosition, wxSize(800, 600)), 
-      ws_(ws), 
+      engine_(engine), 
       usuario_(usuario),
       running_(true),
       currentStatus_(EstadoUsuario::ACTIVO),
       canSendMessages_(true),
-      forceCanSend_(false) {
-
-    std::string ip_local;
-    try {
-        ip_local = ws_->next_layer().local_endpoint().address().to_string();
-    } catch (std::exception& e) {
+      forceCanSend_(false),
+      session_(usuario),
+      ackScheduled_(false),
+      dropNoticeScheduled_(false),
+      drainScheduled_(false),
+      drainTimer_(this, ID_DRAIN_TIMER),
+      prefetchTimer_(this, ID_PREFETCH_TIMER),
+      prefetchBytes_(0),
+      historyTokens_(HISTORY_BURST),
+      historyTokensAt_(std::chrono::steady_clock::now()),
+      olderHistoryBefore_(0),
+      transcriptDirty_(false),
+      transcriptReset_(false),
+      transcriptPrepended_(0),
+      contactListReset_(false),
+      restoringSelection_(false),
+      statusDirty_(false),
+      subscriptionDirty_(false),
+      ultimaActividad_(std::chrono::steady_clock::now().time_since_epoch().count()),
+      inactivoAutomatico_(false),
+      inactivityTimer_(this, ID_INACTIVITY_TIMER),
+      diagnosticsDialog_(nullptr),
+      diagnosticsTimer_(this, ID_DIAGNOSTICS_TIMER),
+      drainQueuedAt_(0) {
+
+    std::string ip_local = engine_->LocalAddress();
+    if (ip_local.empty()) {
         ip_local = "No disponible";
     }
 
     contacts_.insert({"~", ContactInfo("Chat General", EstadoUsuario::ACTIVO)});
     contacts_.insert({usuario_, ContactInfo(usuario_, EstadoUsuario::ACTIVO)});
+    std::vector<std::string> recentChats = LoadHistoryCache(servidor);
     
     wxPanel* panel = new wxPanel(this);
     
@@ -185,6 +951,8 @@ ChatFrame::ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const s
 
     wxBoxSizer* headerSizer = new wxBoxSizer(wxHORIZONTAL);
     headerSizer->Add(logoutButton, 0, wxALL | wxALIGN_CENTER_VERTICAL, 10); 
+    diagnosticsButton = new wxButton(panel, wxID_ANY, "Diagnóstico", wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT);
+    headerSizer->Add(diagnosticsButton, 0, wxTOP | wxBOTTOM | wxALIGN_CENTER_VERTICAL, 10);
     headerSizer->AddStretchSpacer(); 
     headerSizer->Add(connectionInfoText, 0, wxALL | wxALIGN_CENTER_VERTICAL, 10); 
     
@@ -209,7 +977,10 @@ ChatFrame::ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const s
     leftSizer->Add(statusText, 0, wxALL, 5);
 
     leftSizer->Add(new wxStaticText(panel, wxID_ANY, "Contactos:"), 0, wxALL, 5);
-    contactList = new wxListBox(panel, wxID_ANY);
+    contactList = new ContactListCtrl(panel, [this](long row) {
+        auto it = contacts_.find(contactRows_[row]);
+        return it != contacts_.end() ? it->second.FormatName() : wxString();
+    });
     leftSizer->Add(contactList, 1, wxALL | wxEXPAND, 5);
 
     wxBoxSizer* contactButtonsSizer = new wxBoxSizer(wxHORIZONTAL);
@@ -222,6 +993,12 @@ ChatFrame::ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const s
     
     refreshUsersButton = new wxButton(panel, wxID_ANY, "Actualizar");
     contactButtonsSizer->Add(refreshUsersButton, 1, wxALL, 5);
+
+    roomsButton = new wxButton(panel, wxID_ANY, "Salas");
+    contactButtonsSizer->Add(roomsButton, 1, wxALL, 5);
+
+    searchButton = new wxButton(panel, wxID_ANY, "Buscar");
+    contactButtonsSizer->Add(searchButton, 1, wxALL, 5);
     
     leftSizer->Add(contactButtonsSizer, 0, wxEXPAND);
 
@@ -230,8 +1007,9 @@ ChatFrame::ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const s
     chatTitle = new wxStaticText(panel, ID_CHAT_TITLE, "Chat con: [Seleccione un contacto]");
     rightSizer->Add(chatTitle, 0, wxALL, 5);
 
-    chatBox = new wxTextCtrl(panel, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, 
-                            wxTE_MULTILINE | wxTE_READONLY | wxTE_RICH2);
+    chatBox = new TranscriptView(panel, [this]() {
+        RequestOlderHistory();
+    });
     rightSizer->Add(chatBox, 1, wxALL | wxEXPAND, 5);
 
     wxBoxSizer* inputSizer = new wxBoxSizer(wxHORIZONTAL);
@@ -256,119 +1034,389 @@ ChatFrame::ChatFrame(std::shared_ptr<websocket::stream<tcp::socket>> ws, const s
     addContactButton->Bind(wxEVT_BUTTON, &ChatFrame::OnHelp, this);
     checkUserInfoButton->Bind(wxEVT_BUTTON, &ChatFrame::OnCheckUserInfo, this);
     refreshUsersButton->Bind(wxEVT_BUTTON, &ChatFrame::OnRefreshUsers, this);
-    contactList->Bind(wxEVT_LISTBOX, &ChatFrame::OnSelectContact, this);
+    roomsButton->Bind(wxEVT_BUTTON, &ChatFrame::OnRooms, this);
+    searchButton->Bind(wxEVT_BUTTON, &ChatFrame::OnSearch, this);
+    contactList->Bind(wxEVT_LIST_ITEM_SELECTED, &ChatFrame::OnSelectContact, this);
     statusChoice->Bind(wxEVT_CHOICE, &ChatFrame::OnChangeStatus, this);
     logoutButton->Bind(wxEVT_BUTTON, &ChatFrame::OnLogout, this);
-
+    diagnosticsButton->Bind(wxEVT_BUTTON, &ChatFrame::OnDiagnostics, this);
+    Bind(wxEVT_TIMER, &ChatFrame::OnDrainTimer, this, ID_DRAIN_TIMER);
+    Bind(wxEVT_TIMER, &ChatFrame::OnPrefetchTimer, this, ID_PREFETCH_TIMER);
+    Bind(wxEVT_TIMER, &ChatFrame::OnInactivityTimer, this, ID_INACTIVITY_TIMER);
+    Bind(wxEVT_TIMER, &ChatFrame::OnDiagnosticsTimer, this, ID_DIAGNOSTICS_TIMER);
+    Bind(wxEVT_CHAR_HOOK, [this](wxKeyEvent& evt) {
+        RegistrarActividad();
+        evt.Skip();
+    });
+    messageInput->Bind(wxEVT_TEXT, &ChatFrame::OnTyping, this);
+
+    engine_->EnableReconnect(
+        [this]() {
+            return session_.Target();
+        },
+        [this](unsigned attempt, std::chrono::milliseconds delay, const beast::error_code& ec) {
+            std::string error = ec.message();
+            wxGetApp().CallAfter([this, attempt, delay, error]() {
+                MostrarReconexion(attempt, delay, error);
+            });
+        },
+        [this](const beast::error_code&) {
+            wxGetApp().CallAfter([this]() {
+                OnReconnected();
+            });
+        });
     StartReceivingMessages();
     RequestUserList();
-    MonitorearInactividad();
-    UpdateContactListUI();
-    
-    contactList->SetSelection(contactList->FindString("[A] Chat General"));
+    ArmInactivityTimer();
+
     chatPartner_ = "~";
+    UpdateContactListUI();
     chatTitle->SetLabel("Chat con: Chat General");
+    chatBox->ShowTranscript(&transcripts_[chatPartner_]);
+    LoadChatHistory();
+
+    for (size_t i = 0; i < recentChats.size() && i < PREFETCH_RECENT; i++) {
+        SchedulePrefetch(recentChats[i]);
+    }
 }
 
 ChatFrame::~ChatFrame() {
     running_ = false;
-    try {
-        ws_->close(websocket::close_code::normal);
-    } catch (...) {
-
-    }
+    drainTimer_.Stop();
+    prefetchTimer_.Stop();
+    inactivityTimer_.Stop();
+    diagnosticsTimer_.Stop();
+    engine_->Shutdown();
 }
 
 void ChatFrame::ActualizarInfoConexion() {
-    std::string ip_local;
-    try {
-        ip_local = ws_->next_layer().local_endpoint().address().to_string();
-    } catch (std::exception& e) {
+    std::string ip_local = engine_->LocalAddress();
+    if (ip_local.empty()) {
         ip_local = "No disponible";
     }
     
     wxString connectionInfo = wxString::Format("Conectado como: %s\nIP: %s", 
                                             usuario_.c_str(), ip_local.c_str());
     connectionInfoText->SetLabel(connectionInfo);
+    connectionInfoText->SetForegroundColour(wxColour(0, 128, 0));
 }
 
-void ChatFrame::RequestUserList() {
-    try {
-        std::vector<uint8_t> request = CreateListUsersMessage();
-        ws_->write(net::buffer(request));
-    } catch (const std::exception& e) {
-        wxMessageBox("Error al solicitar la lista de usuarios: " + std::string(e.what()),
-                    "Error", wxOK | wxICON_ERROR);
+void ChatFrame::MostrarReconexion(unsigned attempt, std::chrono::milliseconds delay, const std::string& error) {
+    wxString info;
+    if (attempt == 0) {
+        info = wxString::Format("Conexión perdida (%s)\nReconectando como: %s", error.c_str(), usuario_.c_str());
+    } else {
+        info = wxString::Format("Intento %u fallido (%s)\nReintento en %.1f s", attempt, error.c_str(),
+                                delay.count() / 1000.0);
     }
+    reconnectInfo_ = info;
+    MostrarDescartados();
 }
 
-void ChatFrame::LoadChatHistory() {
-    if (chatPartner_.empty()) return;
-    
-    RequestChatHistory();
-}
-
-void ChatFrame::RequestChatHistory() {
-    try {
-        std::vector<uint8_t> request = CreateGetHistoryMessage(chatPartner_);
-        ws_->write(net::buffer(request));
-    } catch (const std::exception& e) {
-        wxMessageBox("Error al solicitar historial: " + std::string(e.what()),
-                    "Error", wxOK | wxICON_ERROR);
+// Un solo aviso en la etiqueta de conexión por todos los mensajes que la cola sin conexión descartó
+void ChatFrame::MostrarDescartados() {
+    dropNoticeScheduled_ = false;
+    if (engine_->IsConnected()) return;
+    wxString info = reconnectInfo_;
+    size_t dropped = engine_->DroppedOffline();
+    if (dropped > 0) {
+        info += wxString::Format("\n%zu mensajes sin enviar descartados (cola llena)", dropped);
     }
+    connectionInfoText->SetLabel(info);
+    connectionInfoText->SetForegroundColour(wxColour(200, 100, 0));
 }
 
-bool ChatFrame::CanSendMessage() const {
-    return currentStatus_ == EstadoUsuario::ACTIVO || currentStatus_ == EstadoUsuario::INACTIVO;
+void ChatFrame::OnReconnected() {
+    syncedChats_.clear();
+    prefetchInFlight_.clear();
+    pendingHistory_.clear();
+    RequestUserList();
+    RequestResume();
+    ActualizarInfoConexion();
 }
 
-void ChatFrame::MonitorearInactividad() {
-    std::thread([this]() {
-        while (running_) {
-            std::this_thread::sleep_for(std::chrono::seconds(20));
-
-            auto tiempoActual = std::chrono::steady_clock::now();
-            auto ultimaActividadTranscurrido = std::chrono::duration_cast<std::chrono::seconds>(
-                tiempoActual - ultimaActividad_
-            ).count();
-            
-            if (ultimaActividadTranscurrido >= 20 && 
-                currentStatus_ == EstadoUsuario::ACTIVO) {
-
+// Las solicitudes de historial se anotan en orden: el servidor responde a cada una con
+// SERVER_HISTORY, SERVER_RESUME o un error que lleva su tipo. prefetchChat marca las de la precarga
+void ChatFrame::SendRequest(std::vector<uint8_t> request, const std::string& errorMessage, bool showDialog,
+                            const std::string& prefetchChat) {
+    uint8_t type = request.empty() ? 0 : request[0];
+    uint64_t pingPayload = 0;
+    if (type == CLIENT_PING) {
+        MessageReader(request).ReadUInt(pingPayload, 8);
+    }
+    if (type == CLIENT_GET_HISTORY || type == CLIENT_RESUME) {
+        historyTokens_ = HistoryTokens() - 1;
+        pendingHistory_.push_back(prefetchChat);
+    }
+    engine_->Send(std::move(request), [this, type, pingPayload, errorMessage, showDialog](const beast::error_code& ec) {
+        if (!ec) {
+            diagnostics_.RequestWritten(type, pingPayload);
+            return;
+        }
+        if (ec == net::error::no_buffer_space) {
+            if (!dropNoticeScheduled_.exchange(true)) {
                 wxGetApp().CallAfter([this]() {
-                    statusChoice->SetSelection(2);  
-                    
-                    wxCommandEvent fakeEvent(wxEVT_CHOICE, statusChoice->GetId());
-                    OnChangeStatus(fakeEvent);
+                    MostrarDescartados();
                 });
             }
+            return;
+        }
+        // Al cerrar sesión o perder la conexión fallan juntos todos los pendientes: sin un diálogo por cada uno
+        if (ec == net::error::operation_aborted || ec == websocket::error::closed || !running_) {
+            return;
         }
-    }).detach();
+        std::cerr << errorMessage << ": " << ec.message() << std::endl;
+        if (showDialog) {
+            wxGetApp().CallAfter([errorMessage, ec]() {
+                wxMessageBox(errorMessage + ": " + ec.message(), "Error", wxOK | wxICON_ERROR);
+            });
+        }
+    });
 }
 
-bool ChatFrame::IsWebSocketConnected() {
-    if (!ws_) return false;
-    
-    try {
-        return ws_->is_open() && ws_->next_layer().is_open();
-    } catch (...) {
-        return false;
+double ChatFrame::HistoryTokens() {
+    auto now = std::chrono::steady_clock::now();
+    historyTokens_ = std::min(HISTORY_BURST,
+        historyTokens_ + std::chrono::duration<double>(now - historyTokensAt_).count() * HISTORY_RATE);
+    historyTokensAt_ = now;
+    return historyTokens_;
+}
+
+std::string ChatFrame::PopPendingHistory() {
+    if (pendingHistory_.empty()) {
+        return "";
     }
+    std::string prefetchChat = std::move(pendingHistory_.front());
+    pendingHistory_.pop_front();
+    return prefetchChat;
 }
 
-void ChatFrame::OnHelp(wxCommandEvent&) {
-    wxString ayudaText = 
-        "MANUAL DE USO DEL CLIENTE DE CHAT\n"
-        "===============================\n\n"
-        "INFORMACIÓN GENERAL:\n"
-        "- En la esquina superior derecha se muestra tu nombre de usuario y la IP desde donde te conectas.\n"
+void ChatFrame::RequestUserList() {
+    SendRequest(CreateListUsersMessage(), "Error al solicitar la lista de usuarios");
+}
+
+void ChatFrame::ScheduleAcks() {
+    if (!session_.HasPendingAcks() || ackScheduled_.exchange(true)) {
+        return;
+    }
+    wxGetApp().CallAfter([this]() {
+        FlushAcks();
+    });
+}
+
+void ChatFrame::FlushAcks() {
+    ackScheduled_ = false;
+    std::vector<uint8_t> acks = session_.TakeAcks();
+    if (acks.empty()) return;
+
+    SendRequest(std::move(acks), "Error al confirmar mensajes", false);
+}
+
+void ChatFrame::RequestResume() {
+    std::vector<uint8_t> resume = session_.CreateResume();
+    if (resume.empty()) return;
+
+    SendRequest(std::move(resume), "Error al reanudar conversaciones", false);
+}
+
+void ChatFrame::SendPresenceSubscription() {
+    std::vector<std::string> users;
+    for (const auto& [name, info] : contacts_) {
+        if (name != "~" && name != usuario_ && !info.esSala) {
+            users.push_back(name);
+        }
+    }
+    std::sort(users.begin(), users.end());
+
+    if (users.size() > 255) {
+        users = {"~"};
+    }
+    if (users == presenceSubscription_) {
+        return;
+    }
+
+    SendRequest(CreateSubscribePresenceMessage(users), "Error al suscribirse a la presencia de contactos", false);
+    presenceSubscription_ = std::move(users);
+}
+
+std::vector<std::string> ChatFrame::LoadHistoryCache(const std::string& servidor) {
+    const char* home = std::getenv("HOME");
+    if (!home) home = std::getenv("USERPROFILE");
+
+    std::string name = servidor + "_" + usuario_;
+    for (char& c : name) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-') {
+            c = '_';
+        }
+    }
+    std::filesystem::path path = std::filesystem::path(home ? home : ".") / ".chat_cliente" / (name + ".cache");
+
+    std::vector<std::pair<std::string, HistoryCache::Lines>> chats;
+    std::vector<std::string> recent;
+    if (!historyCache_.Open(path.string(), chats)) {
+        return recent;
+    }
+
+    std::lock_guard<std::mutex> lock(chatHistoryMutex_);
+    for (auto& [chat, lines] : chats) {
+        recent.push_back(chat);
+        Transcript& transcript = transcripts_[chat];
+        for (auto& [line, id] : lines) {
+            session_.RaiseLastId(chat, id);
+            transcript.Append(std::move(line), id);
+        }
+    }
+    std::cout << "Caché de historial: " << chats.size() << " conversaciones desde " << path.string() << std::endl;
+    return recent;
+}
+
+// Una conversación ya sincronizada en esta conexión se muestra desde memoria; con la
+// conversación en la caché solo se piden los mensajes posteriores al último ID guardado
+void ChatFrame::LoadChatHistory() {
+    if (chatPartner_.empty()) return;
+
+    if (syncedChats_.count(chatPartner_) || prefetchInFlight_.count(chatPartner_)) {
+        return;
+    }
+    prefetchQueue_.erase(std::remove(prefetchQueue_.begin(), prefetchQueue_.end(), chatPartner_), prefetchQueue_.end());
+
+    if (NeedsFullHistory(chatPartner_)) {
+        RequestChatHistory();
+        return;
+    }
+
+    SendRequest(session_.CreateResume(chatPartner_), "Error al solicitar historial");
+}
+
+// Las salas no tienen IDs; una conversación con pocas líneas y mensajes anteriores en el
+// servidor (por ejemplo, solo lo recibido en esta sesión) se pide completa
+bool ChatFrame::NeedsFullHistory(const std::string& chat) {
+    if (chat[0] == '#') {
+        return true;
+    }
+    if (session_.LastId(chat) == 0) {
+        return true;
+    }
+    const Transcript& transcript = transcripts_[chat];
+    return transcript.Size() < HISTORY_PAGE && transcript.HasOlder();
+}
+
+void ChatFrame::SchedulePrefetch(const std::string& chat) {
+    if (chat.empty() || chat == chatPartner_ || syncedChats_.count(chat) || prefetchInFlight_.count(chat) ||
+        std::find(prefetchQueue_.begin(), prefetchQueue_.end(), chat) != prefetchQueue_.end()) {
+        return;
+    }
+    prefetchQueue_.push_back(chat);
+    if (!prefetchTimer_.IsRunning()) {
+        prefetchTimer_.Start(PREFETCH_INTERVAL_MS);
+    }
+}
+
+// Precarga con baja prioridad: solo con la conexión ociosa y sin mensajes por procesar,
+// una solicitud por tick sin gastar la reserva de historial del usuario, con un máximo
+// de solicitudes en vuelo y de bytes recibidos por conexión
+void ChatFrame::OnPrefetchTimer(wxTimerEvent&) {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = prefetchInFlight_.begin(); it != prefetchInFlight_.end();) {
+        it = now - it->second > PREFETCH_TIMEOUT ? prefetchInFlight_.erase(it) : std::next(it);
+    }
+
+    if (prefetchBytes_ >= PREFETCH_BUDGET_BYTES) {
+        prefetchQueue_.clear();
+    }
+    if (prefetchQueue_.empty() && prefetchInFlight_.empty()) {
+        prefetchTimer_.Stop();
+        return;
+    }
+    if (!engine_->IsConnected() || !engine_->IsIdle() || drainScheduled_ ||
+        HistoryTokens() < PREFETCH_RESERVE + 1) {
+        return;
+    }
+
+    while (!prefetchQueue_.empty() && prefetchInFlight_.size() < PREFETCH_MAX_IN_FLIGHT) {
+        std::string chat = std::move(prefetchQueue_.front());
+        prefetchQueue_.pop_front();
+        if (chat == chatPartner_ || syncedChats_.count(chat) ||
+            (chat[0] == '#' && contacts_.find(chat) == contacts_.end())) {
+            continue;
+        }
+
+        prefetchInFlight_[chat] = now;
+        if (NeedsFullHistory(chat)) {
+            SendRequest(CreateGetHistoryMessage(chat), "Error al precargar historial", false, chat);
+        } else {
+            SendRequest(session_.CreateResume(chat), "Error al precargar historial", false, chat);
+        }
+        break;
+    }
+}
+
+void ChatFrame::CompletePrefetch(const std::string& chat, size_t bytes) {
+    syncedChats_.insert(chat);
+    if (prefetchInFlight_.erase(chat)) {
+        prefetchBytes_ += bytes;
+    }
+}
+
+void ChatFrame::OnTyping(wxCommandEvent&) {
+    RegistrarActividad();
+    if (!prefetchQueue_.empty()) {
+        std::cout << "Precarga cancelada: " << prefetchQueue_.size() << " conversaciones pendientes" << std::endl;
+        prefetchQueue_.clear();
+    }
+}
+
+void ChatFrame::RequestChatHistory() {
+    SendRequest(CreateGetHistoryMessage(chatPartner_), "Error al solicitar historial");
+}
+
+bool ChatFrame::CanSendMessage() const {
+    return currentStatus_ == EstadoUsuario::ACTIVO || currentStatus_ == EstadoUsuario::INACTIVO;
+}
+
+void ChatFrame::RegistrarActividad() {
+    ultimaActividad_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    if (inactivoAutomatico_ && currentStatus_ == EstadoUsuario::INACTIVO) {
+        ApplyStatus(EstadoUsuario::ACTIVO, true);
+    }
+}
+
+// Solo se programa mientras el usuario está activo; la actividad no toca el temporizador,
+// basta con que al vencer compruebe la última marca y se rearme por el tiempo que falta
+void ChatFrame::ArmInactivityTimer() {
+    if (currentStatus_ != EstadoUsuario::ACTIVO) {
+        inactivityTimer_.Stop();
+        return;
+    }
+    auto ultima = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(ultimaActividad_.load()));
+    auto restante = std::chrono::duration_cast<std::chrono::milliseconds>(
+        ultima + INACTIVITY_TIMEOUT - std::chrono::steady_clock::now());
+    inactivityTimer_.StartOnce(std::max<long long>(restante.count(), 1));
+}
+
+void ChatFrame::OnInactivityTimer(wxTimerEvent&) {
+    auto ultima = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(ultimaActividad_.load()));
+    if (currentStatus_ == EstadoUsuario::ACTIVO && std::chrono::steady_clock::now() - ultima >= INACTIVITY_TIMEOUT) {
+        ApplyStatus(EstadoUsuario::INACTIVO, true);
+        return;
+    }
+    ArmInactivityTimer();
+}
+
+void ChatFrame::OnHelp(wxCommandEvent&) {
+    wxString ayudaText = 
+        "MANUAL DE USO DEL CLIENTE DE CHAT\n"
+        "===============================\n\n"
+        "INFORMACIÓN GENERAL:\n"
+        "- En la esquina superior derecha se muestra tu nombre de usuario y la IP desde donde te conectas.\n"
         "- En la esquina superior izquierda hay un botón 'Salir' para cerrar sesión y volver a la pantalla de inicio.\n\n"
         
         "GESTIÓN DE ESTADO:\n"
         "- Puedes cambiar tu estado usando el menú desplegable en la parte superior izquierda.\n"
         "- Estados disponibles: Activo, Ocupado, Inactivo.\n"
         "- En estado 'Ocupado' no recibirás mensajes nuevos.\n"
-        "- El sistema te cambiará automáticamente a 'Inactivo' tras 20 segundos sin actividad.\n\n"
+        "- El sistema te cambiará automáticamente a 'Inactivo' tras 20 segundos sin actividad\n"
+        "  y de vuelta a 'Activo' en cuanto vuelvas a escribir o interactuar.\n\n"
         
         "CONTACTOS Y CHAT:\n"
         "- La lista de la izquierda muestra todos los usuarios conectados y el Chat General.\n"
@@ -379,11 +1427,14 @@ void ChatFrame::OnHelp(wxCommandEvent&) {
         "- Ayuda: Muestra este manual de usuario.\n"
         "- Info: Muestra información detallada sobre el usuario seleccionado.\n"
         "- Actualizar: Refresca la lista de usuarios conectados.\n"
+        "- Salas: Únete a una sala (#nombre) o sal de ella si ya perteneces. Las salas aparecen con el prefijo [S].\n"
+        "- Buscar: Busca palabras en el chat general y en tus conversaciones directas.\n"
         "- Enviar: Envía el mensaje escrito (también puedes presionar Enter).\n\n"
         
         "OTRAS CARACTERÍSTICAS:\n"
         "- El historial de chat se guarda automáticamente.\n"
-        "- La aplicación intentará reconectarse automáticamente si se pierde la conexión.\n"
+        "- La aplicación intentará reconectarse automáticamente si se pierde la conexión; mientras tanto, los mensajes\n"
+        "  que envíes quedan en cola y se envían al reconectar. El estado de la conexión se muestra arriba a la derecha.\n"
         "- Los mensajes tienen un límite de 255 caracteres.";
 
     wxDialog* helpDialog = new wxDialog(this, wxID_ANY, "Manual de Uso", 
@@ -415,7 +1466,7 @@ void ChatFrame::OnHelp(wxCommandEvent&) {
 }
 
 void ChatFrame::OnSend(wxCommandEvent&) {
-    ultimaActividad_ = std::chrono::steady_clock::now();
+    RegistrarActividad();
     if (chatPartner_.empty()) {
         wxMessageBox("Seleccione un contacto primero", "Aviso", wxOK | wxICON_INFORMATION);
         return;
@@ -429,84 +1480,40 @@ void ChatFrame::OnSend(wxCommandEvent&) {
         return;
     }
 
-    if (!VerificarConexion()) {
+    std::string message = messageInput->GetValue().ToStdString();
+    if (message.empty()) return;
+    if (message.size() > 255) {
+        wxMessageBox("El mensaje es demasiado largo (máximo 255 caracteres)", 
+                    "Aviso", wxOK | wxICON_WARNING);
         return;
     }
 
-    std::string message = messageInput->GetValue().ToStdString();
-    if (message.empty()) return;
+    std::vector<uint8_t> data = CreateSendMessageMessage(chatPartner_, message, session_.NextSendId());
+    if (data.empty()) return;
 
-    try {
-        std::vector<uint8_t> data = CreateSendMessageMessage(chatPartner_, message);
-        if (data.empty()) return;
+    std::cout << "Enviando mensaje a: " << chatPartner_ << ", contenido: " << message << std::endl;
 
-        std::cout << "Enviando mensaje a: " << chatPartner_ << ", contenido: " << message << std::endl;
+    messageInput->Clear();
+    transcripts_[chatPartner_].Append(usuario_ + ": " + message);
+    chatBox->Sync();
 
-        ws_->write(net::buffer(data));
-        messageInput->Clear();
-        
-        std::string formattedMessage = usuario_ + ": " + message;
-        chatBox->AppendText(formattedMessage + "\n");
-        
-    } catch (const std::exception& e) {
-        if (ReiniciarConexion()) {
-            try {
-                std::vector<uint8_t> data = CreateSendMessageMessage(chatPartner_, message);
-                ws_->write(net::buffer(data));
-                messageInput->Clear();
-            } catch (const std::exception& e2) {
-                wxMessageBox("No se pudo enviar el mensaje: " + std::string(e2.what()),
-                            "Error", wxOK | wxICON_ERROR);
-            }
-        } else {
-            wxMessageBox("Error al enviar mensaje: " + std::string(e.what()),
-                        "Error", wxOK | wxICON_ERROR);
-        }
+    // El chat general no devuelve la copia al remitente, así que la línea se guarda sin ID
+    if (chatPartner_ == "~") {
+        historyCache_.Append(chatPartner_, usuario_ + ": " + message, 0);
     }
+
+    // Sin conexión el mensaje espera en la cola del motor; si se reenvía tras reconectar,
+    // el servidor descarta el duplicado por sendId
+    SendRequest(std::move(data), "No se pudo enviar el mensaje");
 }
 
 void ChatFrame::StartReceivingMessages() {
-    std::thread([this]() {
-        try {
-            while (running_) {
-                beast::flat_buffer buffer;
-                ws_->read(buffer);
-                
-
-                std::string data_str = beast::buffers_to_string(buffer.data());
-                std::vector<uint8_t> message(data_str.begin(), data_str.end());
-                
-                if (!message.empty()) {
-                    uint8_t code = message[0];
-                    
-                    switch (code) {
-                        case SERVER_ERROR:
-                            ProcessErrorMessage(message);
-                            break;
-                        case SERVER_LIST_USERS:
-                            ProcessListUsersMessage(message);
-                            break;
-                        case SERVER_USER_INFO:
-                            ProcessUserInfoMessage(message);
-                            break;
-                        case SERVER_NEW_USER:
-                            ProcessNewUserMessage(message);
-                            break;
-                        case SERVER_STATUS_CHANGE:
-                            ProcessStatusChangeMessage(message);
-                            break;
-                        case SERVER_MESSAGE:
-                            ProcessMessageMessage(message);
-                            break;
-                        case SERVER_HISTORY:
-                            ProcessHistoryMessage(message);
-                            break;
-                        default:
-                            break;
-                    }
-                }
-            }
-        } catch (const beast::error_code& ec) {
+    engine_->StartReading(
+        [this](std::vector<uint8_t>& message) {
+            diagnostics_.FrameReceived(message);
+            QueueMessage(message);
+        },
+        [this](const beast::error_code& ec) {
             if (ec == websocket::error::closed) {
                 wxGetApp().CallAfter([this]() {
                     wxMessageBox("Conexión cerrada por el servidor", "Aviso", wxOK | wxICON_INFORMATION);
@@ -519,14 +1526,147 @@ void ChatFrame::StartReceivingMessages() {
                     Close();
                 });
             }
-        } catch (const std::exception& e) {
-            wxGetApp().CallAfter([this, e]() {
-                wxMessageBox("Error en la conexión: " + std::string(e.what()),
-                            "Error", wxOK | wxICON_ERROR);
-                Close();
-            });
+        });
+}
+
+void ChatFrame::QueueMessage(std::vector<uint8_t>& message) {
+    while (!inbox_.Push(message)) {
+        if (!running_) return;
+        std::this_thread::yield();
+    }
+    if (!drainScheduled_.exchange(true)) {
+        drainQueuedAt_ = std::chrono::steady_clock::now().time_since_epoch().count();
+        wxGetApp().CallAfter([this]() {
+            drainTimer_.StartOnce(DRAIN_INTERVAL_MS);
+        });
+    }
+}
+
+// Aplica en una sola pasada, con la ventana congelada, todo lo que llegó desde el último tick
+void ChatFrame::OnDrainTimer(wxTimerEvent&) {
+    auto queuedAt = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(drainQueuedAt_.load()));
+    diagnostics_.UiLag(std::chrono::steady_clock::now() - queuedAt - std::chrono::milliseconds(DRAIN_INTERVAL_MS));
+
+    Freeze();
+    for (int i = 0; i < DRAIN_MAX_EVENTS && inbox_.Pop(drainBuffer_); i++) {
+        DispatchMessage(drainBuffer_);
+    }
+    ApplyPendingUpdates();
+    Thaw();
+
+    drainScheduled_ = false;
+    if (!inbox_.Empty() && !drainScheduled_.exchange(true)) {
+        drainQueuedAt_ = std::chrono::steady_clock::now().time_since_epoch().count();
+        drainTimer_.StartOnce(DRAIN_INTERVAL_MS);
+    }
+}
+
+void ChatFrame::AddTranscriptLine(const std::string& chat, std::string line, uint32_t id, bool visible) {
+    Transcript& transcript = transcripts_[chat];
+    if (id != 0) {
+        historyCache_.Append(chat, line, id);
+    }
+    if (chat != chatPartner_) {
+        SchedulePrefetch(chat);
+    }
+    if (!visible) {
+        transcript.Hold(std::move(line));
+        return;
+    }
+    transcript.Append(std::move(line), id);
+    if (chat == chatPartner_) {
+        transcriptDirty_ = true;
+    }
+}
+
+void ChatFrame::RequestOlderHistory() {
+    if (!olderHistoryChat_.empty() || chatPartner_.empty() || chatPartner_[0] == '#') {
+        return;
+    }
+    Transcript& transcript = transcripts_[chatPartner_];
+    if (!transcript.HasOlder()) {
+        return;
+    }
+    olderHistoryChat_ = chatPartner_;
+    olderHistoryBefore_ = transcript.OldestId();
+    SendRequest(CreateGetHistoryMessage(chatPartner_, olderHistoryBefore_), "Error al solicitar mensajes anteriores", false);
+}
+
+void ChatFrame::ApplyPendingUpdates() {
+    if (transcriptReset_) {
+        chatBox->ShowTranscript(&transcripts_[chatPartner_]);
+    } else if (transcriptPrepended_ > 0) {
+        chatBox->SyncPrepended(transcriptPrepended_);
+    } else if (transcriptDirty_) {
+        chatBox->Sync();
+    }
+    transcriptDirty_ = transcriptReset_ = false;
+    transcriptPrepended_ = 0;
+
+    if (contactListReset_) {
+        UpdateContactListUI();
+    } else {
+        for (const auto& name : changedContacts_) {
+            RefreshContactRow(name);
         }
-    }).detach();
+    }
+    changedContacts_.clear();
+    if (statusDirty_) {
+        UpdateStatusDisplay();
+    }
+    if (subscriptionDirty_) {
+        SendPresenceSubscription();
+    }
+    statusDirty_ = contactListReset_ = subscriptionDirty_ = false;
+}
+
+void ChatFrame::DispatchMessage(std::vector<uint8_t>& message) {
+    if (message.empty()) return;
+
+    uint8_t code = message[0];
+    switch (code) {
+        case SERVER_ERROR:
+            ProcessErrorMessage(message);
+            break;
+        case SERVER_LIST_USERS:
+            ProcessListUsersMessage(message);
+            break;
+        case SERVER_USER_INFO:
+            ProcessUserInfoMessage(message);
+            break;
+        case SERVER_NEW_USER:
+            ProcessNewUserMessage(message);
+            break;
+        case SERVER_STATUS_CHANGE:
+            ProcessStatusChangeMessage(message);
+            break;
+        case SERVER_MESSAGE:
+            ProcessMessageMessage(message);
+            break;
+        case SERVER_HISTORY:
+            ProcessHistoryMessage(message);
+            break;
+        case SERVER_ROOM_MESSAGE:
+            ProcessRoomMessage(message);
+            break;
+        case SERVER_ROOM_UPDATE:
+            ProcessRoomUpdateMessage(message);
+            break;
+        case SERVER_SEARCH_RESULTS:
+            ProcessSearchResultsMessage(message);
+            break;
+        case SERVER_MAILBOX:
+            ProcessMailboxMessage(message);
+            break;
+        case SERVER_RESUME:
+            ProcessResumeMessage(message);
+            break;
+        case SERVER_SESSION:
+            ProcessSessionMessage(message);
+            break;
+        default:
+            break;
+    }
 }
 
 void ChatFrame::OnAddContact(wxCommandEvent&) {
@@ -536,91 +1676,97 @@ void ChatFrame::OnAddContact(wxCommandEvent&) {
     if (dialog.ShowModal() == wxID_OK) {
         std::string contactName = dialog.GetValue().ToStdString();
         if (!contactName.empty()) {
-            try {
-                std::vector<uint8_t> request = CreateGetUserMessage(contactName);
-                ws_->write(net::buffer(request));
-            } catch (const std::exception& e) {
-                wxMessageBox("Error al solicitar información de usuario: " + std::string(e.what()),
-                           "Error", wxOK | wxICON_ERROR);
-            }
+            SendRequest(CreateGetUserMessage(contactName), "Error al solicitar información de usuario");
         }
     }
 }
 
-void ChatFrame::OnSelectContact(wxCommandEvent& evt) {
-    ultimaActividad_ = std::chrono::steady_clock::now();
-    wxString selectedItem = contactList->GetString(evt.GetSelection());
-    wxString contactName = selectedItem.AfterFirst(']').Trim(true).Trim(false);
-
-    if (contactName == "Chat General") {
-        chatPartner_ = "~";  
-    } else {
-        chatPartner_ = contactName.ToStdString();
+void ChatFrame::OnSelectContact(wxListEvent& evt) {
+    long row = evt.GetIndex();
+    if (restoringSelection_ || row < 0 || row >= static_cast<long>(contactRows_.size())) {
+        return;
     }
+    RegistrarActividad();
+    auto previous = transcripts_.find(chatPartner_);
+    if (previous != transcripts_.end()) {
+        previous->second.DropOlder();
+    }
+    chatPartner_ = contactRows_[row];
+    olderHistoryChat_.clear();
 
     wxString titleText = wxString("Chat con: ") + 
                       (chatPartner_ == "~" ? wxString("Chat General") : wxString(chatPartner_));
     chatTitle->SetLabel(titleText);
 
-    chatBox->Clear();
-    
-    {
-        std::lock_guard<std::mutex> lock(chatHistoryMutex_);
-        auto it = chatHistory_.find(chatPartner_);
-        if (it != chatHistory_.end()) {
-            for (const auto& [msg, mostrar] : it->second) {
-                if (mostrar) {
-                    chatBox->AppendText(msg + "\n");
-                }
-            }
-        }
-    }
-    
+    chatBox->ShowTranscript(&transcripts_[chatPartner_]);
     LoadChatHistory();
 }
 
 void ChatFrame::OnCheckUserInfo(wxCommandEvent&) {
-    if (contactList->GetSelection() == wxNOT_FOUND) {
+    long row = contactList->GetFirstSelected();
+    if (row < 0 || row >= static_cast<long>(contactRows_.size())) {
         wxMessageBox("Seleccione un usuario primero", "Aviso", wxOK | wxICON_INFORMATION);
         return;
     }
 
-    if (!VerificarConexion()) {
-        return; 
-    }
-
-    wxString selectedItem = contactList->GetString(contactList->GetSelection());
-    wxString contactName = selectedItem.AfterFirst(']').Trim(true).Trim(false);
-    std::string username = contactName.ToStdString();
+    std::string username = contactRows_[row];
     
-    if (username == "~" || username == "Chat General") {
+    if (username == "~") {
         wxMessageBox("No se puede obtener información del chat general", "Aviso", wxOK | wxICON_INFORMATION);
         return;
     }
     
-    try {
-        std::vector<uint8_t> request = CreateGetUserMessage(username);
-        ws_->write(net::buffer(request));
-    } catch (const std::exception& e) {
-        if (ReiniciarConexion()) {
-            try {
-                std::vector<uint8_t> request = CreateGetUserMessage(username);
-                ws_->write(net::buffer(request));
-            } catch (const std::exception& e2) {
-                wxMessageBox("No se pudo obtener información del usuario: " + std::string(e2.what()),
-                          "Error", wxOK | wxICON_ERROR);
-            }
-        } else {
-            wxMessageBox("Error al solicitar información de usuario: " + std::string(e.what()),
-                       "Error", wxOK | wxICON_ERROR);
-        }
-    }
+    SendRequest(CreateGetUserMessage(username), "No se pudo obtener información del usuario");
 }
 
 void ChatFrame::OnRefreshUsers(wxCommandEvent&) {
     RequestUserList();
 }
 
+void ChatFrame::OnSearch(wxCommandEvent&) {
+    RegistrarActividad();
+    wxTextEntryDialog dialog(this, "Ingrese las palabras a buscar:", "Buscar mensajes", searchQuery_);
+
+    if (dialog.ShowModal() != wxID_OK) {
+        return;
+    }
+
+    std::string query = dialog.GetValue().Trim(true).Trim(false).ToStdString();
+    if (query.empty()) {
+        return;
+    }
+
+    searchQuery_ = query;
+    RequestSearch(0);
+}
+
+void ChatFrame::RequestSearch(uint32_t beforeId) {
+    SendRequest(CreateSearchMessage(searchQuery_, beforeId, 20), "Error al buscar mensajes");
+}
+
+void ChatFrame::OnRooms(wxCommandEvent&) {
+    RegistrarActividad();
+    wxTextEntryDialog dialog(this, "Ingrese el nombre de la sala (si ya pertenece a ella, saldrá de la sala):",
+                           "Salas", "#");
+
+    if (dialog.ShowModal() != wxID_OK) {
+        return;
+    }
+
+    std::string room = dialog.GetValue().Trim(true).Trim(false).ToStdString();
+    if (room.empty() || room == "#") {
+        return;
+    }
+    if (room[0] != '#') {
+        room = "#" + room;
+    }
+
+    auto it = contacts_.find(room);
+    bool isMember = it != contacts_.end() && it->second.esSala;
+
+    SendRequest(CreateRoomMessage(isMember ? CLIENT_LEAVE_ROOM : CLIENT_JOIN_ROOM, room), "Error al actualizar la sala");
+}
+
 void ChatFrame::UpdateStatusDisplay() {
     wxString statusString;
     wxColour statusColor;
@@ -659,49 +1805,42 @@ void ChatFrame::UpdateStatusDisplay() {
         it->second.estado = currentStatus_;
     }
     
-    UpdateContactListUI();
+    RefreshContactRow(usuario_);
 }
 
 
 void ChatFrame::OnChangeStatus(wxCommandEvent&) {
-    ultimaActividad_ = std::chrono::steady_clock::now();
-    int selection = statusChoice->GetSelection();
-    EstadoUsuario newStatus;
-    
-    switch (selection) {
-        case 0: 
-            newStatus = EstadoUsuario::ACTIVO; 
-            canSendMessages_ = true;
-            break;
-        case 1: 
-            newStatus = EstadoUsuario::OCUPADO; 
-            canSendMessages_ = false;
-            break;
-        case 2: 
-            newStatus = EstadoUsuario::INACTIVO; 
-            canSendMessages_ = true;
-            break;
-        default: 
-            newStatus = EstadoUsuario::ACTIVO; 
-            canSendMessages_ = true;
-            break;
+    inactivoAutomatico_ = false;
+    RegistrarActividad();
+
+    switch (statusChoice->GetSelection()) {
+        case 1: ApplyStatus(EstadoUsuario::OCUPADO, false); break;
+        case 2: ApplyStatus(EstadoUsuario::INACTIVO, false); break;
+        default: ApplyStatus(EstadoUsuario::ACTIVO, false); break;
     }
+}
 
-    if (newStatus == EstadoUsuario::ACTIVO) {
-        std::lock_guard<std::mutex> lock(chatHistoryMutex_);
-        
-        if (!chatPartner_.empty()) {
-            auto it = chatHistory_.find(chatPartner_);
-            if (it != chatHistory_.end()) {
-                chatBox->Clear();
-                for (const auto& [msg, _] : it->second) {
-                    chatBox->AppendText(msg + "\n");
-                }
+// Los cambios automáticos por inactividad no muestran diálogos: solo actualizan la
+// etiqueta de estado y la selección
+void ChatFrame::ApplyStatus(EstadoUsuario newStatus, bool automatic) {
+    canSendMessages_ = newStatus != EstadoUsuario::OCUPADO;
+    inactivoAutomatico_ = automatic && newStatus == EstadoUsuario::INACTIVO;
+    statusChoice->SetSelection(newStatus == EstadoUsuario::OCUPADO ? 1 : newStatus == EstadoUsuario::INACTIVO ? 2 : 0);
+
+    if (newStatus != EstadoUsuario::OCUPADO) {
+        bool revealed = false;
+        for (auto& [chat, transcript] : transcripts_) {
+            if (transcript.RevealHeld()) {
+                revealed = true;
             }
         }
+        if (revealed) {
+            chatBox->Sync();
+        }
     }
     
     currentStatus_ = newStatus;
+    ArmInactivityTimer();
     
     wxString statusStr;
     wxColour statusColor;
@@ -735,162 +1874,68 @@ void ChatFrame::OnChangeStatus(wxCommandEvent&) {
     if (it != contacts_.end()) {
         it->second.estado = newStatus;
     }
-    UpdateContactListUI();
+    RefreshContactRow(usuario_);
     
-    try {
-        std::vector<uint8_t> message = CreateChangeStatusMessage(newStatus);
-        ws_->write(net::buffer(message));
-        
-        std::cout << "Enviando solicitud de cambio de estado a: " << static_cast<int>(newStatus) << std::endl;
-        std::cout << "Estado local actualizado a: " << static_cast<int>(currentStatus_) << std::endl;
-        std::cout << "Puede enviar mensajes: " << (canSendMessages_ ? "SÍ" : "NO") << std::endl;
-        
-        wxMessageBox("Estado cambiado a: " + statusStr + "\n" +
-                    "Puedes enviar mensajes: " + (canSendMessages_ ? "SÍ" : "NO"),
-                     "Cambio de estado", wxOK | wxICON_INFORMATION);
-    } catch (const std::exception& e) {
-        std::cerr << "Error al enviar cambio de estado: " << e.what() << std::endl;
-        wxMessageBox("Error al cambiar estado: " + std::string(e.what()), 
-                   "Error", wxOK | wxICON_ERROR);
-    }
-}
-
-bool ChatFrame::ReiniciarConexion() {
-    try {
+    std::cout << "Enviando solicitud de cambio de estado a: " << static_cast<int>(newStatus) << std::endl;
+    std::cout << "Estado local actualizado a: " << static_cast<int>(currentStatus_) << std::endl;
+    std::cout << "Puede enviar mensajes: " << (canSendMessages_ ? "SÍ" : "NO") << std::endl;
 
-        ws_->close(websocket::close_code::normal);
-
-        net::io_context ioc;
-        tcp::resolver resolver(ioc);
-
-        std::string ip = ws_->next_layer().remote_endpoint().address().to_string();
-        unsigned short puerto = ws_->next_layer().remote_endpoint().port();
-        
-        auto const results = resolver.resolve(ip, std::to_string(puerto));
-        
-        tcp::socket socket(ioc);
-        net::connect(socket, results);
-        
-        auto new_ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(socket));
-        new_ws->set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
-        
-        std::string host = ip;
-        std::string target = "/?name=" + usuario_;
-        
-        new_ws->handshake(host, target);
-
-        ws_ = new_ws;
-        RequestUserList();
-        
-        ActualizarInfoConexion();
-        
-        return true;
-    } catch (const std::exception& e) {
-        std::cerr << "Error al reiniciar conexión: " << e.what() << std::endl;
-        return false;
-    }
-}
-
-bool ChatFrame::VerificarConexion() {
-    if (!IsWebSocketConnected()) {
-        bool reconectado = ReiniciarConexion();
-        if (reconectado) {
-            wxMessageBox("La conexión se ha restablecido con éxito.", 
-                       "Reconexión", wxOK | wxICON_INFORMATION);
-            return true;
-        } else {
-            wxMessageBox("No se pudo restablecer la conexión con el servidor.", 
-                       "Error de Conexión", wxOK | wxICON_ERROR);
-            return false;
+    bool canSend = canSendMessages_;
+    engine_->Send(CreateChangeStatusMessage(usuario_, newStatus), [statusStr, canSend, automatic](const beast::error_code& ec) {
+        if (ec) {
+            std::cerr << "Error al enviar cambio de estado: " << ec.message() << std::endl;
         }
-    }
-    return true;
-}
-
-std::vector<uint8_t> ChatFrame::CreateListUsersMessage() {
-    return {CLIENT_LIST_USERS};
-}
-
-std::vector<uint8_t> ChatFrame::CreateGetUserMessage(const std::string& username) {
-    std::vector<uint8_t> message = {CLIENT_GET_USER, static_cast<uint8_t>(username.size())};
-    message.insert(message.end(), username.begin(), username.end());
-    return message;
+        if (automatic) {
+            return;
+        }
+        wxGetApp().CallAfter([statusStr, canSend, ec]() {
+            if (ec) {
+                wxMessageBox("Error al cambiar estado: " + ec.message(),
+                           "Error", wxOK | wxICON_ERROR);
+                return;
+            }
+            wxMessageBox("Estado cambiado a: " + statusStr + "\n" +
+                        "Puedes enviar mensajes: " + (canSend ? "SÍ" : "NO"),
+                         "Cambio de estado", wxOK | wxICON_INFORMATION);
+        });
+    });
 }
 
-std::vector<uint8_t> ChatFrame::CreateChangeStatusMessage(EstadoUsuario status) {
-    std::vector<uint8_t> message = {
-        CLIENT_CHANGE_STATUS, 
-        static_cast<uint8_t>(usuario_.size())
-    };
-    message.insert(message.end(), usuario_.begin(), usuario_.end());
-    message.push_back(static_cast<uint8_t>(status));
-    return message;
-}
+void ChatFrame::ProcessErrorMessage(const std::vector<uint8_t>& data) {
+    ServerError error;
+    if (!DecodeError(data, error)) return;
 
-std::vector<uint8_t> ChatFrame::CreateSendMessageMessage(const std::string& dest, const std::string& message) {
-    if (message.size() > 255) {
-        wxMessageBox("El mensaje es demasiado largo (máximo 255 caracteres)", 
-                    "Aviso", wxOK | wxICON_WARNING);
-        return {};
+    if (error.request == CLIENT_GET_HISTORY || error.request == CLIENT_RESUME) {
+        if (error.code == ERROR_RATE_LIMITED) {
+            historyTokens_ = 0;
+        }
+        // Los errores de la precarga no se muestran; si fue el límite de tasa, la
+        // conversación vuelve a la cola
+        std::string prefetchChat = PopPendingHistory();
+        if (!prefetchChat.empty()) {
+            prefetchInFlight_.erase(prefetchChat);
+            if (error.code == ERROR_RATE_LIMITED) {
+                SchedulePrefetch(prefetchChat);
+            }
+            return;
+        }
+        olderHistoryChat_.clear();
     }
-    
-    try {
-        std::vector<uint8_t> data = {
-            CLIENT_SEND_MESSAGE, 
-            static_cast<uint8_t>(dest.size())
-        };
-        data.insert(data.end(), dest.begin(), dest.end());
-        data.push_back(static_cast<uint8_t>(message.size()));
-        data.insert(data.end(), message.begin(), message.end());
-        return data;
-    } catch (const std::exception& e) {
-        wxMessageBox("Error al crear mensaje: " + std::string(e.what()), 
-                   "Error", wxOK | wxICON_ERROR);
-        return {};
+    // Los pings del panel de diagnóstico y las confirmaciones son automáticos: su error no se muestra
+    if (error.request == CLIENT_PING || error.request == CLIENT_ACK) {
+        return;
     }
-}
-
-std::vector<uint8_t> ChatFrame::CreateGetHistoryMessage(const std::string& chat) {
-    std::vector<uint8_t> message = {CLIENT_GET_HISTORY, static_cast<uint8_t>(chat.size())};
-    message.insert(message.end(), chat.begin(), chat.end());
-    return message;
-}
 
+    wxString errorMessage = wxString::FromUTF8(ErrorDescription(error.code));
 
-void ChatFrame::ProcessErrorMessage(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) return;
-    
-    ErrorCode errorCode = static_cast<ErrorCode>(data[1]);
-    wxString errorMessage;
-    
-    switch (errorCode) {
-        case ERROR_USER_NOT_FOUND:
-            errorMessage = "El usuario solicitado no existe";
-            break;
-        case ERROR_INVALID_STATUS:
-            errorMessage = "Estado de usuario inválido";
-            break;
-        case ERROR_EMPTY_MESSAGE:
-            errorMessage = "No se puede enviar un mensaje vacío";
-            break;
-        case ERROR_DISCONNECTED_USER:
-            errorMessage = "No se puede enviar mensaje a un usuario desconectado";
-            break;
-        default:
-            errorMessage = "Error desconocido";
-            break;
-    }
-    
     wxGetApp().CallAfter([errorMessage]() {
         wxMessageBox(errorMessage, "Error", wxOK | wxICON_ERROR);
     });
 }
 
 void ChatFrame::ProcessListUsersMessage(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) return;
-    
-    uint8_t numUsers = data[1];
-    size_t offset = 2;
+    std::vector<UserStatus> users;
+    if (!DecodeUserList(data, users) && users.empty()) return;
 
     ContactInfo chatGeneral = contacts_["~"];
     EstadoUsuario currentUserStatus = EstadoUsuario::ACTIVO;
@@ -898,265 +1943,371 @@ void ChatFrame::ProcessListUsersMessage(const std::vector<uint8_t>& data) {
     if (it != contacts_.end()) {
         currentUserStatus = it->second.estado;
     }
-    
+
+    std::vector<ContactInfo> rooms;
+    for (const auto& [name, info] : contacts_) {
+        if (info.esSala) {
+            rooms.push_back(info);
+        }
+    }
+
     contacts_.clear();
     contacts_["~"] = chatGeneral;
+    for (const auto& room : rooms) {
+        contacts_[room.nombre] = room;
+    }
 
     contacts_[usuario_] = ContactInfo(usuario_, currentUserStatus);
-    
-    for (uint8_t i = 0; i < numUsers; i++) {
-        if (offset >= data.size()) break;
-        
-        uint8_t userLen = data[offset++];
-        if (offset + userLen > data.size()) break;
-        
-        std::string username(data.begin() + offset, data.begin() + offset + userLen);
-        offset += userLen;
-        
-        if (offset >= data.size()) break;
-        
-        EstadoUsuario status = static_cast<EstadoUsuario>(data[offset++]);
 
-        if (username == usuario_) {
-            currentStatus_ = status;
+    for (const auto& user : users) {
+        if (user.name == usuario_) {
+            currentStatus_ = user.status;
         }
 
-        contacts_.emplace(username, ContactInfo(username, status));
+        contacts_.emplace(user.name, ContactInfo(user.name, user.status));
     }
-    
-    wxGetApp().CallAfter([this]() {
-        UpdateStatusDisplay();
-        UpdateContactListUI();
-    });
+
+    contactListReset_ = true;
+    statusDirty_ = true;
+    subscriptionDirty_ = true;
+    ArmInactivityTimer();
 }
 
 void ChatFrame::ProcessUserInfoMessage(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) return;
-    
-    uint8_t userLen = data[1];
-    if (2 + userLen > data.size()) return;
-    
-    std::string username(data.begin() + 2, data.begin() + 2 + userLen);
-    
-    if (2 + userLen + 1 > data.size()) return;
-    
-    EstadoUsuario status = static_cast<EstadoUsuario>(data[2 + userLen]);
-    
-    if (2 + userLen + 2 > data.size()) return;
-    
-    uint8_t ipLen = data[2 + userLen + 1];
-    if (2 + userLen + 2 + ipLen > data.size()) return;
-    
-    std::string ipAddress(data.begin() + 2 + userLen + 2, data.begin() + 2 + userLen + 2 + ipLen);
-    
+    UserInfo user;
+    if (!DecodeUserInfo(data, user)) return;
+
     std::string statusStr;
-    switch (status) {
+    switch (user.status) {
         case EstadoUsuario::ACTIVO: statusStr = "Activo"; break;
         case EstadoUsuario::OCUPADO: statusStr = "Ocupado"; break;
         case EstadoUsuario::INACTIVO: statusStr = "Inactivo"; break;
         case EstadoUsuario::DESCONECTADO: statusStr = "Desconectado"; break;
     }
-    
-    wxGetApp().CallAfter([username, statusStr, ipAddress]() {
+
+    wxGetApp().CallAfter([username = user.name, statusStr, ipAddress = user.ip]() {
         wxString info = wxString::Format(
             "Información del usuario %s:\n"
             "Estado: %s\n"
             "Dirección IP: %s",
             username, statusStr, ipAddress
         );
-        
+
         wxMessageBox(info, "Información de Usuario", wxOK | wxICON_INFORMATION);
     });
 }
 
 void ChatFrame::ProcessNewUserMessage(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) return;
-    
-    uint8_t userLen = data[1];
-    if (2 + userLen > data.size()) return;
-    
-    std::string username(data.begin() + 2, data.begin() + 2 + userLen);
-    
-    if (2 + userLen + 1 > data.size()) return;
-    
-    EstadoUsuario status = static_cast<EstadoUsuario>(data[2 + userLen]);
-    
+    UserStatus user;
+    if (!DecodeUserStatus(data, user)) return;
 
-    contacts_.emplace(username, ContactInfo(username, status));
-    
-    wxGetApp().CallAfter([this]() {
-        UpdateContactListUI();
-    });
+    contacts_.emplace(user.name, ContactInfo(user.name, user.status));
+    changedContacts_.push_back(user.name);
 }
 
 void ChatFrame::ProcessStatusChangeMessage(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) return;
-    
-    uint8_t userLen = data[1];
-    if (2 + userLen > data.size()) return;
-    
-    std::string username(data.begin() + 2, data.begin() + 2 + userLen);
-    
-    if (2 + userLen + 1 > data.size()) return;
-    
-    EstadoUsuario status = static_cast<EstadoUsuario>(data[2 + userLen]);
-    
-    auto it = contacts_.find(username);
+    UserStatus user;
+    if (!DecodeUserStatus(data, user)) return;
+
+    auto it = contacts_.find(user.name);
     if (it != contacts_.end()) {
-        it->second.estado = status;
+        it->second.estado = user.status;
     } else {
-        contacts_.emplace(username, ContactInfo(username, status));
+        contacts_.emplace(user.name, ContactInfo(user.name, user.status));
     }
 
-    if (username == usuario_) {
-        currentStatus_ = status;
-        
-        wxGetApp().CallAfter([this, status]() {
-            switch (status) {
-                case EstadoUsuario::ACTIVO:
-                    statusChoice->SetSelection(0);
-                    canSendMessages_ = true;
-                    break;
-                case EstadoUsuario::OCUPADO:
-                    statusChoice->SetSelection(1);
-                    canSendMessages_ = false;
-                    break;
-                case EstadoUsuario::INACTIVO:
-                    statusChoice->SetSelection(2);
-                    canSendMessages_ = true;
-                    break;
-                default:
-                    break;
-            }
-            
-            UpdateStatusDisplay();
-        });
+    if (user.name == usuario_) {
+        currentStatus_ = user.status;
+
+        switch (user.status) {
+            case EstadoUsuario::ACTIVO:
+                statusChoice->SetSelection(0);
+                canSendMessages_ = true;
+                break;
+            case EstadoUsuario::OCUPADO:
+                statusChoice->SetSelection(1);
+                canSendMessages_ = false;
+                break;
+            case EstadoUsuario::INACTIVO:
+                statusChoice->SetSelection(2);
+                canSendMessages_ = true;
+                break;
+            default:
+                break;
+        }
+        ArmInactivityTimer();
+        statusDirty_ = true;
     } else {
-        wxGetApp().CallAfter([this]() {
-            UpdateContactListUI();
-        });
+        changedContacts_.push_back(user.name);
     }
 }
 
 void ChatFrame::ProcessMessageMessage(const std::vector<uint8_t>& data) {
+    ChatMessage message;
+    if (!DecodeChatMessage(data, message)) return;
+
+    const std::string& origin = message.line.origin;
+    uint32_t id = message.line.id;
+    std::string formatted = origin + ": " + message.line.text;
+
+    std::string chatKey;
+    if (!message.chat.empty()) {
+        chatKey = message.chat;
+        if (!session_.RegisterMessageId(message.chat, id)) {
+            return;
+        }
+        ScheduleAcks();
+    } else if (origin == usuario_) {
+        chatKey = chatPartner_;
+    } else {
+        chatKey = (chatPartner_ == "~") ? "~" : origin;
+    }
+
+    // La copia de un mensaje propio ya se agregó a la transcripción al enviarlo
+    if (origin == usuario_) {
+        if (id != 0) {
+            historyCache_.Append(chatKey, formatted, id);
+        }
+        return;
+    }
+
+    bool mostrarMensaje = (currentStatus_ == EstadoUsuario::ACTIVO ||
+                           currentStatus_ == EstadoUsuario::INACTIVO);
+    AddTranscriptLine(chatKey, formatted, id, mostrarMensaje);
+}
+
+void ChatFrame::ProcessHistoryMessage(const std::vector<uint8_t>& data) {
+    PopPendingHistory();
     if (data.size() < 2) return;
-    
-    uint8_t originLen = data[1];
-    if (2 + originLen > data.size()) return;
-    
-    std::string origin(data.begin() + 2, data.begin() + 2 + originLen);
-    
-    if (2 + originLen + 1 > data.size()) return;
-    
-    uint8_t msgLen = data[2 + originLen];
-    if (3 + originLen + msgLen > data.size()) return;
-    
-    std::string message(data.begin() + 3 + originLen, data.begin() + 3 + originLen + msgLen);
 
-    std::string formatted = origin + ": " + message;
-    
-    {
-        std::lock_guard<std::mutex> lock(chatHistoryMutex_);
+    HistoryPage page;
+    DecodeHistory(data, page);
 
-        std::string chatKey;
-        if (origin == usuario_) {
-            chatKey = chatPartner_;
+    std::string chat = page.chat.empty() ? chatPartner_ : page.chat;
+    uint32_t lastId = page.lastId;
+    std::vector<std::pair<std::string, uint32_t>> lines;
+    lines.reserve(page.lines.size());
+    for (auto& line : page.lines) {
+        lines.push_back({line.origin + ": " + line.text, line.id});
+    }
+
+    // Una página anterior solo trae IDs menores al pedido; la respuesta completa llega hasta el último mensaje
+    bool olderPage = chat == olderHistoryChat_ && (lines.empty() || lastId < olderHistoryBefore_);
+    if (olderPage) {
+        olderHistoryChat_.clear();
+    } else if (lastId != 0) {
+        session_.RaiseLastId(chat, lastId);
+    }
+
+    Transcript& transcript = transcripts_[chat];
+    if (olderPage) {
+        size_t added = transcript.PrependOlder(std::move(lines));
+        if (chat == chatPartner_) {
+            transcriptPrepended_ += added;
+        }
+    } else {
+        if (!chat.empty() && chat[0] != '#') {
+            historyCache_.Reset(chat, lines);
+        }
+        CompletePrefetch(chat, data.size());
+        transcript.ReplaceRecent(std::move(lines));
+        if (chat == chatPartner_) {
+            transcriptReset_ = true;
+        }
+    }
+}
+
+void ChatFrame::ProcessRoomMessage(const std::vector<uint8_t>& data) {
+    RoomMessage message;
+    if (!DecodeRoomMessage(data, message)) return;
+
+    std::string formatted = message.line.origin + ": " + message.line.text;
+    bool mostrarMensaje = (currentStatus_ == EstadoUsuario::ACTIVO ||
+                           currentStatus_ == EstadoUsuario::INACTIVO);
+
+    AddTranscriptLine(message.room, formatted, 0, mostrarMensaje);
+}
+
+void ChatFrame::ProcessRoomUpdateMessage(const std::vector<uint8_t>& data) {
+    RoomUpdate update;
+    if (!DecodeRoomUpdate(data, update)) return;
+
+    const std::string& room = update.room;
+    if (update.user == usuario_) {
+        if (update.joined) {
+            contacts_[room] = ContactInfo(room, EstadoUsuario::ACTIVO, true);
         } else {
-            chatKey = (chatPartner_ == "~") ? "~" : origin;
+            contacts_.erase(room);
         }
+        changedContacts_.push_back(room);
+    }
 
-        bool mostrarMensaje = (currentStatus_ == EstadoUsuario::ACTIVO ||
-                               currentStatus_ == EstadoUsuario::INACTIVO);
-        
-        chatHistory_[chatKey].push_back({formatted, mostrarMensaje});
+    std::string formatted = "* " + update.user + (update.joined ? " se unió a " : " salió de ") + room;
+    AddTranscriptLine(room, formatted);
+}
+
+void ChatFrame::ProcessSearchResultsMessage(const std::vector<uint8_t>& data) {
+    SearchResults results;
+    if (!DecodeSearchResults(data, results)) return;
+
+    std::string text;
+    for (const auto& hit : results.hits) {
+        std::string chat = hit.chat == "~" ? "Chat General" : hit.chat;
+        text += "[" + chat + "] " + hit.line.origin + ": " + hit.line.text + "\n";
     }
 
-    if ((chatPartner_ == "~" || origin == chatPartner_) && 
-        origin != usuario_ && 
-        (currentStatus_ == EstadoUsuario::ACTIVO || 
-         currentStatus_ == EstadoUsuario::INACTIVO)) {
-        wxGetApp().CallAfter([this, formatted]() {
-            chatBox->AppendText(formatted + "\n");
-        });
+    if (text.empty()) {
+        text = "No se encontraron mensajes\n";
     }
+
+    wxGetApp().CallAfter([this, text, nextId = results.nextId]() {
+        if (nextId == 0) {
+            wxMessageBox(text, "Resultados de búsqueda: " + searchQuery_, wxOK | wxICON_INFORMATION);
+        } else if (wxMessageBox(text + "\n¿Mostrar más resultados?", "Resultados de búsqueda: " + searchQuery_,
+                                wxYES_NO | wxICON_INFORMATION) == wxYES) {
+            RequestSearch(nextId);
+        }
+    });
 }
 
-void ChatFrame::ProcessHistoryMessage(const std::vector<uint8_t>& data) {
-    if (data.size() < 2) return;
-    
-    uint8_t numMessages = data[1];
-    size_t offset = 2;
-    
-    std::vector<std::string> messages;
-    std::vector<std::pair<std::string, bool>> historicalMessages;
-    
-    for (uint8_t i = 0; i < numMessages; i++) {
-        if (offset >= data.size()) break;
-        
-        uint8_t userLen = data[offset++];
-        if (offset + userLen > data.size()) break;
-        
-        std::string username(data.begin() + offset, data.begin() + offset + userLen);
-        offset += userLen;
-        
-        if (offset >= data.size()) break;
-        
-        uint8_t msgLen = data[offset++];
-        if (offset + msgLen > data.size()) break;
-        
-        std::string message(data.begin() + offset, data.begin() + offset + msgLen);
-        offset += msgLen;
+void ChatFrame::ProcessSessionMessage(const std::vector<uint8_t>& data) {
+    std::string token;
+    if (DecodeSession(data, token)) {
+        session_.SetToken(std::move(token));
+    }
+}
 
-        std::string formatted = username + ": " + message;
-        
-        bool mostrarMensaje = (currentStatus_ == EstadoUsuario::ACTIVO ||
-                               currentStatus_ == EstadoUsuario::INACTIVO);
-        
-        historicalMessages.push_back({formatted, mostrarMensaje});
-        
-        if (mostrarMensaje) {
-            messages.push_back(formatted);
+void ChatFrame::ProcessMailboxMessage(const std::vector<uint8_t>& data) {
+    std::vector<MailboxEntry> entries;
+    if (!DecodeMailbox(data, entries)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(chatHistoryMutex_);
+        for (const auto& entry : entries) {
+            const ChatLine& line = entry.line;
+            if (line.id != 0 && !session_.RegisterMessageId(line.origin, line.id)) {
+                continue;
+            }
+
+            AddTranscriptLine(line.origin, line.origin + ": " + line.text, line.id);
         }
     }
-    
+
+    ScheduleAcks();
+
+    size_t numMessages = entries.size();
+    wxGetApp().CallAfter([numMessages]() {
+        wxMessageBox(wxString::Format("Recibiste %d mensajes mientras no estabas disponible", static_cast<int>(numMessages)),
+                     "Mensajes pendientes", wxOK | wxICON_INFORMATION);
+    });
+}
+
+void ChatFrame::ProcessResumeMessage(const std::vector<uint8_t>& data) {
+    PopPendingHistory();
+
+    std::vector<ResumeChat> chats;
+    DecodeResume(data, chats);
+    bool reloadCurrent = false;
+
     {
         std::lock_guard<std::mutex> lock(chatHistoryMutex_);
-        chatHistory_[chatPartner_] = historicalMessages;
-    }
-    
-    wxGetApp().CallAfter([this, messages]() {
-        chatBox->Clear();
-        for (const auto& msg : messages) {
-            chatBox->AppendText(msg + "\n");
+        for (const auto& resumed : chats) {
+            const std::string& chat = resumed.chat;
+
+            // Con un hueco en la conversación la caché ya no sirve: se vacía y se vuelve a llenar
+            if (!resumed.complete) {
+                transcripts_[chat] = Transcript();
+                historyCache_.Reset(chat, {});
+                session_.ResetChat(chat);
+                prefetchInFlight_.erase(chat);
+                if (chat == chatPartner_) {
+                    reloadCurrent = true;
+                    transcriptReset_ = true;
+                }
+            } else {
+                CompletePrefetch(chat, data.size());
+            }
+
+            for (const auto& line : resumed.lines) {
+                if (!session_.RegisterMessageId(chat, line.id)) {
+                    continue;
+                }
+
+                AddTranscriptLine(chat, line.origin + ": " + line.text, line.id);
+            }
         }
-    });
+    }
+
+    ScheduleAcks();
+
+    if (reloadCurrent) {
+        RequestChatHistory();
+    }
 }
 
 void ChatFrame::UpdateContactListUI() {
-    int currentSelection = contactList->GetSelection();
-    wxString currentItem = (currentSelection != wxNOT_FOUND) ? 
-                         contactList->GetString(currentSelection) : wxString();
-
-    contactList->Clear();
-    
+    contactRows_.clear();
+    contactRows_.reserve(contacts_.size());
     for (const auto& [name, info] : contacts_) {
-        contactList->Append(info.FormatName());
+        contactRows_.push_back(name);
     }
+    std::sort(contactRows_.begin(), contactRows_.end(), ContactOrder);
 
-    if (!currentItem.IsEmpty()) {
-        int pos = contactList->FindString(currentItem);
-        if (pos != wxNOT_FOUND) {
-            contactList->SetSelection(pos);
-        } else {
-            wxString contactName = currentItem.AfterFirst(']').Trim(true).Trim(false);
-            for (unsigned int i = 0; i < contactList->GetCount(); i++) {
-                if (contactList->GetString(i).AfterFirst(']').Trim(true).Trim(false) == contactName) {
-                    contactList->SetSelection(i);
-                    break;
-                }
-            }
+    contactList->SetItemCount(contactRows_.size());
+    contactList->Refresh();
+    SelectContactRow(chatPartner_);
+}
+
+// Actualiza solo la fila del contacto; si aparece o desaparece, repinta desde esa fila
+void ChatFrame::RefreshContactRow(const std::string& name) {
+    auto pos = std::lower_bound(contactRows_.begin(), contactRows_.end(), name, ContactOrder);
+    long row = pos - contactRows_.begin();
+    bool listed = pos != contactRows_.end() && *pos == name;
+    bool exists = contacts_.count(name) > 0;
+
+    if (listed == exists) {
+        if (listed) {
+            contactList->RefreshItem(row);
         }
+        return;
     }
+
+    if (exists) {
+        contactRows_.insert(pos, name);
+    } else {
+        contactRows_.erase(pos);
+    }
+    contactList->SetItemCount(contactRows_.size());
+    if (row < static_cast<long>(contactRows_.size())) {
+        contactList->RefreshItems(row, contactRows_.size() - 1);
+    }
+    SelectContactRow(chatPartner_);
+}
+
+long ChatFrame::FindContactRow(const std::string& name) const {
+    auto pos = std::lower_bound(contactRows_.begin(), contactRows_.end(), name, ContactOrder);
+    if (pos == contactRows_.end() || *pos != name) {
+        return -1;
+    }
+    return pos - contactRows_.begin();
+}
+
+void ChatFrame::SelectContactRow(const std::string& name) {
+    long row = FindContactRow(name);
+    long current = contactList->GetFirstSelected();
+    if (row == current) {
+        return;
+    }
+
+    restoringSelection_ = true;
+    if (current != -1) {
+        contactList->SetItemState(current, 0, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED);
+    }
+    if (row != -1) {
+        contactList->SetItemState(row, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED,
+                                  wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED);
+    }
+    restoringSelection_ = false;
 }
 
 class MyFrame : public wxFrame {
@@ -1198,6 +2349,7 @@ private:
     wxTextCtrl* ipInput;
     wxTextCtrl* puertoInput;
     wxStaticText* statusLabel;
+    std::shared_ptr<NetworkEngine> engine_;
 
 void OnConectar(wxCommandEvent&) {
     std::string usuario = nombreInput->GetValue().ToStdString();
@@ -1226,72 +2378,59 @@ void OnConectar(wxCommandEvent&) {
     
     statusLabel->SetLabel("Conectando...");
 
-    std::thread([this, usuario, ip, puerto]() {
-        try {
-            std::cout << "Iniciando conexión a " << ip << ":" << puerto << std::endl;
-
-            net::io_context ioc;
-            tcp::resolver resolver(ioc);
-            auto const results = resolver.resolve(ip, puerto);
-            
-            std::cout << "Dirección resuelta, conectando socket TCP..." << std::endl;
-    
-            tcp::socket socket(ioc);
-            net::connect(socket, results.begin(), results.end());
-            
-            std::cout << "Socket TCP conectado, creando stream WebSocket..." << std::endl;
+    std::cout << "Iniciando conexión a " << ip << ":" << puerto << std::endl;
 
-            auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(socket));
-
-            ws->set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
-
-            std::string host = ip;
-            std::string target = "/?name=" + usuario;
-            
-            std::cout << "Iniciando handshake WebSocket con host=" << host 
-                     << " y target=" << target << std::endl;
-    
-
-            ws->handshake(host, target);
-            std::cout << "Handshake WebSocket exitoso!" << std::endl;
-    
-
-            wxGetApp().CallAfter([this, ws, usuario]() {
-                ChatFrame* chatFrame = new ChatFrame(ws, usuario);
-                chatFrame->Show(true);
-                Close();
-            });
-        } 
-        catch (const beast::error_code& ec) {
-            wxGetApp().CallAfter([this, ec]() {
+    engine_ = std::make_shared<NetworkEngine>();
+    engine_->Connect(ip, puerto, "/?name=" + usuario, [this, usuario, ip, puerto](const beast::error_code& ec) {
+        wxGetApp().CallAfter([this, usuario, ip, puerto, ec]() {
+            if (ec) {
                 std::string errorMsg = "Error de conexión: " + ec.message();
                 statusLabel->SetLabel("Error: " + errorMsg);
                 std::cerr << errorMsg << std::endl;
-            });
-        }
-        catch (const std::exception& e) {
-            wxGetApp().CallAfter([this, e]() {
-                std::string errorMsg = e.what();
-                statusLabel->SetLabel("Error: " + errorMsg);
-                std::cerr << "Excepción: " << errorMsg << std::endl;
-            });
-        }
-        catch (...) {
-            wxGetApp().CallAfter([this]() {
-                statusLabel->SetLabel("Error: Excepción desconocida durante la conexión");
-                std::cerr << "Error desconocido durante la conexión" << std::endl;
-            });
-        }
-    }).detach();
+                engine_.reset();
+                return;
+            }
+
+            std::cout << "Handshake WebSocket exitoso!" << std::endl;
+            ChatFrame* chatFrame = new ChatFrame(engine_, usuario, ip + ":" + puerto);
+            engine_.reset();
+            chatFrame->Show(true);
+            Close();
+        });
+    });
 }
 };
 
+// El muestreo y los ping solo corren mientras el panel está abierto
+void ChatFrame::OnDiagnostics(wxCommandEvent&) {
+    if (!diagnosticsDialog_) {
+        diagnosticsDialog_ = new DiagnosticsDialog(this, diagnostics_);
+        diagnosticsDialog_->Bind(wxEVT_CLOSE_WINDOW, [this](wxCloseEvent&) {
+            diagnosticsTimer_.Stop();
+            diagnosticsDialog_->Hide();
+        });
+    }
+    if (!diagnosticsTimer_.IsRunning()) {
+        diagnostics_.Reset(engine_->GetTraffic());
+        diagnosticsTimer_.Start(DIAGNOSTICS_INTERVAL_MS);
+        SendRequest(CreatePingMessage(std::chrono::steady_clock::now().time_since_epoch().count()),
+                    "Error al medir la latencia", false);
+    }
+    diagnosticsDialog_->Show();
+    diagnosticsDialog_->Raise();
+}
+
+void ChatFrame::OnDiagnosticsTimer(wxTimerEvent&) {
+    diagnosticsDialog_->ShowSample(diagnostics_.TakeSample(engine_->GetTraffic()));
+    if (engine_->IsConnected()) {
+        SendRequest(CreatePingMessage(std::chrono::steady_clock::now().time_since_epoch().count()),
+                    "Error al medir la latencia", false);
+    }
+}
+
 void ChatFrame::OnLogout(wxCommandEvent&) {
     running_ = false;
-    try {
-        ws_->close(websocket::close_code::normal);
-    } catch (...) {
-    }
+    engine_->Shutdown();
 
     MyFrame* loginFrame = new MyFrame();
     loginFrame->Show(true);
@@ -0,0 +1,351 @@
+#include "cliente_core.hpp"
+#include <sstream>
+#include <future>
+#include <cstdlib>
+
+const auto ACK_INTERVAL = std::chrono::milliseconds(100);
+const auto EOF_GRACE = std::chrono::milliseconds(500);
+
+// Cliente de terminal: lee órdenes de stdin, una por línea, y escribe en stdout cada
+// mensaje del servidor como una línea separada por tabuladores. Sirve para bots y
+// pruebas de integración sin depender de wxWidgets.
+class CliClient {
+public:
+    CliClient(const std::string& usuario, const std::string& ip, const std::string& puerto)
+        : session_(usuario), ip_(ip), puerto_(puerto), chat_("~") {}
+
+    bool Connect();
+    void Run();
+
+private:
+    void Send(std::vector<uint8_t> request, const std::string& errorMessage);
+    void WaitIdle();
+    bool ExecuteCommand(const std::string& line);
+    void SendText(const std::string& dest, const std::string& text);
+    void FlushAcks();
+    void OnMessage(const std::vector<uint8_t>& data);
+    void PrintMessage(const std::vector<uint8_t>& data);
+    void PrintHistory(const std::vector<uint8_t>& data);
+    void PrintResume(const std::vector<uint8_t>& data);
+    void PrintSearchResults(const std::vector<uint8_t>& data);
+    void PrintMailbox(const std::vector<uint8_t>& data);
+
+    NetworkEngine engine_;
+    ClientSession session_;
+    std::string ip_;
+    std::string puerto_;
+    std::string chat_;
+    std::atomic<bool> closed_{false};
+    std::atomic<std::chrono::steady_clock::rep> lastFrame_{0};
+};
+
+bool CliClient::Connect() {
+    std::promise<beast::error_code> connected;
+    engine_.Connect(ip_, puerto_, session_.Target(), [&connected](const beast::error_code& ec) {
+        connected.set_value(ec);
+    });
+    beast::error_code ec = connected.get_future().get();
+    if (ec) {
+        std::cerr << "No se pudo conectar a " << ip_ << ":" << puerto_ << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    engine_.EnableReconnect(
+        [this]() {
+            return session_.Target();
+        },
+        [](unsigned attempt, std::chrono::milliseconds delay, const beast::error_code& ec) {
+            if (attempt == 0) {
+                std::cerr << "Conexión perdida (" << ec.message() << "), reconectando" << std::endl;
+            } else {
+                std::cerr << "Intento " << attempt << " fallido (" << ec.message() << "), reintento en "
+                          << delay.count() << " ms" << std::endl;
+            }
+        },
+        [this](const beast::error_code&) {
+            std::cerr << "Reconectado como " << session_.User() << std::endl;
+            std::vector<uint8_t> resume = session_.CreateResume();
+            if (!resume.empty()) {
+                Send(std::move(resume), "Error al reanudar conversaciones");
+            }
+        });
+    engine_.StartReading(
+        [this](std::vector<uint8_t>& data) {
+            OnMessage(data);
+        },
+        [this](const beast::error_code& ec) {
+            std::cerr << "Conexión cerrada: " << ec.message() << std::endl;
+            closed_ = true;
+        });
+
+    std::cerr << "Conectado como " << session_.User() << " (" << engine_.LocalAddress() << ")" << std::endl;
+    return true;
+}
+
+void CliClient::Send(std::vector<uint8_t> request, const std::string& errorMessage) {
+    engine_.Send(std::move(request), [errorMessage](const beast::error_code& ec) {
+        if (ec) {
+            std::cerr << errorMessage << ": " << ec.message() << std::endl;
+        }
+    });
+}
+
+void CliClient::Run() {
+    std::string line;
+    while (!closed_ && std::getline(std::cin, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        if (!ExecuteCommand(line)) {
+            break;
+        }
+    }
+
+    // Al terminar la entrada se espera a vaciar la cola y a que el servidor deje de responder
+    WaitIdle();
+    while (!closed_ && std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(
+                           std::chrono::steady_clock::duration(lastFrame_.load())) < EOF_GRACE) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    FlushAcks();
+    WaitIdle();
+    engine_.Shutdown();
+}
+
+void CliClient::WaitIdle() {
+    while (!closed_ && !engine_.IsIdle()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+bool CliClient::ExecuteCommand(const std::string& line) {
+    if (line[0] != '/') {
+        SendText(chat_, line);
+        return true;
+    }
+
+    std::istringstream input(line);
+    std::string command, arg;
+    input >> command >> arg;
+    std::string rest;
+    std::getline(input >> std::ws, rest);
+
+    if (command == "/fin") {
+        return false;
+    } else if (command == "/a" && !arg.empty()) {
+        SendText(arg, rest);
+    } else if (command == "/chat" && !arg.empty()) {
+        chat_ = arg;
+    } else if (command == "/lista") {
+        Send(CreateListUsersMessage(), "Error al solicitar la lista de usuarios");
+    } else if (command == "/info" && !arg.empty()) {
+        Send(CreateGetUserMessage(arg), "Error al solicitar información del usuario");
+    } else if (command == "/estado") {
+        EstadoUsuario status;
+        if (arg == "activo") status = EstadoUsuario::ACTIVO;
+        else if (arg == "ocupado") status = EstadoUsuario::OCUPADO;
+        else if (arg == "inactivo") status = EstadoUsuario::INACTIVO;
+        else {
+            std::cerr << "Estado inválido: " << arg << std::endl;
+            return true;
+        }
+        Send(CreateChangeStatusMessage(session_.User(), status), "Error al cambiar el estado");
+    } else if (command == "/historial") {
+        Send(CreateGetHistoryMessage(arg.empty() ? chat_ : arg), "Error al solicitar historial");
+    } else if (command == "/unirse" && !arg.empty()) {
+        Send(CreateRoomMessage(CLIENT_JOIN_ROOM, arg), "Error al unirse a la sala");
+    } else if (command == "/salir" && !arg.empty()) {
+        Send(CreateRoomMessage(CLIENT_LEAVE_ROOM, arg), "Error al salir de la sala");
+    } else if (command == "/buscar" && !arg.empty()) {
+        std::string query = rest.empty() ? arg : arg + " " + rest;
+        if (query.size() > 255) {
+            std::cerr << "La búsqueda no puede exceder los 255 caracteres" << std::endl;
+            return true;
+        }
+        Send(CreateSearchMessage(query, 0, 50), "Error al buscar mensajes");
+    } else if (command == "/esperar" && !arg.empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::atoi(arg.c_str())));
+    } else {
+        std::cerr << "Orden desconocida: " << line << std::endl;
+    }
+    return true;
+}
+
+void CliClient::SendText(const std::string& dest, const std::string& text) {
+    std::vector<uint8_t> request = CreateSendMessageMessage(dest, text, session_.NextSendId());
+    if (request.empty() || text.empty()) {
+        std::cerr << "El mensaje debe tener entre 1 y 255 caracteres" << std::endl;
+        return;
+    }
+    Send(std::move(request), "Error al enviar mensaje");
+}
+
+void CliClient::FlushAcks() {
+    std::vector<uint8_t> acks = session_.TakeAcks();
+    if (acks.empty()) return;
+
+    Send(std::move(acks), "Error al confirmar mensajes");
+}
+
+void CliClient::OnMessage(const std::vector<uint8_t>& data) {
+    lastFrame_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    if (data.empty()) return;
+
+    switch (data[0]) {
+        case SERVER_ERROR: {
+            ServerError error;
+            // Las confirmaciones salen solas; su error no es parte de la salida del script
+            if (!DecodeError(data, error) || error.request == CLIENT_ACK) break;
+            std::cout << "ERROR\t" << static_cast<int>(error.code) << "\t" << ErrorDescription(error.code) << "\n";
+            break;
+        }
+        case SERVER_LIST_USERS: {
+            std::vector<UserStatus> users;
+            DecodeUserList(data, users);
+            for (const auto& user : users) {
+                std::cout << "USUARIO\t" << user.name << "\t" << StatusName(user.status) << "\n";
+            }
+            break;
+        }
+        case SERVER_USER_INFO: {
+            UserInfo info;
+            if (DecodeUserInfo(data, info)) {
+                std::cout << "INFO\t" << info.name << "\t" << StatusName(info.status) << "\t" << info.ip << "\n";
+            }
+            break;
+        }
+        case SERVER_NEW_USER:
+        case SERVER_STATUS_CHANGE: {
+            UserStatus user;
+            if (DecodeUserStatus(data, user)) {
+                std::cout << (data[0] == SERVER_NEW_USER ? "NUEVO\t" : "ESTADO\t") << user.name << "\t"
+                          << StatusName(user.status) << "\n";
+            }
+            break;
+        }
+        case SERVER_MESSAGE:
+            PrintMessage(data);
+            break;
+        case SERVER_HISTORY:
+            PrintHistory(data);
+            break;
+        case SERVER_ROOM_MESSAGE: {
+            RoomMessage message;
+            if (DecodeRoomMessage(data, message)) {
+                std::cout << "SALA\t" << message.room << "\t" << message.line.origin << "\t" << message.line.text << "\n";
+            }
+            break;
+        }
+        case SERVER_ROOM_UPDATE: {
+            RoomUpdate update;
+            if (DecodeRoomUpdate(data, update)) {
+                std::cout << "SALA_CAMBIO\t" << update.room << "\t" << update.user << "\t"
+                          << (update.joined ? "entra" : "sale") << "\n";
+            }
+            break;
+        }
+        case SERVER_SEARCH_RESULTS:
+            PrintSearchResults(data);
+            break;
+        case SERVER_MAILBOX:
+            PrintMailbox(data);
+            break;
+        case SERVER_RESUME:
+            PrintResume(data);
+            break;
+        case SERVER_SESSION: {
+            std::string token;
+            if (DecodeSession(data, token)) {
+                session_.SetToken(std::move(token));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    std::cout.flush();
+
+    if (session_.AcksDue(ACK_INTERVAL)) {
+        FlushAcks();
+    }
+}
+
+void CliClient::PrintMessage(const std::vector<uint8_t>& data) {
+    ChatMessage message;
+    if (!DecodeChatMessage(data, message)) return;
+
+    // El servidor entrega cada mensaje en vivo una sola vez pero no siempre en orden, así que
+    // aquí solo se avanza el último id; el filtro de duplicados queda para buzón y reanudación
+    if (message.chat.empty()) {
+        message.chat = "~";
+    } else {
+        session_.RegisterMessageId(message.chat, message.line.id);
+    }
+    std::cout << "MENSAJE\t" << message.chat << "\t" << message.line.origin << "\t" << message.line.text << "\t"
+              << message.line.id << "\n";
+}
+
+void CliClient::PrintHistory(const std::vector<uint8_t>& data) {
+    HistoryPage page;
+    if (!DecodeHistory(data, page)) return;
+
+    for (const auto& line : page.lines) {
+        std::cout << "HISTORIAL\t" << page.chat << "\t" << line.origin << "\t" << line.text << "\t" << line.id << "\n";
+    }
+    if (page.lastId != 0 && page.chat.compare(0, 1, "#") != 0) {
+        session_.RegisterMessageId(page.chat, page.lastId);
+    }
+}
+
+void CliClient::PrintResume(const std::vector<uint8_t>& data) {
+    std::vector<ResumeChat> chats;
+    DecodeResume(data, chats);
+    for (const auto& chat : chats) {
+        if (!chat.complete) {
+            std::cout << "INCOMPLETO\t" << chat.chat << "\n";
+        }
+        for (const auto& line : chat.lines) {
+            if (session_.RegisterMessageId(chat.chat, line.id)) {
+                std::cout << "MENSAJE\t" << chat.chat << "\t" << line.origin << "\t" << line.text << "\t" << line.id << "\n";
+            }
+        }
+    }
+}
+
+void CliClient::PrintSearchResults(const std::vector<uint8_t>& data) {
+    SearchResults results;
+    DecodeSearchResults(data, results);
+    for (const auto& hit : results.hits) {
+        std::cout << "BUSQUEDA\t" << hit.chat << "\t" << hit.line.origin << "\t" << hit.line.text << "\t"
+                  << hit.line.id << "\t" << hit.timestamp << "\n";
+    }
+}
+
+void CliClient::PrintMailbox(const std::vector<uint8_t>& data) {
+    std::vector<MailboxEntry> entries;
+    DecodeMailbox(data, entries);
+    for (const auto& entry : entries) {
+        if (session_.RegisterMessageId(entry.line.origin, entry.line.id)) {
+            std::cout << "BUZON\t" << entry.line.origin << "\t" << entry.line.text << "\t" << entry.line.id << "\t"
+                      << entry.timestamp << "\n";
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 4) {
+        std::cerr << "Uso: " << argv[0] << " <usuario> <ip> <puerto>" << std::endl;
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+    CliClient client(argv[1], argv[2], argv[3]);
+    if (!client.Connect()) {
+        return 1;
+    }
+    client.Run();
+    return 0;
+}
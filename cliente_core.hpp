@@ -0,0 +1,1105 @@
+// Núcleo del cliente sin interfaz: tipos del protocolo, constructores de mensajes y motor
+// de red. Lo comparten el cliente gráfico (cliente.cpp) y el de terminal (cliente_cli.cpp).
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <random>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <chrono>
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+enum MessageType : uint8_t {
+    CLIENT_LIST_USERS = 1,
+    CLIENT_GET_USER = 2,
+    CLIENT_CHANGE_STATUS = 3,
+    CLIENT_SEND_MESSAGE = 4,
+    CLIENT_GET_HISTORY = 5,
+    CLIENT_JOIN_ROOM = 6,
+    CLIENT_LEAVE_ROOM = 7,
+    CLIENT_SUBSCRIBE_PRESENCE = 8,
+    CLIENT_SEARCH = 9,
+    CLIENT_RESUME = 10,
+    CLIENT_ACK = 11,
+    CLIENT_PING = 12,
+
+    SERVER_ERROR = 50,
+    SERVER_LIST_USERS = 51,
+    SERVER_USER_INFO = 52,
+    SERVER_NEW_USER = 53,
+    SERVER_STATUS_CHANGE = 54,
+    SERVER_MESSAGE = 55,
+    SERVER_HISTORY = 56,
+    SERVER_ROOM_MESSAGE = 57,
+    SERVER_ROOM_UPDATE = 58,
+    SERVER_SEARCH_RESULTS = 59,
+    SERVER_MAILBOX = 60,
+    SERVER_RESUME = 61,
+    SERVER_SESSION = 62,
+    SERVER_PONG = 63
+};
+
+enum ErrorCode : uint8_t {
+    ERROR_USER_NOT_FOUND = 1,
+    ERROR_INVALID_STATUS = 2,
+    ERROR_EMPTY_MESSAGE = 3,
+    ERROR_DISCONNECTED_USER = 4,
+    ERROR_RATE_LIMITED = 5,
+    ERROR_INVALID_ROOM = 6,
+    ERROR_NOT_IN_ROOM = 7
+};
+
+enum class EstadoUsuario : uint8_t {
+    DESCONECTADO = 0,
+    ACTIVO = 1,
+    OCUPADO = 2,
+    INACTIVO = 3
+};
+
+const auto RECONNECT_BASE_DELAY = std::chrono::milliseconds(500);
+const auto RECONNECT_MAX_DELAY = std::chrono::milliseconds(30000);
+const auto CONNECT_STAGGER = std::chrono::milliseconds(250);
+const auto CONNECT_DEADLINE = std::chrono::seconds(10);
+const auto DNS_CACHE_TTL = std::chrono::minutes(5);
+const unsigned DNS_MAX_FAILURES = 3;
+const size_t OFFLINE_QUEUE_MAX = 1000;
+
+// Buffers de trama reutilizables. Los mensajes se arman en el hilo de la interfaz y
+// se liberan en el del motor al terminar de escribirse, así que la lista es compartida.
+class FramePool {
+public:
+    static std::vector<uint8_t> Acquire(uint8_t type, size_t capacity) {
+        std::vector<uint8_t> buffer;
+        {
+            std::lock_guard<std::mutex> lock(Mutex());
+            auto& free = Free();
+            if (!free.empty() && capacity <= BUFFER_SIZE) {
+                buffer = std::move(free.back());
+                free.pop_back();
+            }
+        }
+        if (buffer.capacity() == 0) {
+            buffer.reserve(std::max(capacity, BUFFER_SIZE));
+        }
+        buffer.push_back(type);
+        return buffer;
+    }
+
+    static void Release(std::vector<uint8_t>& buffer) {
+        if (buffer.capacity() >= BUFFER_SIZE && buffer.capacity() <= BUFFER_SIZE * 4) {
+            buffer.clear();
+            std::lock_guard<std::mutex> lock(Mutex());
+            if (Free().size() < MAX_FREE) {
+                Free().push_back(std::move(buffer));
+            }
+        }
+        buffer = std::vector<uint8_t>();
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 512;
+    static constexpr size_t MAX_FREE = 64;
+
+    static std::mutex& Mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<std::vector<uint8_t>>& Free() {
+        static std::vector<std::vector<uint8_t>> free;
+        return free;
+    }
+};
+
+// Motor de red del cliente: un hilo propio con su io_context lee del WebSocket y envía
+// en orden una cola de mensajes salientes. La interfaz solo encola; los callbacks se
+// ejecutan en el hilo del motor. Con la reconexión habilitada, al perder la conexión
+// reintenta en segundo plano y los mensajes salientes esperan en la cola.
+class NetworkEngine {
+public:
+    using Stream = websocket::stream<tcp::socket>;
+    using MessageHandler = std::function<void(std::vector<uint8_t>&)>;
+    using ResultHandler = std::function<void(const beast::error_code&)>;
+    using TargetProvider = std::function<std::string()>;
+    using RetryHandler = std::function<void(unsigned attempt, std::chrono::milliseconds delay, const beast::error_code&)>;
+
+    // Totales desde que se creó el motor; quien mide calcula las tasas con dos lecturas
+    struct Traffic {
+        uint64_t framesIn = 0;
+        uint64_t bytesIn = 0;
+        uint64_t framesOut = 0;
+        uint64_t bytesOut = 0;
+    };
+
+    NetworkEngine();
+    ~NetworkEngine();
+
+    void Connect(const std::string& host, const std::string& port, const std::string& target, ResultHandler done);
+    void EnableReconnect(TargetProvider target, RetryHandler onRetry, ResultHandler onReconnected);
+    void StartReading(MessageHandler onMessage, ResultHandler onError);
+    void Send(std::vector<uint8_t> data, ResultHandler done = nullptr);
+    void Shutdown();
+
+    bool IsConnected() const { return connected_; }
+    bool IsIdle() const { return queued_ == 0; }
+    // Mensajes descartados por llenarse la cola durante la reconexión en curso
+    size_t DroppedOffline() const { return dropped_; }
+    std::string LocalAddress() const;
+    Traffic GetTraffic() const;
+
+private:
+    struct Outgoing {
+        std::vector<uint8_t> data;
+        ResultHandler done;
+    };
+
+    // Conexiones en paralelo a las direcciones resueltas (happy eyeballs): cada intento
+    // que no responde a tiempo suma el siguiente y gana el primero que conecta
+    struct Race {
+        explicit Race(net::io_context& ioc) : stagger(ioc), deadline(ioc) {}
+
+        std::vector<tcp::endpoint> endpoints;
+        std::vector<std::shared_ptr<tcp::socket>> sockets;
+        size_t next = 0;
+        size_t pending = 0;
+        bool finished = false;
+        beast::error_code error = net::error::timed_out;
+        net::steady_timer stagger;
+        net::steady_timer deadline;
+    };
+
+    void Open(const std::string& target, ResultHandler done);
+    void StartRace(const std::string& target, ResultHandler done);
+    void LaunchNext(std::shared_ptr<Race> race, const std::string& target, ResultHandler done);
+    void Handshake(tcp::socket socket, const std::string& target, ResultHandler done);
+    void Adopt(std::shared_ptr<Stream> ws);
+    void Read(std::shared_ptr<Stream> ws, std::shared_ptr<beast::flat_buffer> buffer);
+    void Flush();
+    void Lost(const beast::error_code& ec);
+    void TryReconnect();
+    void FailPending(const beast::error_code& ec);
+
+    net::io_context ioc_;
+    net::executor_work_guard<net::io_context::executor_type> work_;
+    tcp::resolver resolver_;
+    net::steady_timer retryTimer_;
+    std::thread thread_;
+
+    std::shared_ptr<Stream> ws_;
+    std::string host_;
+    std::string port_;
+    std::vector<tcp::endpoint> endpoints_;
+    std::chrono::steady_clock::time_point resolvedAt_;
+    unsigned connectFailures_;
+    std::deque<Outgoing> outbox_;
+    bool writing_;
+    bool closing_;
+    MessageHandler onMessage_;
+    ResultHandler onError_;
+    std::vector<uint8_t> message_;
+
+    TargetProvider target_;
+    RetryHandler onRetry_;
+    ResultHandler onReconnected_;
+    bool reconnecting_;
+    unsigned attempt_;
+    std::mt19937 rng_;
+
+    std::atomic<bool> connected_;
+    std::atomic<size_t> queued_;
+    std::atomic<size_t> dropped_;
+    std::atomic<uint64_t> framesIn_;
+    std::atomic<uint64_t> bytesIn_;
+    std::atomic<uint64_t> framesOut_;
+    std::atomic<uint64_t> bytesOut_;
+    mutable std::mutex addressMutex_;
+    std::string localAddress_;
+};
+
+inline NetworkEngine::NetworkEngine()
+    : work_(net::make_work_guard(ioc_)),
+      resolver_(ioc_),
+      retryTimer_(ioc_),
+      connectFailures_(0),
+      writing_(false),
+      closing_(false),
+      reconnecting_(false),
+      attempt_(0),
+      rng_(std::random_device{}()),
+      connected_(false),
+      queued_(0),
+      dropped_(0),
+      framesIn_(0),
+      bytesIn_(0),
+      framesOut_(0),
+      bytesOut_(0) {
+    thread_ = std::thread([this]() {
+        ioc_.run();
+    });
+}
+
+inline NetworkEngine::~NetworkEngine() {
+    Shutdown();
+}
+
+inline void NetworkEngine::Connect(const std::string& host, const std::string& port, const std::string& target, ResultHandler done) {
+    net::post(ioc_, [this, host, port, target, done]() {
+        host_ = host;
+        port_ = port;
+        Open(target, done);
+    });
+}
+
+inline void NetworkEngine::EnableReconnect(TargetProvider target, RetryHandler onRetry, ResultHandler onReconnected) {
+    net::post(ioc_, [this, target, onRetry, onReconnected]() {
+        target_ = target;
+        onRetry_ = onRetry;
+        onReconnected_ = onReconnected;
+    });
+}
+
+// Las direcciones resueltas se reutilizan hasta que vencen o fallan varias conexiones seguidas
+inline void NetworkEngine::Open(const std::string& target, ResultHandler done) {
+    bool cached = !endpoints_.empty() && connectFailures_ < DNS_MAX_FAILURES &&
+                  std::chrono::steady_clock::now() - resolvedAt_ < DNS_CACHE_TTL;
+    if (cached) {
+        StartRace(target, done);
+        return;
+    }
+
+    resolver_.async_resolve(host_, port_, [this, target, done](const beast::error_code& ec, tcp::resolver::results_type results) {
+        if (ec) {
+            if (endpoints_.empty()) {
+                done(ec);
+            } else {
+                StartRace(target, done);
+            }
+            return;
+        }
+
+        // Se alternan las familias de direcciones empezando por la primera que devolvió el resolver
+        std::vector<tcp::endpoint> first, second;
+        for (const auto& entry : results) {
+            tcp::endpoint endpoint = entry.endpoint();
+            (first.empty() || endpoint.protocol() == first.front().protocol() ? first : second).push_back(endpoint);
+        }
+        endpoints_.clear();
+        for (size_t i = 0; i < std::max(first.size(), second.size()); i++) {
+            if (i < first.size()) endpoints_.push_back(first[i]);
+            if (i < second.size()) endpoints_.push_back(second[i]);
+        }
+        resolvedAt_ = std::chrono::steady_clock::now();
+        connectFailures_ = 0;
+        StartRace(target, done);
+    });
+}
+
+inline void NetworkEngine::StartRace(const std::string& target, ResultHandler done) {
+    ResultHandler finish = [this, done](const beast::error_code& ec) {
+        connectFailures_ = ec ? connectFailures_ + 1 : 0;
+        done(ec);
+    };
+    if (endpoints_.empty()) {
+        finish(net::error::host_not_found);
+        return;
+    }
+
+    auto race = std::make_shared<Race>(ioc_);
+    race->endpoints = endpoints_;
+    race->deadline.expires_after(CONNECT_DEADLINE);
+    race->deadline.async_wait([race](const beast::error_code& ec) {
+        if (ec) return;
+        race->next = race->endpoints.size();
+        for (auto& socket : race->sockets) {
+            beast::error_code ignored;
+            socket->close(ignored);
+        }
+    });
+    LaunchNext(race, target, finish);
+}
+
+inline void NetworkEngine::LaunchNext(std::shared_ptr<Race> race, const std::string& target, ResultHandler done) {
+    if (race->finished || race->next >= race->endpoints.size()) {
+        return;
+    }
+
+    auto socket = std::make_shared<tcp::socket>(ioc_);
+    race->sockets.push_back(socket);
+    race->pending++;
+    socket->async_connect(race->endpoints[race->next++], [this, race, socket, target, done](const beast::error_code& ec) {
+        race->pending--;
+        if (race->finished) {
+            return;
+        }
+        if (ec) {
+            if (ec != net::error::operation_aborted) {
+                race->error = ec;
+            }
+            if (race->next < race->endpoints.size()) {
+                LaunchNext(race, target, done);
+            } else if (race->pending == 0) {
+                race->finished = true;
+                race->stagger.cancel();
+                race->deadline.cancel();
+                done(race->error);
+            }
+            return;
+        }
+
+        race->finished = true;
+        race->stagger.cancel();
+        race->deadline.cancel();
+        for (auto& other : race->sockets) {
+            if (other != socket) {
+                beast::error_code ignored;
+                other->close(ignored);
+            }
+        }
+        Handshake(std::move(*socket), target, done);
+    });
+
+    race->stagger.expires_after(CONNECT_STAGGER);
+    race->stagger.async_wait([this, race, target, done](const beast::error_code& ec) {
+        if (!ec) {
+            LaunchNext(race, target, done);
+        }
+    });
+}
+
+inline void NetworkEngine::Handshake(tcp::socket socket, const std::string& target, ResultHandler done) {
+    auto ws = std::make_shared<Stream>(std::move(socket));
+    ws->set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
+    ws->binary(true);
+    ws->async_handshake(host_, target, [this, ws, done](const beast::error_code& ec) {
+        if (!ec && !closing_) {
+            Adopt(ws);
+        }
+        done(ec);
+    });
+}
+
+inline void NetworkEngine::Adopt(std::shared_ptr<Stream> ws) {
+    if (ws_) {
+        beast::error_code ignored;
+        ws_->next_layer().close(ignored);
+    }
+    ws_ = std::move(ws);
+    writing_ = false;
+    connected_ = true;
+
+    {
+        beast::error_code ec;
+        auto endpoint = ws_->next_layer().local_endpoint(ec);
+        std::lock_guard<std::mutex> lock(addressMutex_);
+        localAddress_ = ec ? std::string() : endpoint.address().to_string();
+    }
+
+    if (onMessage_) {
+        Read(ws_, std::make_shared<beast::flat_buffer>());
+    }
+    Flush();
+}
+
+inline void NetworkEngine::StartReading(MessageHandler onMessage, ResultHandler onError) {
+    net::post(ioc_, [this, onMessage, onError]() {
+        onMessage_ = onMessage;
+        onError_ = onError;
+        if (ws_) {
+            Read(ws_, std::make_shared<beast::flat_buffer>());
+        }
+    });
+}
+
+inline void NetworkEngine::Read(std::shared_ptr<Stream> ws, std::shared_ptr<beast::flat_buffer> buffer) {
+    ws->async_read(*buffer, [this, ws, buffer](const beast::error_code& ec, std::size_t) {
+        if (ws != ws_) {
+            return;
+        }
+        if (ec) {
+            Lost(ec);
+            return;
+        }
+
+        auto bytes = static_cast<const uint8_t*>(buffer->data().data());
+        message_.assign(bytes, bytes + buffer->size());
+        buffer->consume(buffer->size());
+        framesIn_.fetch_add(1, std::memory_order_relaxed);
+        bytesIn_.fetch_add(message_.size(), std::memory_order_relaxed);
+        onMessage_(message_);
+
+        Read(ws, buffer);
+    });
+}
+
+// Sin conexión, mientras se reconecta, los mensajes esperan en la cola (hasta OFFLINE_QUEUE_MAX;
+// los más antiguos se descartan y se cuentan en DroppedOffline)
+inline void NetworkEngine::Send(std::vector<uint8_t> data, ResultHandler done) {
+    queued_++;
+    net::post(ioc_, [this, data = std::move(data), done = std::move(done)]() mutable {
+        if (closing_ || (!connected_ && !reconnecting_)) {
+            queued_--;
+            if (done) {
+                done(net::error::not_connected);
+            }
+            return;
+        }
+        outbox_.push_back({std::move(data), std::move(done)});
+        if (!connected_ && outbox_.size() > OFFLINE_QUEUE_MAX) {
+            Outgoing dropped = std::move(outbox_.front());
+            outbox_.pop_front();
+            queued_--;
+            dropped_++;
+            if (dropped.done) {
+                dropped.done(net::error::no_buffer_space);
+            }
+        }
+        Flush();
+    });
+}
+
+inline void NetworkEngine::Flush() {
+    if (writing_ || outbox_.empty() || !ws_) {
+        return;
+    }
+    writing_ = true;
+    auto ws = ws_;
+    ws->async_write(net::buffer(outbox_.front().data), [this, ws](const beast::error_code& ec, std::size_t) {
+        if (ws != ws_ || closing_) {
+            return;
+        }
+        writing_ = false;
+        if (ec) {
+            Lost(ec);
+            return;
+        }
+
+        Outgoing sent = std::move(outbox_.front());
+        outbox_.pop_front();
+        queued_--;
+        framesOut_.fetch_add(1, std::memory_order_relaxed);
+        bytesOut_.fetch_add(sent.data.size(), std::memory_order_relaxed);
+        FramePool::Release(sent.data);
+        if (sent.done) {
+            sent.done(ec);
+        }
+        Flush();
+    });
+}
+
+// El mensaje cuya escritura falló sigue al frente de la cola y se reenvía al reconectar
+inline void NetworkEngine::Lost(const beast::error_code& ec) {
+    connected_ = false;
+    writing_ = false;
+    if (closing_ || reconnecting_) {
+        return;
+    }
+    if (ws_) {
+        beast::error_code ignored;
+        ws_->next_layer().close(ignored);
+        ws_.reset();
+    }
+
+    if (!target_ || ec == websocket::error::closed) {
+        FailPending(ec);
+        if (onError_) {
+            onError_(ec);
+        }
+        return;
+    }
+
+    reconnecting_ = true;
+    attempt_ = 0;
+    onRetry_(0, std::chrono::milliseconds(0), ec);
+    TryReconnect();
+}
+
+// Espera exponencial con jitter: entre la mitad y el total del tope de cada intento
+inline void NetworkEngine::TryReconnect() {
+    Open(target_(), [this](const beast::error_code& ec) {
+        if (closing_) {
+            return;
+        }
+        if (!ec) {
+            reconnecting_ = false;
+            attempt_ = 0;
+            dropped_ = 0;
+            onReconnected_(ec);
+            return;
+        }
+
+        attempt_++;
+        auto cap = std::min(RECONNECT_MAX_DELAY, RECONNECT_BASE_DELAY * (1u << std::min(attempt_ - 1, 16u)));
+        std::uniform_int_distribution<long long> jitter(cap.count() / 2, cap.count());
+        std::chrono::milliseconds delay(jitter(rng_));
+        onRetry_(attempt_, delay, ec);
+
+        retryTimer_.expires_after(delay);
+        retryTimer_.async_wait([this](const beast::error_code& ec) {
+            if (!ec && !closing_) {
+                TryReconnect();
+            }
+        });
+    });
+}
+
+inline void NetworkEngine::FailPending(const beast::error_code& ec) {
+    std::deque<Outgoing> failed;
+    failed.swap(outbox_);
+    for (auto& pending : failed) {
+        queued_--;
+        if (pending.done) {
+            pending.done(ec);
+        }
+    }
+}
+
+inline void NetworkEngine::Shutdown() {
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    net::post(ioc_, [this]() {
+        closing_ = true;
+        retryTimer_.cancel();
+        FailPending(net::error::operation_aborted);
+        if (!ws_ || !ws_->is_open()) {
+            ioc_.stop();
+            return;
+        }
+        auto timer = std::make_shared<net::steady_timer>(ioc_, std::chrono::milliseconds(500));
+        timer->async_wait([this, timer](const beast::error_code&) {
+            ioc_.stop();
+        });
+        ws_->async_close(websocket::close_code::normal, [this](const beast::error_code&) {
+            ioc_.stop();
+        });
+    });
+
+    if (thread_.get_id() == std::this_thread::get_id()) {
+        thread_.detach();
+    } else {
+        thread_.join();
+    }
+}
+
+inline std::string NetworkEngine::LocalAddress() const {
+    std::lock_guard<std::mutex> lock(addressMutex_);
+    return localAddress_;
+}
+
+inline NetworkEngine::Traffic NetworkEngine::GetTraffic() const {
+    Traffic traffic;
+    traffic.framesIn = framesIn_.load(std::memory_order_relaxed);
+    traffic.bytesIn = bytesIn_.load(std::memory_order_relaxed);
+    traffic.framesOut = framesOut_.load(std::memory_order_relaxed);
+    traffic.bytesOut = bytesOut_.load(std::memory_order_relaxed);
+    return traffic;
+}
+
+inline const char* StatusName(EstadoUsuario status) {
+    switch (status) {
+        case EstadoUsuario::ACTIVO: return "ACTIVO";
+        case EstadoUsuario::OCUPADO: return "OCUPADO";
+        case EstadoUsuario::INACTIVO: return "INACTIVO";
+        case EstadoUsuario::DESCONECTADO: return "DESCONECTADO";
+    }
+    return "DESCONOCIDO";
+}
+
+inline const char* ErrorDescription(uint8_t code) {
+    switch (code) {
+        case ERROR_USER_NOT_FOUND: return "El usuario solicitado no existe";
+        case ERROR_INVALID_STATUS: return "Estado de usuario inválido";
+        case ERROR_EMPTY_MESSAGE: return "No se puede enviar un mensaje vacío";
+        case ERROR_DISCONNECTED_USER: return "No se puede enviar mensaje a un usuario desconectado";
+        case ERROR_RATE_LIMITED: return "Demasiadas solicitudes, espera un momento antes de volver a intentarlo";
+        case ERROR_INVALID_ROOM: return "Nombre de sala inválido, debe empezar con #";
+        case ERROR_NOT_IN_ROOM: return "No perteneces a esta sala";
+    }
+    return "Error desconocido";
+}
+
+// Los constructores toman su buffer de FramePool; NetworkEngine lo devuelve al escribirlo
+inline std::vector<uint8_t> CreateListUsersMessage() {
+    return FramePool::Acquire(CLIENT_LIST_USERS, 1);
+}
+
+inline std::vector<uint8_t> CreateGetUserMessage(const std::string& username) {
+    auto message = FramePool::Acquire(CLIENT_GET_USER, 2 + username.size());
+    message.push_back(static_cast<uint8_t>(username.size()));
+    message.insert(message.end(), username.begin(), username.end());
+    return message;
+}
+
+inline std::vector<uint8_t> CreateChangeStatusMessage(const std::string& usuario, EstadoUsuario status) {
+    auto message = FramePool::Acquire(CLIENT_CHANGE_STATUS, 3 + usuario.size());
+    message.push_back(static_cast<uint8_t>(usuario.size()));
+    message.insert(message.end(), usuario.begin(), usuario.end());
+    message.push_back(static_cast<uint8_t>(status));
+    return message;
+}
+
+// Devuelve un mensaje vacío si el texto supera los 255 bytes
+inline std::vector<uint8_t> CreateSendMessageMessage(const std::string& dest, const std::string& message, uint32_t sendId) {
+    if (message.size() > 255) {
+        return {};
+    }
+
+    auto data = FramePool::Acquire(CLIENT_SEND_MESSAGE, 7 + dest.size() + message.size());
+    data.push_back(static_cast<uint8_t>(dest.size()));
+    data.insert(data.end(), dest.begin(), dest.end());
+    data.push_back(static_cast<uint8_t>(message.size()));
+    data.insert(data.end(), message.begin(), message.end());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        data.push_back(static_cast<uint8_t>(sendId >> shift));
+    }
+    return data;
+}
+
+inline std::vector<uint8_t> CreateChatIdsMessage(MessageType type, const std::unordered_map<std::string, uint32_t>& ids) {
+    auto message = FramePool::Acquire(type, 2 + ids.size() * 16);
+    message.push_back(0);
+    for (const auto& [chat, id] : ids) {
+        if (message[1] == 255) break;
+        message.push_back(static_cast<uint8_t>(chat.size()));
+        message.insert(message.end(), chat.begin(), chat.end());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            message.push_back(static_cast<uint8_t>(id >> shift));
+        }
+        message[1]++;
+    }
+    return message;
+}
+
+inline std::vector<uint8_t> CreateGetHistoryMessage(const std::string& chat, uint32_t beforeId = 0) {
+    auto message = FramePool::Acquire(CLIENT_GET_HISTORY, 6 + chat.size());
+    message.push_back(static_cast<uint8_t>(chat.size()));
+    message.insert(message.end(), chat.begin(), chat.end());
+    if (beforeId != 0) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            message.push_back(static_cast<uint8_t>(beforeId >> shift));
+        }
+    }
+    return message;
+}
+
+inline std::vector<uint8_t> CreateSubscribePresenceMessage(const std::vector<std::string>& users) {
+    auto message = FramePool::Acquire(CLIENT_SUBSCRIBE_PRESENCE, 2 + users.size() * 16);
+    message.push_back(static_cast<uint8_t>(users.size()));
+    for (const auto& user : users) {
+        message.push_back(static_cast<uint8_t>(user.size()));
+        message.insert(message.end(), user.begin(), user.end());
+    }
+    return message;
+}
+
+inline std::vector<uint8_t> CreateSearchMessage(const std::string& query, uint32_t beforeId, uint8_t limit) {
+    auto message = FramePool::Acquire(CLIENT_SEARCH, 7 + query.size());
+    message.push_back(static_cast<uint8_t>(query.size()));
+    message.insert(message.end(), query.begin(), query.end());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        message.push_back(static_cast<uint8_t>(beforeId >> shift));
+    }
+    message.push_back(limit);
+    return message;
+}
+
+// La carga viaja de vuelta intacta en SERVER_PONG; el cliente pone ahí la hora de envío
+inline std::vector<uint8_t> CreatePingMessage(uint64_t payload) {
+    auto message = FramePool::Acquire(CLIENT_PING, 9);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        message.push_back(static_cast<uint8_t>(payload >> shift));
+    }
+    return message;
+}
+
+inline std::vector<uint8_t> CreateRoomMessage(MessageType type, const std::string& room) {
+    auto message = FramePool::Acquire(type, 2 + room.size());
+    message.push_back(static_cast<uint8_t>(room.size()));
+    message.insert(message.end(), room.begin(), room.end());
+    return message;
+}
+
+// Lectura secuencial de un mensaje del servidor; cada lectura falla si el mensaje se termina
+class MessageReader {
+public:
+    explicit MessageReader(const std::vector<uint8_t>& data, size_t offset = 1) : data_(data), offset_(offset) {}
+
+    bool ReadByte(uint8_t& value) {
+        if (offset_ >= data_.size()) return false;
+        value = data_[offset_++];
+        return true;
+    }
+
+    bool ReadUInt(uint64_t& value, int bytes) {
+        if (offset_ + bytes > data_.size()) return false;
+        value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value = (value << 8) | data_[offset_++];
+        }
+        return true;
+    }
+
+    bool ReadString(std::string& value) {
+        uint8_t len;
+        if (!ReadByte(len) || offset_ + len > data_.size()) return false;
+        value.assign(data_.begin() + offset_, data_.begin() + offset_ + len);
+        offset_ += len;
+        return true;
+    }
+
+    bool AtEnd() const {
+        return offset_ >= data_.size();
+    }
+
+private:
+    const std::vector<uint8_t>& data_;
+    size_t offset_;
+};
+
+// Mensajes del servidor ya decodificados. Las interfaces leen las tramas solo a través de
+// las funciones Decode*, que devuelven false si la trama está incompleta; en las listas se
+// conserva lo que se alcanzó a leer.
+struct ChatLine {
+    std::string origin;
+    std::string text;
+    uint32_t id = 0;
+};
+
+struct ServerError {
+    uint8_t code = 0;
+    uint8_t request = 0;    // tipo de la solicitud rechazada; 0 en servidores anteriores
+};
+
+struct UserStatus {
+    std::string name;
+    EstadoUsuario status = EstadoUsuario::DESCONECTADO;
+};
+
+struct UserInfo {
+    std::string name;
+    EstadoUsuario status = EstadoUsuario::DESCONECTADO;
+    std::string ip;
+};
+
+struct ChatMessage {
+    ChatLine line;
+    std::string chat;       // vacío en servidores sin IDs de mensaje
+};
+
+struct HistoryPage {
+    std::string chat;       // vacío en servidores sin IDs de mensaje
+    std::vector<ChatLine> lines;
+    uint32_t lastId = 0;
+};
+
+struct RoomMessage {
+    std::string room;
+    ChatLine line;
+};
+
+struct RoomUpdate {
+    std::string room;
+    std::string user;
+    bool joined = false;
+};
+
+struct SearchHit {
+    std::string chat;
+    ChatLine line;
+    uint64_t timestamp = 0;
+};
+
+struct SearchResults {
+    std::vector<SearchHit> hits;
+    uint32_t nextId = 0;    // id anterior para pedir la siguiente página; 0 si no hay más
+};
+
+struct MailboxEntry {
+    ChatLine line;          // la conversación es line.origin
+    uint64_t timestamp = 0;
+};
+
+struct ResumeChat {
+    std::string chat;
+    bool complete = true;   // false si hubo un hueco y la conversación debe pedirse completa
+    std::vector<ChatLine> lines;
+};
+
+inline bool ReadUserStatus(MessageReader& reader, UserStatus& user) {
+    uint8_t status;
+    if (!reader.ReadString(user.name) || !reader.ReadByte(status)) return false;
+    user.status = static_cast<EstadoUsuario>(status);
+    return true;
+}
+
+inline bool ReadId(MessageReader& reader, uint32_t& id) {
+    uint64_t value;
+    if (!reader.ReadUInt(value, 4)) return false;
+    id = static_cast<uint32_t>(value);
+    return true;
+}
+
+inline bool DecodeError(const std::vector<uint8_t>& data, ServerError& error) {
+    MessageReader reader(data);
+    if (!reader.ReadByte(error.code)) return false;
+    reader.ReadByte(error.request);
+    return true;
+}
+
+inline bool DecodeUserList(const std::vector<uint8_t>& data, std::vector<UserStatus>& users) {
+    MessageReader reader(data);
+    uint8_t count;
+    if (!reader.ReadByte(count)) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        UserStatus user;
+        if (!ReadUserStatus(reader, user)) return false;
+        users.push_back(std::move(user));
+    }
+    return true;
+}
+
+inline bool DecodeUserInfo(const std::vector<uint8_t>& data, UserInfo& info) {
+    MessageReader reader(data);
+    uint8_t status;
+    if (!reader.ReadString(info.name) || !reader.ReadByte(status) || !reader.ReadString(info.ip)) return false;
+    info.status = static_cast<EstadoUsuario>(status);
+    return true;
+}
+
+// SERVER_NEW_USER y SERVER_STATUS_CHANGE
+inline bool DecodeUserStatus(const std::vector<uint8_t>& data, UserStatus& user) {
+    MessageReader reader(data);
+    return ReadUserStatus(reader, user);
+}
+
+inline bool DecodeChatMessage(const std::vector<uint8_t>& data, ChatMessage& message) {
+    MessageReader reader(data);
+    if (!reader.ReadString(message.line.origin) || !reader.ReadString(message.line.text)) return false;
+    if (!ReadId(reader, message.line.id) || !reader.ReadString(message.chat)) {
+        message.line.id = 0;
+        message.chat.clear();
+    }
+    return true;
+}
+
+// Los IDs van al final, después del nombre de la conversación, en el orden de las líneas
+inline bool DecodeHistory(const std::vector<uint8_t>& data, HistoryPage& page) {
+    MessageReader reader(data);
+    uint8_t count;
+    if (!reader.ReadByte(count)) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        ChatLine line;
+        if (!reader.ReadString(line.origin) || !reader.ReadString(line.text)) return false;
+        page.lines.push_back(std::move(line));
+    }
+    if (!reader.ReadString(page.chat)) {
+        page.chat.clear();
+        return true;
+    }
+    for (size_t i = 0; !reader.AtEnd(); i++) {
+        uint32_t id;
+        if (!ReadId(reader, id)) break;
+        if (i < page.lines.size()) {
+            page.lines[i].id = id;
+        }
+        page.lastId = std::max(page.lastId, id);
+    }
+    return true;
+}
+
+inline bool DecodeRoomMessage(const std::vector<uint8_t>& data, RoomMessage& message) {
+    MessageReader reader(data);
+    return reader.ReadString(message.room) && reader.ReadString(message.line.origin) &&
+           reader.ReadString(message.line.text);
+}
+
+inline bool DecodeRoomUpdate(const std::vector<uint8_t>& data, RoomUpdate& update) {
+    MessageReader reader(data);
+    uint8_t joined;
+    if (!reader.ReadString(update.room) || !reader.ReadString(update.user) || !reader.ReadByte(joined)) return false;
+    update.joined = joined != 0;
+    return true;
+}
+
+inline bool DecodeSearchResults(const std::vector<uint8_t>& data, SearchResults& results) {
+    MessageReader reader(data);
+    uint8_t count;
+    if (!reader.ReadByte(count)) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        SearchHit hit;
+        if (!ReadId(reader, hit.line.id) || !reader.ReadString(hit.chat) || !reader.ReadString(hit.line.origin) ||
+            !reader.ReadString(hit.line.text) || !reader.ReadUInt(hit.timestamp, 8)) return false;
+        results.hits.push_back(std::move(hit));
+    }
+    ReadId(reader, results.nextId);
+    return true;
+}
+
+inline bool DecodeMailbox(const std::vector<uint8_t>& data, std::vector<MailboxEntry>& entries) {
+    MessageReader reader(data);
+    uint64_t count;
+    if (!reader.ReadUInt(count, 2)) return false;
+    for (uint64_t i = 0; i < count; i++) {
+        MailboxEntry entry;
+        if (!reader.ReadString(entry.line.origin) || !reader.ReadString(entry.line.text) ||
+            !reader.ReadUInt(entry.timestamp, 8) || !ReadId(reader, entry.line.id)) return false;
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+inline bool DecodeResume(const std::vector<uint8_t>& data, std::vector<ResumeChat>& chats) {
+    MessageReader reader(data);
+    uint8_t count;
+    if (!reader.ReadByte(count)) return false;
+    for (uint8_t c = 0; c < count; c++) {
+        ResumeChat chat;
+        uint8_t complete;
+        uint64_t lines;
+        if (!reader.ReadString(chat.chat) || !reader.ReadByte(complete) || !reader.ReadUInt(lines, 2)) return false;
+        chat.complete = complete != 0;
+        bool ok = true;
+        for (uint64_t i = 0; i < lines && ok; i++) {
+            ChatLine line;
+            ok = ReadId(reader, line.id) && reader.ReadString(line.origin) && reader.ReadString(line.text);
+            if (ok) {
+                chat.lines.push_back(std::move(line));
+            }
+        }
+        chats.push_back(std::move(chat));
+        if (!ok) return false;
+    }
+    return true;
+}
+
+inline bool DecodeSession(const std::vector<uint8_t>& data, std::string& token) {
+    MessageReader reader(data);
+    return reader.ReadString(token);
+}
+
+inline bool DecodePong(const std::vector<uint8_t>& data, uint64_t& payload) {
+    MessageReader reader(data);
+    return reader.ReadUInt(payload, 8);
+}
+
+// Estado de protocolo de una sesión, común a las dos interfaces: el último ID recibido de
+// cada conversación, las confirmaciones pendientes, el token para reanudar la sesión al
+// reconectar y los IDs de envío con los que el servidor descarta reenvíos. Seguro entre hilos.
+class ClientSession {
+public:
+    explicit ClientSession(std::string user)
+        : user_(std::move(user)), nextSendId_(std::random_device{}() | 1) {}
+
+    const std::string& User() const { return user_; }
+
+    // Ruta del handshake; con token, el servidor retoma la sesión anterior
+    std::string Target() const {
+        std::string target = "/?name=" + user_;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!token_.empty()) {
+            target += "&token=" + token_;
+        }
+        return target;
+    }
+
+    void SetToken(std::string token) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        token_ = std::move(token);
+    }
+
+    uint32_t NextSendId() {
+        uint32_t id = nextSendId_++;
+        return id != 0 ? id : nextSendId_++;
+    }
+
+    // Avanza el último ID de la conversación y lo deja pendiente de confirmar; false si ya se
+    // había recibido (un duplicado del buzón o de una reanudación)
+    bool RegisterMessageId(const std::string& chat, uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t& last = lastIds_[chat];
+        if (id <= last) {
+            return false;
+        }
+        last = id;
+        pendingAcks_[chat] = id;
+        return true;
+    }
+
+    // Para IDs que no se confirman: los de la caché local o de una página de historial
+    void RaiseLastId(const std::string& chat, uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t& last = lastIds_[chat];
+        last = std::max(last, id);
+    }
+
+    void ResetChat(const std::string& chat) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lastIds_[chat] = 0;
+    }
+
+    uint32_t LastId(const std::string& chat) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = lastIds_.find(chat);
+        return it == lastIds_.end() ? 0 : it->second;
+    }
+
+    bool HasPendingAcks() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !pendingAcks_.empty();
+    }
+
+    bool AcksDue(std::chrono::milliseconds interval) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !pendingAcks_.empty() && std::chrono::steady_clock::now() - lastAck_ >= interval;
+    }
+
+    // CLIENT_ACK con lo pendiente, o un mensaje vacío si no hay nada que confirmar
+    std::vector<uint8_t> TakeAcks() {
+        std::unordered_map<std::string, uint32_t> acks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            acks.swap(pendingAcks_);
+            lastAck_ = std::chrono::steady_clock::now();
+        }
+        if (acks.empty()) return {};
+        return CreateChatIdsMessage(CLIENT_ACK, acks);
+    }
+
+    // CLIENT_RESUME de todas las conversaciones conocidas, o vacío si no hay ninguna
+    std::vector<uint8_t> CreateResume() const {
+        std::unordered_map<std::string, uint32_t> ids;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ids = lastIds_;
+        }
+        if (ids.empty()) return {};
+        return CreateChatIdsMessage(CLIENT_RESUME, ids);
+    }
+
+    std::vector<uint8_t> CreateResume(const std::string& chat) const {
+        return CreateChatIdsMessage(CLIENT_RESUME, {{chat, LastId(chat)}});
+    }
+
+private:
+    const std::string user_;
+    std::atomic<uint32_t> nextSendId_;
+    mutable std::mutex mutex_;
+    std::string token_;
+    std::unordered_map<std::string, uint32_t> lastIds_;
+    std::unordered_map<std::string, uint32_t> pendingAcks_;
+    std::chrono::steady_clock::time_point lastAck_;
+};
@@ -1,3 +1,10 @@
+// Compilando con -DCHAT_IO_URING (Boost 1.78 o posterior, enlazando -luring)
+// Asio usa io_uring en lugar de epoll para sus operaciones asíncronas.
+#ifdef CHAT_IO_URING
+#define BOOST_ASIO_HAS_IO_URING 1
+#define BOOST_ASIO_DISABLE_EPOLL 1
+#endif
+
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/http.hpp>
@@ -5,7 +12,9 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
 #include <memory>
 #include <vector>
@@ -14,13 +23,45 @@
 #include <chrono>
 #include <fstream>
 #include <ctime>
+#include <cctype>
+#include <cstring>
 #include <iomanip>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <random>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "servidor_core.hpp"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
 namespace websocket = beast::websocket;
 namespace net = boost::asio;
 using tcp = net::ip::tcp;
+using socket_cliente = net::generic::stream_protocol::socket;
+
+#if defined(CHAT_IO_URING) && BOOST_VERSION < 107800
+#error "CHAT_IO_URING requiere Boost 1.78 o posterior"
+#endif
+
+// Backend de Asio con el que se compiló. Las sesiones leen y escriben de forma
+// síncrona en su propio hilo, así que hoy ese tráfico no pasa por el backend.
+const char* backend_io() {
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+    return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+    return "kqueue";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+    return "iocp";
+#else
+    return "select";
+#endif
+}
 
 enum MessageType : uint8_t {
     CLIENT_LIST_USERS = 1,
@@ -28,6 +69,13 @@ enum MessageType : uint8_t {
     CLIENT_CHANGE_STATUS = 3,
     CLIENT_SEND_MESSAGE = 4,
     CLIENT_GET_HISTORY = 5,
+    CLIENT_JOIN_ROOM = 6,
+    CLIENT_LEAVE_ROOM = 7,
+    CLIENT_SUBSCRIBE_PRESENCE = 8,
+    CLIENT_SEARCH = 9,
+    CLIENT_RESUME = 10,
+    CLIENT_ACK = 11,
+    CLIENT_PING = 12,
 
     SERVER_ERROR = 50,
     SERVER_LIST_USERS = 51,
@@ -35,14 +83,42 @@ enum MessageType : uint8_t {
     SERVER_NEW_USER = 53,
     SERVER_STATUS_CHANGE = 54,
     SERVER_MESSAGE = 55,
-    SERVER_HISTORY = 56
+    SERVER_HISTORY = 56,
+    SERVER_ROOM_MESSAGE = 57,
+    SERVER_ROOM_UPDATE = 58,
+    SERVER_SEARCH_RESULTS = 59,
+    SERVER_MAILBOX = 60,
+    SERVER_RESUME = 61,
+    SERVER_SESSION = 62,
+    SERVER_PONG = 63
 };
 
 enum ErrorCode : uint8_t {
     ERROR_USER_NOT_FOUND = 1,
     ERROR_INVALID_STATUS = 2,
     ERROR_EMPTY_MESSAGE = 3,
-    ERROR_DISCONNECTED_USER = 4
+    ERROR_DISCONNECTED_USER = 4,
+    ERROR_RATE_LIMITED = 5,
+    ERROR_INVALID_ROOM = 6,
+    ERROR_NOT_IN_ROOM = 7
+};
+
+enum PeerMessageType : uint8_t {
+    PEER_HELLO = 100,
+    PEER_PRESENCE = 101,
+    PEER_MESSAGE = 102,
+    PEER_BROADCAST = 103
+};
+
+enum ReplicationMessageType : uint8_t {
+    REPL_SNAPSHOT = 110,
+    REPL_BATCH = 111,
+    REPL_ACK = 112,
+
+    REPL_GENERAL = 120,
+    REPL_HISTORIAL = 121,
+    REPL_PRESENCIA = 122,
+    REPL_SALA = 123
 };
 
 enum class EstadoUsuario : uint8_t {
@@ -52,15 +128,124 @@ enum class EstadoUsuario : uint8_t {
     INACTIVO = 3
 };
 
-struct Mensaje {
-    std::string origen;
-    std::string destino;
-    std::string contenido;
-    std::chrono::system_clock::time_point timestamp;
+void agregar_cadena(std::vector<uint8_t>& mensaje, const std::string& texto) {
+    mensaje.push_back(static_cast<uint8_t>(texto.size()));
+    mensaje.insert(mensaje.end(), texto.begin(), texto.end());
+}
+
+bool leer_cadena(const std::vector<uint8_t>& datos, size_t& offset, std::string& texto) {
+    if (offset >= datos.size()) return false;
+    uint8_t len = datos[offset++];
+    if (offset + len > datos.size()) return false;
+    texto.assign(datos.begin() + offset, datos.begin() + offset + len);
+    offset += len;
+    return true;
+}
+
+void agregar_entero(std::vector<uint8_t>& mensaje, uint64_t valor, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        mensaje.push_back(static_cast<uint8_t>(valor >> (8 * i)));
+    }
+}
+
+bool leer_entero(const std::vector<uint8_t>& datos, size_t& offset, uint64_t& valor, int bytes) {
+    if (offset + bytes > datos.size()) return false;
+    valor = 0;
+    for (int i = 0; i < bytes; i++) {
+        valor = (valor << 8) | datos[offset++];
+    }
+    return true;
+}
+
+int64_t a_milisegundos(std::chrono::system_clock::time_point tiempo) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tiempo.time_since_epoch()).count();
+}
+
+std::chrono::system_clock::time_point desde_milisegundos(int64_t ms) {
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(ms)));
+}
+
+// Buffers de tramas agrupados por clase de tamaño (64 B a 64 KB, de 4 en 4).
+// Las tramas se arman en el hilo de una sesión y muchas se envían desde hilos
+// de envío que terminan con el mensaje, así que las listas libres son
+// compartidas; los buffers más grandes se liberan normalmente.
+class PoolBuffers {
+private:
+    static constexpr size_t TAM_MINIMO = 64;
+    static constexpr size_t CLASES = 6;
+    static constexpr size_t MAX_LIBRES = 64;
+
+    static size_t tamano_clase(size_t clase) {
+        return TAM_MINIMO << (2 * clase);
+    }
+
+    static std::mutex& mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::array<std::vector<std::vector<uint8_t>>, CLASES>& libres() {
+        static std::array<std::vector<std::vector<uint8_t>>, CLASES> listas;
+        return listas;
+    }
+
+    static std::atomic<uint64_t>& contador_reservas() {
+        static std::atomic<uint64_t> contador{0};
+        return contador;
+    }
+
+public:
+    static std::vector<uint8_t> obtener(size_t capacidad) {
+        size_t clase = 0;
+        while (clase < CLASES && tamano_clase(clase) < capacidad) {
+            clase++;
+        }
+        std::vector<uint8_t> buffer;
+        if (clase < CLASES) {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto& lista = libres()[clase];
+            if (!lista.empty()) {
+                buffer = std::move(lista.back());
+                lista.pop_back();
+                return buffer;
+            }
+        }
+        contador_reservas().fetch_add(1, std::memory_order_relaxed);
+        buffer.reserve(clase == CLASES ? capacidad : tamano_clase(clase));
+        return buffer;
+    }
+
+    // Buffers que el pool tuvo que reservar porque no había uno libre
+    static uint64_t reservas() {
+        return contador_reservas().load(std::memory_order_relaxed);
+    }
+
+    static std::vector<uint8_t> trama(uint8_t tipo, size_t capacidad) {
+        auto buffer = obtener(capacidad);
+        buffer.push_back(tipo);
+        return buffer;
+    }
 
-    Mensaje(std::string org, std::string dest, std::string cont)
-        : origen(std::move(org)), destino(std::move(dest)), contenido(std::move(cont)), 
-        timestamp(std::chrono::system_clock::now()) {}
+    static void devolver(std::vector<uint8_t>& buffer) {
+        size_t capacidad = buffer.capacity();
+        if (capacidad < TAM_MINIMO || capacidad > tamano_clase(CLASES - 1) * 2) {
+            return;
+        }
+        size_t clase = 0;
+        while (clase + 1 < CLASES && tamano_clase(clase + 1) <= capacidad) {
+            clase++;
+        }
+        buffer.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto& lista = libres()[clase];
+            if (lista.size() < MAX_LIBRES) {
+                lista.push_back(std::move(buffer));
+            }
+        }
+        buffer = std::vector<uint8_t>();
+    }
 };
 
 class Logger {
@@ -98,18 +283,185 @@ public:
     }
 };
 
+class TokenBucket {
+private:
+    double tasa;
+    double rafaga;
+    double tokens;
+    std::chrono::steady_clock::time_point ultima_recarga;
+
+public:
+    TokenBucket(double tasa = 0, double rafaga = 0)
+        : tasa(tasa), rafaga(rafaga), tokens(rafaga), ultima_recarga(std::chrono::steady_clock::now()) {}
+
+    bool consumir() {
+        if (tasa <= 0) {
+            return true;
+        }
+
+        auto ahora = std::chrono::steady_clock::now();
+        double transcurrido = std::chrono::duration<double>(ahora - ultima_recarga).count();
+        ultima_recarga = ahora;
+        tokens = std::min(rafaga, tokens + transcurrido * tasa);
+
+        if (tokens < 1.0) {
+            return false;
+        }
+        tokens -= 1.0;
+        return true;
+    }
+};
+
+struct LimiteTasa {
+    double tasa;
+    double rafaga;
+};
+
+// Índice 0 (no es un tipo CLIENT_*) corresponde a los envíos al chat general "~".
+constexpr uint8_t LIMITE_CHAT_GENERAL = 0;
+
+struct ConfigLimites {
+    std::array<LimiteTasa, 16> por_tipo{};
+};
+
+class LimitadorTasa {
+private:
+    std::array<TokenBucket, 16> buckets;
+    bool configurado_ = false;
+
+public:
+    LimitadorTasa() {}
+
+    explicit LimitadorTasa(const ConfigLimites& config) : configurado_(true) {
+        for (size_t i = 0; i < buckets.size(); i++) {
+            buckets[i] = TokenBucket(config.por_tipo[i].tasa, config.por_tipo[i].rafaga);
+        }
+    }
+
+    bool configurado() const {
+        return configurado_;
+    }
+
+    bool permitir(uint8_t tipo) {
+        if (tipo >= buckets.size()) {
+            return true;
+        }
+        return buckets[tipo].consumir();
+    }
+};
+
+struct LimitadorIp {
+    LimitadorTasa limitador;
+    std::mutex mutex;
+
+    explicit LimitadorIp(const ConfigLimites& config) : limitador(config) {}
+
+    bool permitir(uint8_t tipo) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return limitador.permitir(tipo);
+    }
+};
+
+// Mensajes directos pendientes de un usuario desconectado u ocupado. Se
+// guardan ya codificados en un único buffer para entregarlos en una sola
+// trama SERVER_MAILBOX.
+class Buzon {
+private:
+    struct Entrada {
+        uint32_t bytes;
+        std::chrono::system_clock::time_point timestamp;
+    };
+
+    std::vector<uint8_t> datos;
+    size_t inicio = 0;
+    std::deque<Entrada> entradas;
+
+    void descartar_primero() {
+        inicio += entradas.front().bytes;
+        entradas.pop_front();
+        if (entradas.empty()) {
+            datos.clear();
+            inicio = 0;
+        } else if (inicio > datos.size() / 2) {
+            datos.erase(datos.begin(), datos.begin() + inicio);
+            inicio = 0;
+        }
+    }
+
+public:
+    size_t descartados = 0;
+
+    size_t size() const {
+        return entradas.size();
+    }
+
+    size_t bytes() const {
+        return datos.size() - inicio + entradas.size() * sizeof(Entrada);
+    }
+
+    void agregar(const Mensaje& mensaje, size_t max_mensajes) {
+        if (max_mensajes == 0) {
+            return;
+        }
+        while (entradas.size() >= max_mensajes) {
+            descartar_primero();
+            descartados++;
+        }
+        size_t antes = datos.size();
+        agregar_cadena(datos, mensaje.origen());
+        agregar_cadena(datos, mensaje.contenido());
+        agregar_entero(datos, a_milisegundos(mensaje.timestamp), 8);
+        agregar_entero(datos, mensaje.id, 4);
+        entradas.push_back(Entrada{static_cast<uint32_t>(datos.size() - antes), mensaje.timestamp});
+    }
+
+    std::vector<uint8_t> extraer_trama(std::chrono::seconds max_edad) {
+        auto limite = std::chrono::system_clock::now() - max_edad;
+        while (!entradas.empty() && entradas.front().timestamp < limite) {
+            descartar_primero();
+            descartados++;
+        }
+
+        std::vector<uint8_t> trama;
+        if (entradas.empty()) {
+            return trama;
+        }
+        trama.reserve(3 + datos.size() - inicio);
+        trama.push_back(SERVER_MAILBOX);
+        agregar_entero(trama, entradas.size(), 2);
+        trama.insert(trama.end(), datos.begin() + inicio, datos.end());
+
+        datos.clear();
+        inicio = 0;
+        entradas.clear();
+        return trama;
+    }
+};
+
 class Usuario {
 public:
+    uint32_t id;
     std::string nombre;
     EstadoUsuario estado;
-    std::shared_ptr<websocket::stream<tcp::socket>> ws_stream;
+    std::shared_ptr<websocket::stream<socket_cliente>> ws_stream;
     std::deque<Mensaje> historial_mensajes;
     std::chrono::system_clock::time_point ultima_actividad;
     net::ip::address ip_address;
-
-    Usuario(std::string nombre, std::shared_ptr<websocket::stream<tcp::socket>> ws, 
+    std::mutex escritura_mutex;
+    LimitadorTasa limitador;
+    std::shared_ptr<LimitadorIp> limitador_ip;
+    Buzon buzon;
+    std::unordered_map<std::string, uint32_t> confirmados;
+    std::deque<uint32_t> envios_recientes;
+    std::string token_sesion;
+    bool en_gracia = false;
+    EstadoUsuario estado_previo = EstadoUsuario::ACTIVO;
+    std::chrono::steady_clock::time_point gracia_hasta;
+
+    Usuario(uint32_t id, std::string nombre, std::shared_ptr<websocket::stream<socket_cliente>> ws, 
             net::ip::address ip)
-        : nombre(std::move(nombre)), 
+        : id(id),
+          nombre(std::move(nombre)), 
           estado(EstadoUsuario::ACTIVO), 
           ws_stream(ws),
           ultima_actividad(std::chrono::system_clock::now()),
@@ -126,21 +478,446 @@ public:
     void actualizar_actividad() {
         ultima_actividad = std::chrono::system_clock::now();
     }
+
+    void enviar(const std::vector<uint8_t>& mensaje) {
+        std::lock_guard<std::mutex> lock(escritura_mutex);
+        ws_stream->write(net::buffer(mensaje));
+    }
+
+    bool es_envio_repetido(uint32_t id_cliente) {
+        if (id_cliente == 0) {
+            return false;
+        }
+        if (std::find(envios_recientes.begin(), envios_recientes.end(), id_cliente) != envios_recientes.end()) {
+            return true;
+        }
+        envios_recientes.push_back(id_cliente);
+        if (envios_recientes.size() > 64) {
+            envios_recientes.pop_front();
+        }
+        return false;
+    }
+
+    bool permitir_solicitud(uint8_t tipo) {
+        if (!limitador.permitir(tipo)) {
+            return false;
+        }
+        return !limitador_ip || limitador_ip->permitir(tipo);
+    }
+};
+
+using RegistroUsuarios = RegistroNombres<std::shared_ptr<Usuario>>;
+
+// Usuario desconectado hace tiempo, compactado fuera del registro activo:
+// su historial queda serializado y se restaura si vuelve o recibe mensajes.
+struct UsuarioFrio {
+    uint32_t id;
+    std::vector<uint8_t> historial;
+    Buzon buzon;
+    std::unordered_map<std::string, uint32_t> confirmados;
+    std::vector<std::string> salas;
+    uint64_t generacion;
+    size_t bytes;
+};
+
+template <typename T>
+class Anillo {
+private:
+    std::vector<T> datos;
+    size_t capacidad;
+    size_t inicio = 0;
+
+public:
+    explicit Anillo(size_t capacidad) : capacidad(capacidad) {
+        datos.reserve(capacidad);
+    }
+
+    void push(T valor) {
+        if (datos.size() < capacidad) {
+            datos.push_back(std::move(valor));
+        } else {
+            datos[inicio] = std::move(valor);
+            inicio = (inicio + 1) % capacidad;
+        }
+    }
+
+    size_t size() const {
+        return datos.size();
+    }
+
+    const T& operator[](size_t i) const {
+        return datos[(inicio + i) % datos.size()];
+    }
+};
+
+struct MiembroSala {
+    uint32_t id;
+    std::weak_ptr<Usuario> usuario;
+};
+
+class Sala {
+public:
+    std::string nombre;
+    std::vector<MiembroSala> miembros;
+    Anillo<Mensaje> historial;
+    std::mutex mutex;
+
+    explicit Sala(std::string nombre) : nombre(std::move(nombre)), historial(1000) {}
+
+    bool contiene(uint32_t id) const {
+        auto it = std::lower_bound(miembros.begin(), miembros.end(), id,
+                                   [](const MiembroSala& m, uint32_t valor) { return m.id < valor; });
+        return it != miembros.end() && it->id == id;
+    }
+
+    bool agregar(const std::shared_ptr<Usuario>& usuario) {
+        auto it = std::lower_bound(miembros.begin(), miembros.end(), usuario->id,
+                                   [](const MiembroSala& m, uint32_t valor) { return m.id < valor; });
+        if (it != miembros.end() && it->id == usuario->id) {
+            return false;
+        }
+        miembros.insert(it, MiembroSala{usuario->id, usuario});
+        return true;
+    }
+
+    bool quitar(uint32_t id) {
+        auto it = std::lower_bound(miembros.begin(), miembros.end(), id,
+                                   [](const MiembroSala& m, uint32_t valor) { return m.id < valor; });
+        if (it == miembros.end() || it->id != id) {
+            return false;
+        }
+        miembros.erase(it);
+        return true;
+    }
+
+    std::vector<std::shared_ptr<Usuario>> conectados() {
+        std::vector<std::shared_ptr<Usuario>> resultado;
+        resultado.reserve(miembros.size());
+        for (auto it = miembros.begin(); it != miembros.end();) {
+            auto usuario = it->usuario.lock();
+            if (!usuario) {
+                it = miembros.erase(it);
+                continue;
+            }
+            if (usuario->estado != EstadoUsuario::DESCONECTADO) {
+                resultado.push_back(std::move(usuario));
+            }
+            ++it;
+        }
+        return resultado;
+    }
+};
+
+struct CambioPresencia {
+    std::string nombre;
+    EstadoUsuario estado;
+    bool nuevo;
+};
+
+// Agrupa las transiciones de presencia de cada usuario durante una ventana
+// y al vencer solo entrega el cambio neto respecto al último estado emitido.
+class AgregadorPresencia {
+private:
+    struct Pendiente {
+        EstadoUsuario inicial;
+        EstadoUsuario final;
+        uint32_t transiciones;
+        std::chrono::steady_clock::time_point plazo;
+    };
+
+    std::chrono::milliseconds ventana;
+    std::unordered_map<std::string, EstadoUsuario> emitidos;
+    std::unordered_map<std::string, Pendiente> pendientes;
+    uint64_t total_emitidas = 0;
+    uint64_t total_suprimidas = 0;
+    std::mutex mutex;
+
+public:
+    explicit AgregadorPresencia(std::chrono::milliseconds ventana = std::chrono::milliseconds(0)) : ventana(ventana) {}
+
+    void configurar_ventana(std::chrono::milliseconds nueva) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ventana = nueva;
+    }
+
+    bool activo() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ventana.count() > 0;
+    }
+
+    void registrar(const std::string& nombre, EstadoUsuario estado) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pendientes.find(nombre);
+        if (it == pendientes.end()) {
+            auto it_emitido = emitidos.find(nombre);
+            EstadoUsuario inicial = it_emitido != emitidos.end() ? it_emitido->second : EstadoUsuario::DESCONECTADO;
+            it = pendientes.emplace(nombre, Pendiente{inicial, estado, 0,
+                                                      std::chrono::steady_clock::now() + ventana}).first;
+        }
+        it->second.final = estado;
+        it->second.transiciones++;
+    }
+
+    std::vector<CambioPresencia> extraer_vencidos() {
+        std::vector<CambioPresencia> cambios;
+        auto ahora = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = pendientes.begin(); it != pendientes.end();) {
+            if (it->second.plazo > ahora) {
+                ++it;
+                continue;
+            }
+            const auto& pendiente = it->second;
+            if (pendiente.final == pendiente.inicial) {
+                total_suprimidas += pendiente.transiciones;
+            } else {
+                total_suprimidas += pendiente.transiciones - 1;
+                total_emitidas++;
+                cambios.push_back(CambioPresencia{it->first, pendiente.final,
+                                                  pendiente.inicial == EstadoUsuario::DESCONECTADO});
+            }
+            if (pendiente.final == EstadoUsuario::DESCONECTADO) {
+                emitidos.erase(it->first);
+            } else {
+                emitidos[it->first] = pendiente.final;
+            }
+            it = pendientes.erase(it);
+        }
+        return cambios;
+    }
+
+    uint64_t emitidas() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total_emitidas;
+    }
+
+    uint64_t suprimidas() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total_suprimidas;
+    }
+};
+
+// Los enlaces entre nodos usan TCP plano: cada trama va precedida de su
+// longitud en 4 bytes big-endian y empieza con un PeerMessageType.
+void escribir_trama_tcp(tcp::socket& socket, const std::vector<uint8_t>& datos) {
+    uint32_t len = static_cast<uint32_t>(datos.size());
+    uint8_t cabecera[4] = {
+        static_cast<uint8_t>(len >> 24), static_cast<uint8_t>(len >> 16),
+        static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len)
+    };
+    std::array<net::const_buffer, 2> buffers = {net::buffer(cabecera), net::buffer(datos)};
+    net::write(socket, buffers);
+}
+
+std::vector<uint8_t> leer_trama_tcp(tcp::socket& socket) {
+    uint8_t cabecera[4];
+    net::read(socket, net::buffer(cabecera));
+    uint32_t len = (uint32_t(cabecera[0]) << 24) | (uint32_t(cabecera[1]) << 16) |
+                   (uint32_t(cabecera[2]) << 8) | uint32_t(cabecera[3]);
+    if (len > (1u << 20)) {
+        throw std::runtime_error("Trama TCP demasiado grande: " + std::to_string(len));
+    }
+    std::vector<uint8_t> datos(len);
+    net::read(socket, net::buffer(datos));
+    return datos;
+}
+
+const size_t PEER_COLA_MAX_BYTES = 64 * 1024 * 1024;
+
+// Con iniciar_escritor() las tramas se encolan y un hilo propio del enlace las escribe,
+// así que enviar() no bloquea aunque se llame con usuarios_mutex tomado y el otro nodo
+// no lea. Si la cola supera PEER_COLA_MAX_BYTES el enlace se cierra. Sin escritor (los
+// seguidores de replicación) la escritura es directa.
+struct EnlacePeer {
+    std::string id;
+    bool saliente;
+    tcp::socket socket;
+    std::mutex escritura_mutex;
+    std::condition_variable cola_cv;
+    std::deque<std::vector<uint8_t>> cola;
+    size_t bytes_en_cola = 0;
+    bool cerrado = false;
+    std::thread escritor;
+
+    EnlacePeer(tcp::socket s, bool es_saliente) : saliente(es_saliente), socket(std::move(s)) {}
+
+    ~EnlacePeer() {
+        cerrar();
+        if (escritor.joinable()) {
+            escritor.join();
+        }
+    }
+
+    void iniciar_escritor() {
+        escritor = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(escritura_mutex);
+            while (true) {
+                cola_cv.wait(lock, [this]() { return cerrado || !cola.empty(); });
+                if (cerrado) {
+                    return;
+                }
+                auto datos = std::move(cola.front());
+                cola.pop_front();
+                bytes_en_cola -= datos.size();
+
+                lock.unlock();
+                try {
+                    escribir_trama_tcp(socket, datos);
+                } catch (const std::exception&) {
+                    cerrar();
+                }
+                lock.lock();
+            }
+        });
+    }
+
+    void enviar(const std::vector<uint8_t>& datos) {
+        std::lock_guard<std::mutex> lock(escritura_mutex);
+        if (!escritor.joinable()) {
+            escribir_trama_tcp(socket, datos);
+            return;
+        }
+        if (cerrado) {
+            throw std::runtime_error("enlace cerrado");
+        }
+        if (bytes_en_cola + datos.size() > PEER_COLA_MAX_BYTES) {
+            throw std::runtime_error("cola de salida llena");
+        }
+        cola.push_back(datos);
+        bytes_en_cola += datos.size();
+        cola_cv.notify_one();
+    }
+
+    void cerrar() {
+        if (escritor.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(escritura_mutex);
+                cerrado = true;
+            }
+            cola_cv.notify_all();
+        }
+        beast::error_code ec;
+        socket.shutdown(tcp::socket::shutdown_both, ec);
+    }
+};
+
+struct UsuarioRemoto {
+    std::string nodo;
+    EstadoUsuario estado;
+    std::string ip;
+};
+
+struct EntradaReplicacion {
+    uint64_t seq;
+    std::chrono::steady_clock::time_point publicada;
+    std::vector<uint8_t> datos;
 };
 
 class ChatServer {
 private:
-    std::unordered_map<std::string, std::shared_ptr<Usuario>> usuarios;
+    RegistroUsuarios usuarios;
     std::mutex usuarios_mutex;
     std::deque<Mensaje> chat_general;
     std::mutex chat_general_mutex;
+    uint32_t secuencia_general = 0;
+    std::unordered_map<std::string, uint32_t> secuencias_directas;
     Logger logger;
     std::chrono::seconds timeout_inactividad;
     std::atomic<bool> running;
 
+    std::string id_nodo;
+    std::unordered_map<std::string, std::shared_ptr<EnlacePeer>> peers;
+    std::mutex peers_mutex;
+    std::unordered_map<std::string, UsuarioRemoto> usuarios_remotos;
+    std::mutex usuarios_remotos_mutex;
+
+    std::deque<EntradaReplicacion> registro_replicacion;
+    uint64_t siguiente_seq_replicacion = 1;
+    std::mutex replicacion_mutex;
+    std::condition_variable replicacion_cv;
+    std::atomic<bool> replicacion_activa;
+    std::atomic<bool> modo_seguidor;
+
+    ConfigLimites limites_usuario;
+    ConfigLimites limites_ip;
+    std::array<bool, 16> limites_ip_explicitos{};
+    std::unordered_map<std::string, std::weak_ptr<LimitadorIp>> limitadores_ip;
+    std::mutex limitadores_ip_mutex;
+
+    std::atomic<uint32_t> siguiente_id_usuario;
+    std::unordered_map<std::string, std::shared_ptr<Sala>> salas;
+    std::mutex salas_mutex;
+
+    std::unordered_map<std::string, std::unordered_set<std::string>> observadores;
+    std::unordered_map<std::string, std::unordered_set<std::string>> suscripciones;
+    std::unordered_set<std::string> observadores_globales;
+    std::mutex suscripciones_mutex;
+
+    AgregadorPresencia agregador_presencia;
+    IndiceBusqueda indice_busqueda;
+
+    size_t buzon_max_mensajes = 200;
+    std::chrono::seconds buzon_max_edad = std::chrono::hours(72);
+    std::chrono::seconds gracia_sesion = std::chrono::seconds(30);
+
+    std::unordered_map<std::string, UsuarioFrio> usuarios_frios;
+    std::deque<std::pair<uint64_t, std::string>> orden_frios;
+    uint64_t generacion_fria = 0;
+    size_t memoria_fria = 0;
+    size_t presupuesto_frio = 64 * 1024 * 1024;
+    std::chrono::seconds espera_frio = std::chrono::minutes(30);
+
+    void procesar_presencia_pendiente() {
+        auto ultimo_reporte = std::chrono::steady_clock::now();
+        uint64_t suprimidas_reportadas = 0;
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            for (const auto& cambio : agregador_presencia.extraer_vencidos()) {
+                auto mensaje = cambio.nuevo ? crear_mensaje_nuevo_usuario(cambio.nombre, cambio.estado)
+                                            : crear_mensaje_cambio_estado(cambio.nombre, cambio.estado);
+                notificar_observadores(cambio.nombre, mensaje, false, false);
+                PoolBuffers::devolver(mensaje);
+            }
+
+            expirar_sesiones();
+
+            if (std::chrono::steady_clock::now() - ultimo_reporte >= std::chrono::seconds(60)) {
+                ultimo_reporte = std::chrono::steady_clock::now();
+                uint64_t suprimidas = agregador_presencia.suprimidas();
+                if (suprimidas != suprimidas_reportadas) {
+                    suprimidas_reportadas = suprimidas;
+                    logger.log("Métricas presencia: " + std::to_string(agregador_presencia.emitidas()) +
+                               " notificaciones emitidas, " + std::to_string(suprimidas) + " suprimidas");
+                }
+            }
+        }
+    }
+
+    // Cierra las sesiones cuya ventana de gracia venció sin reconexión: recién
+    // entonces se difunde el DESCONECTADO y se liberan las suscripciones.
+    void expirar_sesiones() {
+        auto ahora = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(usuarios_mutex);
+        for (auto& [nombre, usuario] : usuarios) {
+            if (!usuario->en_gracia || ahora < usuario->gracia_hasta) {
+                continue;
+            }
+            usuario->en_gracia = false;
+            usuario->token_sesion.clear();
+            logger.log("Sesión de " + nombre + " expirada tras la ventana de gracia");
+            cancelar_suscripciones(nombre);
+            notificar_cambio_estado(nombre, EstadoUsuario::DESCONECTADO, true);
+        }
+    }
+
     void check_inactivity() {
         while (running) {
             std::this_thread::sleep_for(std::chrono::seconds(10)); 
+
+            if (modo_seguidor) {
+                continue;
+            }
             
             auto ahora = std::chrono::system_clock::now();
             std::lock_guard<std::mutex> lock(usuarios_mutex);
@@ -154,103 +931,268 @@ private:
                         usuario->estado = EstadoUsuario::INACTIVO;
                         logger.log("Usuario " + nombre + " cambiado a INACTIVO por timeout");
 
-                        std::vector<uint8_t> notificacion = crear_mensaje_cambio_estado(nombre, usuario->estado);
-                        broadcast_mensaje(notificacion);
+                        notificar_cambio_estado(nombre, usuario->estado, true);
                     }
                 }
             }
-        }
-    }
 
-    std::vector<uint8_t> crear_mensaje_error(ErrorCode codigo) {
-        std::vector<uint8_t> mensaje = {SERVER_ERROR, static_cast<uint8_t>(codigo)};
-        return mensaje;
+            enfriar_usuarios();
+        }
     }
 
-    std::vector<uint8_t> crear_mensaje_lista_usuarios() {
-        std::lock_guard<std::mutex> lock(usuarios_mutex);
+    // Pasa al nivel frío a los usuarios desconectados sin actividad durante
+    // espera_frio y descarta los más antiguos si se supera el presupuesto.
+    // Se llama con usuarios_mutex tomado.
+    void enfriar_usuarios() {
+        if (espera_frio.count() <= 0) {
+            return;
+        }
+        auto limite = std::chrono::system_clock::now() - espera_frio;
+        size_t enfriados = 0;
+        for (auto it = usuarios.begin(); it != usuarios.end();) {
+            auto& usuario = it->second;
+            if (usuario->estado != EstadoUsuario::DESCONECTADO || usuario->en_gracia ||
+                usuario->ultima_actividad > limite) {
+                ++it;
+                continue;
+            }
 
-        uint8_t count = 0;
-        for (const auto& [nombre, usuario] : usuarios) {
-            if (usuario->estado != EstadoUsuario::DESCONECTADO) {
-                count++;
+            UsuarioFrio frio{usuario->id, {}, std::move(usuario->buzon), std::move(usuario->confirmados), {},
+                             ++generacion_fria, 0};
+            for (const auto& msg : usuario->historial_mensajes) {
+                agregar_cadena(frio.historial, msg.origen());
+                agregar_cadena(frio.historial, msg.destino());
+                agregar_cadena(frio.historial, msg.contenido());
+                agregar_entero(frio.historial, a_milisegundos(msg.timestamp), 8);
+                agregar_entero(frio.historial, msg.id, 4);
+            }
+            frio.historial.shrink_to_fit();
+            {
+                std::lock_guard<std::mutex> lock_salas(salas_mutex);
+                for (const auto& [nombre_sala, sala] : salas) {
+                    std::lock_guard<std::mutex> lock_sala(sala->mutex);
+                    if (sala->contiene(usuario->id)) {
+                        frio.salas.push_back(nombre_sala);
+                    }
+                }
             }
+            frio.bytes = sizeof(UsuarioFrio) + it->first.size() + frio.historial.size() + frio.buzon.bytes() +
+                         frio.confirmados.size() * 48;
+
+            memoria_fria += frio.bytes;
+            orden_frios.emplace_back(frio.generacion, it->first);
+            usuarios_frios[it->first] = std::move(frio);
+            it = usuarios.erase(it);
+            enfriados++;
         }
 
-        std::vector<uint8_t> mensaje = {SERVER_LIST_USERS, count};
+        // El presupuesto cubre también el índice de búsqueda, que guarda su propia copia de
+        // los mensajes: primero se descartan usuarios fríos y, si no alcanza, lo más
+        // antiguo del índice
+        size_t memoria_indice = indice_busqueda.bytes();
+        size_t descartados = 0;
+        while (memoria_fria + memoria_indice > presupuesto_frio && !orden_frios.empty()) {
+            auto [generacion, nombre] = std::move(orden_frios.front());
+            orden_frios.pop_front();
+            auto it = usuarios_frios.find(nombre);
+            if (it == usuarios_frios.end() || it->second.generacion != generacion) {
+                continue;
+            }
+            memoria_fria -= it->second.bytes;
+            usuarios_frios.erase(it);
+            descartados++;
+        }
+        if (memoria_fria + memoria_indice > presupuesto_frio) {
+            size_t recortados = indice_busqueda.recortar(presupuesto_frio - std::min(memoria_fria, presupuesto_frio));
+            logger.log("Nivel frío: índice de búsqueda recortado en " + std::to_string(recortados) +
+                       " mensajes para respetar el presupuesto");
+        }
+
+        if (enfriados > 0 || descartados > 0) {
+            logger.log("Nivel frío: " + std::to_string(enfriados) + " usuarios enfriados, " +
+                       std::to_string(descartados) + " descartados por presupuesto; " +
+                       std::to_string(usuarios.size()) + " activos, " + std::to_string(usuarios_frios.size()) +
+                       " fríos (" + std::to_string(memoria_fria / 1024) + " KB), índice de búsqueda " +
+                       std::to_string(memoria_indice / 1024) + " KB");
+        }
+    }
+
+    template <typename F>
+    static void leer_historial_frio(const UsuarioFrio& frio, F&& recibir) {
+        size_t offset = 0;
+        while (offset < frio.historial.size()) {
+            std::string origen, destino, contenido;
+            uint64_t ts, id;
+            if (!leer_cadena(frio.historial, offset, origen) || !leer_cadena(frio.historial, offset, destino) ||
+                !leer_cadena(frio.historial, offset, contenido) || !leer_entero(frio.historial, offset, ts, 8) ||
+                !leer_entero(frio.historial, offset, id, 4)) {
+                break;
+            }
+            Mensaje msg(std::move(origen), std::move(destino), std::move(contenido),
+                        desde_milisegundos(static_cast<int64_t>(ts)));
+            msg.id = static_cast<uint32_t>(id);
+            recibir(std::move(msg));
+        }
+    }
+
+    // Devuelve el usuario del registro activo, restaurándolo desde el nivel
+    // frío si hace falta. Se llama con usuarios_mutex tomado.
+    RegistroUsuarios::iterator despertar_usuario(const std::string& nombre) {
+        auto it = usuarios.find(nombre);
+        if (it != usuarios.end()) {
+            return it;
+        }
+        auto it_frio = usuarios_frios.find(nombre);
+        if (it_frio == usuarios_frios.end()) {
+            return it;
+        }
+
+        UsuarioFrio& frio = it_frio->second;
+        auto usuario = std::make_shared<Usuario>(frio.id, nombre, nullptr, net::ip::address());
+        usuario->estado = EstadoUsuario::DESCONECTADO;
+        usuario->buzon = std::move(frio.buzon);
+        usuario->confirmados = std::move(frio.confirmados);
+        leer_historial_frio(frio, [&](Mensaje msg) { usuario->historial_mensajes.push_back(std::move(msg)); });
+        for (const auto& nombre_sala : frio.salas) {
+            auto sala = obtener_sala(nombre_sala, false);
+            if (sala) {
+                std::lock_guard<std::mutex> lock_sala(sala->mutex);
+                sala->quitar(usuario->id);
+                sala->agregar(usuario);
+            }
+        }
+
+        memoria_fria -= frio.bytes;
+        usuarios_frios.erase(it_frio);
+        logger.log("Usuario " + nombre + " restaurado desde el nivel frío");
+        return usuarios.emplace(nombre, usuario).first;
+    }
+
+    bool existe_usuario(const std::string& nombre) {
+        return usuarios.find(nombre) != usuarios.end() || usuarios_frios.count(nombre) > 0;
+    }
+
+    // Con solicitud distinta de 0 el error lleva al final el tipo de la solicitud que lo
+    // causó, para que el cliente sepa a cuál de sus solicitudes pendientes corresponde
+    std::vector<uint8_t> crear_mensaje_error(ErrorCode codigo, uint8_t solicitud = 0) {
+        auto mensaje = PoolBuffers::trama(SERVER_ERROR, 3);
+        mensaje.push_back(static_cast<uint8_t>(codigo));
+        if (solicitud != 0) {
+            mensaje.push_back(solicitud);
+        }
+        return mensaje;
+    }
+
+    std::vector<uint8_t> crear_mensaje_lista_usuarios() {
+        std::lock_guard<std::mutex> lock(usuarios_mutex);
+        std::lock_guard<std::mutex> lock_remotos(usuarios_remotos_mutex);
+
+        uint8_t count = 0;
+        std::vector<uint8_t> mensaje = {SERVER_LIST_USERS, count};
         
         for (const auto& [nombre, usuario] : usuarios) {
-            if (usuario->estado != EstadoUsuario::DESCONECTADO) {
-                mensaje.push_back(static_cast<uint8_t>(nombre.size()));
-                mensaje.insert(mensaje.end(), nombre.begin(), nombre.end());
-                mensaje.push_back(static_cast<uint8_t>(usuario->estado));
+            if (usuario->estado != EstadoUsuario::DESCONECTADO || usuario->en_gracia) {
+                agregar_cadena(mensaje, nombre);
+                mensaje.push_back(static_cast<uint8_t>(usuario->en_gracia ? usuario->estado_previo : usuario->estado));
+                count++;
             }
         }
-        
+
+        for (const auto& [nombre, remoto] : usuarios_remotos) {
+            auto it = usuarios.find(nombre);
+            if (it != usuarios.end() && it->second->estado != EstadoUsuario::DESCONECTADO) {
+                continue;
+            }
+            agregar_cadena(mensaje, nombre);
+            mensaje.push_back(static_cast<uint8_t>(remoto.estado));
+            count++;
+        }
+
+        mensaje[1] = count;
         return mensaje;
     }
 
-    std::vector<uint8_t> crear_mensaje_info_usuario(const std::string& nombre) {
+    std::vector<uint8_t> crear_mensaje_info_usuario(std::string_view nombre) {
         std::lock_guard<std::mutex> lock(usuarios_mutex);
         
         auto it = usuarios.find(nombre);
-        if (it == usuarios.end() || it->second->estado == EstadoUsuario::DESCONECTADO) {
-            return crear_mensaje_error(ERROR_USER_NOT_FOUND);
+        std::string ip_str;
+        EstadoUsuario estado;
+        if (it != usuarios.end() && it->second->estado != EstadoUsuario::DESCONECTADO) {
+            ip_str = it->second->ip_address.to_string();
+            estado = it->second->estado;
+        } else {
+            std::lock_guard<std::mutex> lock_remotos(usuarios_remotos_mutex);
+            auto it_remoto = usuarios_remotos.find(std::string(nombre));
+            if (it_remoto == usuarios_remotos.end()) {
+                return crear_mensaje_error(ERROR_USER_NOT_FOUND);
+            }
+            ip_str = it_remoto->second.ip;
+            estado = it_remoto->second.estado;
         }
         
-        std::string ip_str = it->second->ip_address.to_string();
-        std::vector<uint8_t> mensaje = {SERVER_USER_INFO, static_cast<uint8_t>(nombre.size())};
+        auto mensaje = PoolBuffers::trama(SERVER_USER_INFO, 4 + nombre.size() + ip_str.size());
+        mensaje.push_back(static_cast<uint8_t>(nombre.size()));
         mensaje.insert(mensaje.end(), nombre.begin(), nombre.end());
-        mensaje.push_back(static_cast<uint8_t>(it->second->estado));
+        mensaje.push_back(static_cast<uint8_t>(estado));
         mensaje.push_back(static_cast<uint8_t>(ip_str.size()));
         mensaje.insert(mensaje.end(), ip_str.begin(), ip_str.end());
         
         return mensaje;
     }
 
-    std::vector<uint8_t> crear_mensaje_recibido(const std::string& origen, const std::string& contenido) {
-        std::vector<uint8_t> mensaje = {
-            SERVER_MESSAGE, 
-            static_cast<uint8_t>(origen.size())
-        };
+    std::vector<uint8_t> crear_mensaje_recibido(const std::string& origen, const std::string& contenido,
+                                                uint32_t id = 0, const std::string& chat = "") {
+        auto mensaje = PoolBuffers::trama(SERVER_MESSAGE, 8 + origen.size() + contenido.size() + chat.size());
+        mensaje.push_back(static_cast<uint8_t>(origen.size()));
         mensaje.insert(mensaje.end(), origen.begin(), origen.end());
         mensaje.push_back(static_cast<uint8_t>(contenido.size()));
         mensaje.insert(mensaje.end(), contenido.begin(), contenido.end());
+
+        if (id != 0) {
+            agregar_entero(mensaje, id, 4);
+            agregar_cadena(mensaje, chat);
+        }
         
         return mensaje;
     }
 
-    std::vector<uint8_t> crear_mensaje_historial(const std::string& chat) {
+    // Con id_anterior distinto de 0 devuelve la página de mensajes anteriores a ese ID
+    std::vector<uint8_t> crear_mensaje_historial(const std::string& chat, const std::string& solicitante,
+                                                 uint32_t id_anterior = 0) {
         std::vector<std::shared_ptr<Mensaje>> historial;
 
         if (chat == "~") {
             std::lock_guard<std::mutex> lock(chat_general_mutex);
-        
-            size_t count = std::min(chat_general.size(), size_t(255));
+
+            auto fin = chat_general.end();
+            if (id_anterior != 0) {
+                fin = std::lower_bound(chat_general.begin(), chat_general.end(), id_anterior,
+                                       [](const Mensaje& m, uint32_t valor) { return m.id < valor; });
+            }
+            size_t count = std::min(static_cast<size_t>(fin - chat_general.begin()), size_t(255));
             historial.reserve(count);
             
-            if (!chat_general.empty()) {
-                auto it = chat_general.end() - std::min(chat_general.size(), size_t(count));
-                for (size_t i = 0; i < std::min(chat_general.size(), size_t(count)); i++) {
-                    auto msg_original = *it++;
-                    historial.push_back(std::make_shared<Mensaje>("Anónimo", msg_original.destino, msg_original.contenido));
-                }
+            for (auto it = fin - count; it != fin; ++it) {
+                historial.push_back(std::make_shared<Mensaje>("Anónimo", it->destino(), it->contenido()));
+                historial.back()->id = it->id;
             }
         } else {
             std::lock_guard<std::mutex> lock(usuarios_mutex);
             
-            auto it = usuarios.find(chat);
-            if (it == usuarios.end()) {
-                return crear_mensaje_error(ERROR_USER_NOT_FOUND);
+            if (!existe_usuario(chat) && nodo_de_usuario_remoto(chat).empty()) {
+                return crear_mensaje_error(ERROR_USER_NOT_FOUND, CLIENT_GET_HISTORY);
             }
 
-            size_t count = std::min(it->second->historial_mensajes.size(), size_t(255));
-            historial.reserve(count);
-            
-            if (!it->second->historial_mensajes.empty()) {
-                auto msg_it = it->second->historial_mensajes.end() - std::min(it->second->historial_mensajes.size(), size_t(count));
-                for (size_t i = 0; i < std::min(it->second->historial_mensajes.size(), size_t(count)); i++) {
-                    historial.push_back(std::make_shared<Mensaje>(*msg_it++));
+            auto it_solicitante = usuarios.find(solicitante);
+            if (it_solicitante != usuarios.end()) {
+                for (const auto& msg : it_solicitante->second->historial_mensajes) {
+                    if ((msg.origen() == chat || msg.destino() == chat) && (id_anterior == 0 || msg.id < id_anterior)) {
+                        historial.push_back(std::make_shared<Mensaje>(msg));
+                    }
+                }
+                if (historial.size() > 255) {
+                    historial.erase(historial.begin(), historial.end() - 255);
                 }
             }
         }
@@ -258,10 +1200,15 @@ private:
         std::vector<uint8_t> mensaje = {SERVER_HISTORY, static_cast<uint8_t>(historial.size())};
         
         for (const auto& msg : historial) {
-            mensaje.push_back(static_cast<uint8_t>(msg->origen.size()));
-            mensaje.insert(mensaje.end(), msg->origen.begin(), msg->origen.end());
-            mensaje.push_back(static_cast<uint8_t>(msg->contenido.size()));
-            mensaje.insert(mensaje.end(), msg->contenido.begin(), msg->contenido.end());
+            mensaje.push_back(static_cast<uint8_t>(msg->origen().size()));
+            mensaje.insert(mensaje.end(), msg->origen().begin(), msg->origen().end());
+            mensaje.push_back(static_cast<uint8_t>(msg->contenido().size()));
+            mensaje.insert(mensaje.end(), msg->contenido().begin(), msg->contenido().end());
+        }
+
+        agregar_cadena(mensaje, chat);
+        for (const auto& msg : historial) {
+            agregar_entero(mensaje, msg->id, 4);
         }
         
         return mensaje;
@@ -271,21 +1218,44 @@ public:
     ChatServer() 
         : logger("chat_server.log"), 
           timeout_inactividad(60),
-          running(true) {
+          running(true),
+          replicacion_activa(false),
+          modo_seguidor(false),
+          siguiente_id_usuario(1) {
+
+        limites_usuario.por_tipo[CLIENT_LIST_USERS] = {1, 5};
+        limites_usuario.por_tipo[CLIENT_GET_USER] = {2, 10};
+        limites_usuario.por_tipo[CLIENT_CHANGE_STATUS] = {1, 5};
+        limites_usuario.por_tipo[CLIENT_SEND_MESSAGE] = {5, 20};
+        limites_usuario.por_tipo[CLIENT_GET_HISTORY] = {2, 10};
+        limites_usuario.por_tipo[CLIENT_SUBSCRIBE_PRESENCE] = {1, 5};
+        limites_usuario.por_tipo[CLIENT_SEARCH] = {2, 10};
+        limites_usuario.por_tipo[CLIENT_RESUME] = {2, 10};
+        limites_usuario.por_tipo[CLIENT_JOIN_ROOM] = {1, 5};
+        limites_usuario.por_tipo[CLIENT_LEAVE_ROOM] = {1, 5};
+        limites_usuario.por_tipo[CLIENT_ACK] = {10, 50};
+        limites_usuario.por_tipo[CLIENT_PING] = {2, 10};
+        limites_usuario.por_tipo[LIMITE_CHAT_GENERAL] = {2, 10};
+
+        logger.log("Backend de E/S: " + std::string(backend_io()));
 
         std::thread inactivity_thread(&ChatServer::check_inactivity, this);
         inactivity_thread.detach();
+
+        std::thread presence_thread(&ChatServer::procesar_presencia_pendiente, this);
+        presence_thread.detach();
     }
     
     ~ChatServer() {
         running = false;
+        replicacion_cv.notify_all();
     }
 
     std::mutex& get_usuarios_mutex() {
         return usuarios_mutex;
     }
     
-    std::unordered_map<std::string, std::shared_ptr<Usuario>>& get_usuarios() {
+    RegistroUsuarios& get_usuarios() {
         return usuarios;
     }
 
@@ -301,7 +1271,7 @@ public:
                 if (usuario->estado != EstadoUsuario::DESCONECTADO && nombre != exclude_user) {
                     try {
                         if (usuario->ws_stream && usuario->ws_stream->is_open()) {
-                            usuario->ws_stream->write(net::buffer(mensaje));
+                            usuario->enviar(mensaje);
                         } else {
                             logger.log("Skipping broadcast to " + nombre + " - WebSocket not open");
                         }
@@ -326,26 +1296,30 @@ public:
         if (!it->second->ws_stream || !it->second->ws_stream->is_open()) {
             logger.log("WebSocket inválido para " + nombre_usuario + " al intentar enviar mensaje");
             it->second->estado = EstadoUsuario::DESCONECTADO;
-            auto notificacion = crear_mensaje_cambio_estado(nombre_usuario, EstadoUsuario::DESCONECTADO);
-            broadcast_mensaje(notificacion);
+            notificar_cambio_estado(nombre_usuario, EstadoUsuario::DESCONECTADO, true);
             return false;
         }
         
         try {
-            it->second->ws_stream->write(net::buffer(mensaje));
+            it->second->enviar(mensaje);
             it->second->actualizar_actividad();
             return true;
         } catch (const std::exception& e) {
             logger.log("Error enviando mensaje a " + nombre_usuario + ": " + e.what());
             
             it->second->estado = EstadoUsuario::DESCONECTADO;
-            auto notificacion = crear_mensaje_cambio_estado(nombre_usuario, EstadoUsuario::DESCONECTADO);
-            broadcast_mensaje(notificacion);
+            notificar_cambio_estado(nombre_usuario, EstadoUsuario::DESCONECTADO, true);
             logger.log("Usuario " + nombre_usuario + " marcado como DESCONECTADO por error de comunicación");
             return false;
         }
     }
 
+    bool enviar_mensaje_a_usuario(const std::string& nombre_usuario, std::vector<uint8_t>&& mensaje) {
+        bool enviado = enviar_mensaje_a_usuario(nombre_usuario, static_cast<const std::vector<uint8_t>&>(mensaje));
+        PoolBuffers::devolver(mensaje);
+        return enviado;
+    }
+
     std::string parse_nombre_usuario(const std::string& query_string) {
         std::string nombre;
         if (query_string.find("name=") != std::string::npos) {
@@ -359,14 +1333,1418 @@ public:
         return nombre;
     }
 
+    std::string parse_token_sesion(const std::string& query_string) {
+        size_t pos = query_string.find("token=");
+        if (pos == std::string::npos || (pos > 0 && query_string[pos - 1] != '&')) {
+            return "";
+        }
+        std::string token = query_string.substr(pos + 6);
+        return token.substr(0, token.find('&'));
+    }
+
+    std::string generar_token_sesion() {
+        static const char hex[] = "0123456789abcdef";
+        std::random_device rd;
+        std::string token;
+        for (int i = 0; i < 8; i++) {
+            uint32_t valor = rd();
+            for (int j = 0; j < 4; j++) {
+                token.push_back(hex[(valor >> (j * 8 + 4)) & 0x0F]);
+                token.push_back(hex[(valor >> (j * 8)) & 0x0F]);
+            }
+        }
+        return token;
+    }
+
+    std::vector<uint8_t> crear_mensaje_sesion(const std::string& token) {
+        std::vector<uint8_t> mensaje = {SERVER_SESSION};
+        agregar_cadena(mensaje, token);
+        agregar_entero(mensaje, static_cast<uint64_t>(gracia_sesion.count()), 4);
+        return mensaje;
+    }
+
     std::vector<uint8_t> crear_mensaje_cambio_estado(const std::string& nombre, EstadoUsuario estado) {
-        std::vector<uint8_t> mensaje = {SERVER_STATUS_CHANGE, static_cast<uint8_t>(nombre.size())};
+        auto mensaje = PoolBuffers::trama(SERVER_STATUS_CHANGE, 3 + nombre.size());
+        mensaje.push_back(static_cast<uint8_t>(nombre.size()));
         mensaje.insert(mensaje.end(), nombre.begin(), nombre.end());
         mensaje.push_back(static_cast<uint8_t>(estado));
         
         return mensaje;
     }
 
+    std::vector<uint8_t> crear_mensaje_nuevo_usuario(const std::string& nombre, EstadoUsuario estado) {
+        auto mensaje = PoolBuffers::trama(SERVER_NEW_USER, 3 + nombre.size());
+        mensaje.push_back(static_cast<uint8_t>(nombre.size()));
+        mensaje.insert(mensaje.end(), nombre.begin(), nombre.end());
+        mensaje.push_back(static_cast<uint8_t>(estado));
+        
+        return mensaje;
+    }
+
+    void quitar_suscripciones(const std::string& observador) {
+        observadores_globales.erase(observador);
+        auto it = suscripciones.find(observador);
+        if (it == suscripciones.end()) {
+            return;
+        }
+        for (const auto& observado : it->second) {
+            auto it_obs = observadores.find(observado);
+            if (it_obs != observadores.end()) {
+                it_obs->second.erase(observador);
+                if (it_obs->second.empty()) {
+                    observadores.erase(it_obs);
+                }
+            }
+        }
+        suscripciones.erase(it);
+    }
+
+    void suscribir_presencia(const std::string& observador, const std::vector<std::string>& observados) {
+        std::lock_guard<std::mutex> lock(suscripciones_mutex);
+        quitar_suscripciones(observador);
+        if (std::find(observados.begin(), observados.end(), "~") != observados.end()) {
+            observadores_globales.insert(observador);
+            return;
+        }
+        auto& propias = suscripciones[observador];
+        for (const auto& observado : observados) {
+            if (observado != observador && propias.insert(observado).second) {
+                observadores[observado].insert(observador);
+            }
+        }
+    }
+
+    void cancelar_suscripciones(const std::string& observador) {
+        std::lock_guard<std::mutex> lock(suscripciones_mutex);
+        quitar_suscripciones(observador);
+    }
+
+    void notificar_observadores(const std::string& nombre, const std::vector<uint8_t>& mensaje, bool already_locked = false,
+                                bool incluir_propio = true) {
+        std::vector<std::string> destinatarios = {nombre};
+        if (!incluir_propio) {
+            destinatarios.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(suscripciones_mutex);
+            destinatarios.insert(destinatarios.end(), observadores_globales.begin(), observadores_globales.end());
+            auto it = observadores.find(nombre);
+            if (it != observadores.end()) {
+                destinatarios.insert(destinatarios.end(), it->second.begin(), it->second.end());
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(usuarios_mutex, std::defer_lock);
+        if (!already_locked) {
+            lock.lock();
+        }
+
+        for (size_t i = 0; i < destinatarios.size(); i++) {
+            if ((i > 0 || !incluir_propio) && destinatarios[i] == nombre) {
+                continue;
+            }
+            auto it = usuarios.find(destinatarios[i]);
+            if (it == usuarios.end() || it->second->estado == EstadoUsuario::DESCONECTADO ||
+                !it->second->ws_stream || !it->second->ws_stream->is_open()) {
+                continue;
+            }
+            try {
+                it->second->enviar(mensaje);
+            } catch (const std::exception& e) {
+                logger.log("Error enviando presencia a " + destinatarios[i] + ": " + e.what());
+            }
+        }
+    }
+
+    void procesar_suscribir_presencia(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+        if (datos.size() < 2) return;
+
+        uint8_t count = datos[1];
+        size_t offset = 2;
+        std::vector<std::string> observados;
+        observados.reserve(count);
+        for (uint8_t i = 0; i < count; i++) {
+            std::string nombre;
+            if (!leer_cadena(datos, offset, nombre)) break;
+            observados.push_back(std::move(nombre));
+        }
+
+        suscribir_presencia(nombre_cliente, observados);
+        logger.log("Cliente " + nombre_cliente + " se suscribe a la presencia de " +
+                   std::to_string(observados.size()) + " usuarios");
+    }
+
+    void enviar_presencia_propia(const std::string& nombre, const std::vector<uint8_t>& mensaje, bool already_locked) {
+        std::unique_lock<std::mutex> lock(usuarios_mutex, std::defer_lock);
+        if (!already_locked) {
+            lock.lock();
+        }
+        auto it = usuarios.find(nombre);
+        if (it == usuarios.end() || it->second->estado == EstadoUsuario::DESCONECTADO ||
+            !it->second->ws_stream || !it->second->ws_stream->is_open()) {
+            return;
+        }
+        try {
+            it->second->enviar(mensaje);
+        } catch (const std::exception& e) {
+            logger.log("Error enviando presencia a " + nombre + ": " + e.what());
+        }
+    }
+
+    void avisar_observadores(const std::string& nombre, EstadoUsuario estado, bool nuevo, bool already_locked = false) {
+        auto mensaje = nuevo ? crear_mensaje_nuevo_usuario(nombre, estado) : crear_mensaje_cambio_estado(nombre, estado);
+        if (!agregador_presencia.activo()) {
+            notificar_observadores(nombre, mensaje, already_locked);
+            PoolBuffers::devolver(mensaje);
+            return;
+        }
+        enviar_presencia_propia(nombre, mensaje, already_locked);
+        PoolBuffers::devolver(mensaje);
+        agregador_presencia.registrar(nombre, estado);
+    }
+
+    void notificar_nuevo_usuario(const std::string& nombre, const std::string& ip) {
+        avisar_observadores(nombre, EstadoUsuario::ACTIVO, true);
+        difundir_presencia(nombre, EstadoUsuario::ACTIVO, ip);
+        replicar_presencia(nombre, EstadoUsuario::ACTIVO, ip);
+    }
+
+    void notificar_cambio_estado(const std::string& nombre, EstadoUsuario estado, bool already_locked = false) {
+        avisar_observadores(nombre, estado, false, already_locked);
+        difundir_presencia(nombre, estado, "");
+        replicar_presencia(nombre, estado, "");
+    }
+
+    void configurar_ventana_presencia(int milisegundos) {
+        agregador_presencia.configurar_ventana(std::chrono::milliseconds(milisegundos));
+    }
+
+    void configurar_nivel_frio(int minutos, size_t megabytes) {
+        espera_frio = std::chrono::minutes(minutos);
+        presupuesto_frio = megabytes * 1024 * 1024;
+    }
+
+    void configurar_busqueda(size_t max_mensajes) {
+        indice_busqueda.configurar_capacidad(max_mensajes);
+    }
+
+    void configurar_gracia_sesion(int segundos) {
+        gracia_sesion = std::chrono::seconds(segundos);
+    }
+
+    void configurar_buzon(size_t max_mensajes, int horas) {
+        buzon_max_mensajes = max_mensajes;
+        buzon_max_edad = std::chrono::hours(horas);
+    }
+
+    void guardar_en_buzon(Usuario& usuario, const Mensaje& mensaje) {
+        usuario.buzon.agregar(mensaje, buzon_max_mensajes);
+        logger.log("Mensaje de " + mensaje.origen() + " guardado en el buzón de " + usuario.nombre +
+                   " (" + std::to_string(usuario.buzon.size()) + " pendientes)");
+    }
+
+    void entregar_buzon(Usuario& usuario) {
+        if (usuario.buzon.size() == 0 || !usuario.puede_recibir_mensajes()) {
+            return;
+        }
+        size_t pendientes = usuario.buzon.size();
+        auto trama = usuario.buzon.extraer_trama(buzon_max_edad);
+        if (trama.empty()) {
+            return;
+        }
+        try {
+            usuario.enviar(trama);
+            logger.log("Buzón de " + usuario.nombre + " entregado: " + std::to_string(pendientes) +
+                       " mensajes en " + std::to_string(trama.size()) + " bytes (" +
+                       std::to_string(usuario.buzon.descartados) + " descartados en total por límite)");
+        } catch (const std::exception& e) {
+            logger.log("Error entregando buzón a " + usuario.nombre + ": " + e.what());
+        }
+    }
+
+    void agregar_historial(std::deque<Mensaje>& historial, Mensaje mensaje) {
+        historial.push_back(std::move(mensaje));
+        if (historial.size() > 1000) {
+            historial.pop_front();
+        }
+    }
+
+    std::vector<uint8_t> crear_entrada_general(const Mensaje& mensaje) {
+        std::vector<uint8_t> entrada = {REPL_GENERAL};
+        agregar_cadena(entrada, mensaje.origen());
+        agregar_cadena(entrada, mensaje.contenido());
+        agregar_entero(entrada, a_milisegundos(mensaje.timestamp), 8);
+        agregar_entero(entrada, mensaje.id, 4);
+        return entrada;
+    }
+
+    std::vector<uint8_t> crear_entrada_historial(const std::string& nombre, const Mensaje& mensaje, bool indexar) {
+        std::vector<uint8_t> entrada = {REPL_HISTORIAL};
+        agregar_cadena(entrada, nombre);
+        agregar_cadena(entrada, mensaje.origen());
+        agregar_cadena(entrada, mensaje.destino());
+        agregar_cadena(entrada, mensaje.contenido());
+        agregar_entero(entrada, a_milisegundos(mensaje.timestamp), 8);
+        entrada.push_back(indexar ? 1 : 0);
+        agregar_entero(entrada, mensaje.id, 4);
+        return entrada;
+    }
+
+    // Los IDs son crecientes por conversación: uno para el chat general y
+    // otro para cada par de usuarios. Requiere usuarios_mutex.
+    uint32_t& secuencia_directa(const std::string& a, const std::string& b) {
+        return secuencias_directas[a < b ? a + '\n' + b : b + '\n' + a];
+    }
+
+    // Como secuencia_directa, pero sin crear la conversación: 0 si nunca hubo mensajes
+    uint32_t ultima_secuencia_directa(const std::string& a, const std::string& b) const {
+        auto it = secuencias_directas.find(a < b ? a + '\n' + b : b + '\n' + a);
+        return it == secuencias_directas.end() ? 0 : it->second;
+    }
+
+    uint32_t agregar_historial_general(Mensaje mensaje) {
+        if (mensaje.id == 0) {
+            mensaje.id = ++secuencia_general;
+        } else {
+            secuencia_general = std::max(secuencia_general, mensaje.id);
+        }
+        if (replicacion_activa) {
+            replicar(crear_entrada_general(mensaje));
+        }
+        uint32_t id = mensaje.id;
+        indice_busqueda.indexar(mensaje);
+        agregar_historial(chat_general, std::move(mensaje));
+        return id;
+    }
+
+    // Un mensaje directo entre dos usuarios locales se guarda en ambos
+    // historiales pero solo se indexa una vez.
+    uint32_t agregar_historial_usuario(Usuario& usuario, Mensaje mensaje, bool indexar = true) {
+        uint32_t& secuencia = secuencia_directa(mensaje.origen(), mensaje.destino());
+        if (mensaje.id == 0) {
+            mensaje.id = ++secuencia;
+        } else {
+            secuencia = std::max(secuencia, mensaje.id);
+        }
+        if (replicacion_activa) {
+            replicar(crear_entrada_historial(usuario.nombre, mensaje, indexar));
+        }
+        if (indexar) {
+            indice_busqueda.indexar(mensaje);
+        }
+        uint32_t id = mensaje.id;
+        agregar_historial(usuario.historial_mensajes, std::move(mensaje));
+        return id;
+    }
+
+    std::string nodo_de_usuario_remoto(const std::string& nombre) {
+        std::lock_guard<std::mutex> lock(usuarios_remotos_mutex);
+        auto it = usuarios_remotos.find(nombre);
+        if (it == usuarios_remotos.end() || it->second.estado == EstadoUsuario::DESCONECTADO) {
+            return "";
+        }
+        return it->second.nodo;
+    }
+
+    void difundir_a_peers(const std::vector<uint8_t>& trama) {
+        std::vector<std::shared_ptr<EnlacePeer>> destinos;
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex);
+            for (const auto& [id, enlace] : peers) {
+                destinos.push_back(enlace);
+            }
+        }
+
+        for (const auto& enlace : destinos) {
+            try {
+                enlace->enviar(trama);
+            } catch (const std::exception& e) {
+                logger.log("Error enviando a nodo " + enlace->id + ": " + e.what());
+                enlace->cerrar();
+            }
+        }
+    }
+
+    bool enviar_a_peer(const std::string& nodo, const std::vector<uint8_t>& trama) {
+        std::shared_ptr<EnlacePeer> enlace;
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex);
+            auto it = peers.find(nodo);
+            if (it == peers.end()) {
+                return false;
+            }
+            enlace = it->second;
+        }
+
+        try {
+            enlace->enviar(trama);
+            return true;
+        } catch (const std::exception& e) {
+            logger.log("Error enviando a nodo " + nodo + ": " + e.what());
+            enlace->cerrar();
+            return false;
+        }
+    }
+
+    std::vector<uint8_t> crear_trama_presencia(const std::string& nombre, EstadoUsuario estado, const std::string& ip) {
+        std::vector<uint8_t> trama = {PEER_PRESENCE};
+        agregar_cadena(trama, nombre);
+        trama.push_back(static_cast<uint8_t>(estado));
+        agregar_cadena(trama, ip);
+        return trama;
+    }
+
+    void difundir_presencia(const std::string& nombre, EstadoUsuario estado, const std::string& ip) {
+        if (id_nodo.empty()) return;
+        difundir_a_peers(crear_trama_presencia(nombre, estado, ip));
+    }
+
+    void aplicar_presencia_remota(const std::string& nodo, const std::string& nombre,
+                                  EstadoUsuario estado, const std::string& ip) {
+        bool conocido = false;
+        {
+            std::lock_guard<std::mutex> lock(usuarios_remotos_mutex);
+            auto it = usuarios_remotos.find(nombre);
+            conocido = it != usuarios_remotos.end();
+
+            if (conocido && it->second.nodo == nodo && it->second.estado == estado) {
+                if (!ip.empty()) {
+                    it->second.ip = ip;
+                }
+                return;
+            }
+
+            if (estado == EstadoUsuario::DESCONECTADO) {
+                if (conocido && it->second.nodo == nodo) {
+                    usuarios_remotos.erase(it);
+                } else {
+                    conocido = false;
+                }
+            } else if (conocido) {
+                it->second.nodo = nodo;
+                it->second.estado = estado;
+                if (!ip.empty()) {
+                    it->second.ip = ip;
+                }
+            } else {
+                usuarios_remotos[nombre] = UsuarioRemoto{nodo, estado, ip};
+            }
+        }
+
+        logger.log("Presencia remota de " + nombre + " (nodo " + nodo + "): " +
+                   std::to_string(static_cast<int>(estado)));
+
+        if (estado == EstadoUsuario::DESCONECTADO) {
+            if (conocido) {
+                avisar_observadores(nombre, estado, false);
+            }
+        } else {
+            avisar_observadores(nombre, estado, !conocido);
+        }
+    }
+
+    void purgar_usuarios_de_nodo(const std::string& nodo) {
+        std::vector<std::string> desconectados;
+        {
+            std::lock_guard<std::mutex> lock(usuarios_remotos_mutex);
+            for (auto it = usuarios_remotos.begin(); it != usuarios_remotos.end();) {
+                if (it->second.nodo == nodo) {
+                    desconectados.push_back(it->first);
+                    it = usuarios_remotos.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        for (const auto& nombre : desconectados) {
+            avisar_observadores(nombre, EstadoUsuario::DESCONECTADO, false);
+        }
+        logger.log("Nodo " + nodo + " fuera del cluster, " + std::to_string(desconectados.size()) +
+                   " usuarios remotos marcados como DESCONECTADO");
+    }
+
+    void recibir_mensaje_peer(const std::string& origen, const std::string& destino, const std::string& contenido) {
+        std::shared_ptr<Usuario> usuario_destino;
+        uint32_t id = 0;
+        {
+            std::lock_guard<std::mutex> lock(usuarios_mutex);
+            auto it = despertar_usuario(destino);
+            if (it == usuarios.end()) {
+                logger.log("Mensaje remoto de " + origen + " para " + destino + " descartado: destinatario desconocido");
+                return;
+            }
+            Mensaje mensaje(origen, destino, contenido);
+            mensaje.id = agregar_historial_usuario(*it->second, mensaje);
+            if (!it->second->puede_recibir_mensajes()) {
+                guardar_en_buzon(*it->second, mensaje);
+                return;
+            }
+            usuario_destino = it->second;
+            id = mensaje.id;
+        }
+
+        enviar_mensaje_a_usuario(destino, crear_mensaje_recibido(origen, contenido, id, origen));
+    }
+
+    void recibir_broadcast_peer(const std::string& origen, const std::string& contenido) {
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> lock(chat_general_mutex);
+            id = agregar_historial_general(Mensaje(origen, "~", contenido));
+        }
+        broadcast_mensaje(crear_mensaje_recibido("Anónimo", contenido, id, "~"));
+    }
+
+    void procesar_trama_peer(const std::string& nodo, const std::vector<uint8_t>& trama) {
+        if (trama.empty()) return;
+
+        size_t offset = 1;
+        switch (trama[0]) {
+            case PEER_PRESENCE: {
+                std::string nombre, ip;
+                if (!leer_cadena(trama, offset, nombre) || offset >= trama.size()) break;
+                uint8_t estado = trama[offset++];
+                if (estado > 3 || !leer_cadena(trama, offset, ip)) break;
+                aplicar_presencia_remota(nodo, nombre, static_cast<EstadoUsuario>(estado), ip);
+                break;
+            }
+
+            case PEER_MESSAGE: {
+                std::string origen, destino, contenido;
+                if (!leer_cadena(trama, offset, origen) || !leer_cadena(trama, offset, destino) ||
+                    !leer_cadena(trama, offset, contenido)) break;
+                recibir_mensaje_peer(origen, destino, contenido);
+                break;
+            }
+
+            case PEER_BROADCAST: {
+                std::string origen, contenido;
+                if (!leer_cadena(trama, offset, origen) || !leer_cadena(trama, offset, contenido)) break;
+                recibir_broadcast_peer(origen, contenido);
+                break;
+            }
+
+            default:
+                logger.log("Trama desconocida de nodo " + nodo + ": tipo " + std::to_string(trama[0]));
+                break;
+        }
+    }
+
+    void enviar_snapshot_presencia(EnlacePeer& enlace) {
+        std::vector<std::vector<uint8_t>> tramas;
+        {
+            std::lock_guard<std::mutex> lock(usuarios_mutex);
+            for (const auto& [nombre, usuario] : usuarios) {
+                if (usuario->estado != EstadoUsuario::DESCONECTADO) {
+                    tramas.push_back(crear_trama_presencia(nombre, usuario->estado, usuario->ip_address.to_string()));
+                }
+            }
+        }
+
+        for (const auto& trama : tramas) {
+            enlace.enviar(trama);
+        }
+    }
+
+    std::string manejar_enlace_peer(tcp::socket socket, bool saliente) {
+        auto enlace = std::make_shared<EnlacePeer>(std::move(socket), saliente);
+        enlace->iniciar_escritor();
+
+        try {
+            std::vector<uint8_t> saludo = {PEER_HELLO};
+            agregar_cadena(saludo, id_nodo);
+            enlace->enviar(saludo);
+
+            auto respuesta = leer_trama_tcp(enlace->socket);
+            size_t offset = 1;
+            if (respuesta.empty() || respuesta[0] != PEER_HELLO ||
+                !leer_cadena(respuesta, offset, enlace->id) || enlace->id.empty() || enlace->id == id_nodo) {
+                logger.log("Enlace de federación rechazado: saludo inválido");
+                enlace->cerrar();
+                return "";
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(peers_mutex);
+                auto it = peers.find(enlace->id);
+                if (it != peers.end()) {
+                    const std::string& marcador = std::min(id_nodo, enlace->id);
+                    bool preferido = (enlace->saliente ? id_nodo : enlace->id) == marcador;
+                    if (!preferido) {
+                        logger.log("Enlace duplicado con nodo " + enlace->id + " descartado");
+                        enlace->cerrar();
+                        return enlace->id;
+                    }
+                    it->second->cerrar();
+                    it->second = enlace;
+                } else {
+                    peers[enlace->id] = enlace;
+                }
+            }
+
+            logger.log("Enlace de federación establecido con nodo " + enlace->id +
+                       (enlace->saliente ? " (saliente)" : " (entrante)"));
+            enviar_snapshot_presencia(*enlace);
+
+            while (running) {
+                auto trama = leer_trama_tcp(enlace->socket);
+                procesar_trama_peer(enlace->id, trama);
+            }
+        } catch (const std::exception& e) {
+            logger.log("Enlace con nodo " + (enlace->id.empty() ? std::string("desconocido") : enlace->id) +
+                       " cerrado: " + e.what());
+        }
+
+        bool registrado = false;
+        {
+            std::lock_guard<std::mutex> lock(peers_mutex);
+            auto it = peers.find(enlace->id);
+            if (it != peers.end() && it->second == enlace) {
+                peers.erase(it);
+                registrado = true;
+            }
+        }
+
+        if (registrado) {
+            purgar_usuarios_de_nodo(enlace->id);
+        }
+        return enlace->id;
+    }
+
+    void conectar_peer(const std::string& direccion) {
+        auto separador = direccion.rfind(':');
+        if (separador == std::string::npos) {
+            logger.log("Dirección de peer inválida: " + direccion);
+            return;
+        }
+        std::string host = direccion.substr(0, separador);
+        std::string puerto = direccion.substr(separador + 1);
+        std::string id_conocido;
+
+        while (running) {
+            bool enlazado = false;
+            if (!id_conocido.empty()) {
+                std::lock_guard<std::mutex> lock(peers_mutex);
+                enlazado = peers.count(id_conocido) > 0;
+            }
+
+            if (!enlazado) {
+                try {
+                    net::io_context ioc;
+                    tcp::resolver resolver(ioc);
+                    tcp::socket socket(ioc);
+                    net::connect(socket, resolver.resolve(host, puerto));
+                    socket.set_option(tcp::no_delay(true));
+                    std::string id = manejar_enlace_peer(std::move(socket), true);
+                    if (!id.empty()) {
+                        id_conocido = id;
+                    }
+                } catch (const std::exception& e) {
+                    logger.log("No se pudo conectar al peer " + direccion + ": " + e.what());
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds(3));
+        }
+    }
+
+    void iniciar_federacion(const std::string& nodo, unsigned short puerto_cluster,
+                            const std::vector<std::string>& direcciones_peers) {
+        id_nodo = nodo;
+
+        std::thread([this, puerto_cluster]() {
+            try {
+                net::io_context ioc{1};
+                tcp::acceptor acceptor{ioc, {tcp::v4(), puerto_cluster}};
+                logger.log("Nodo " + id_nodo + " escuchando enlaces de federación en puerto " +
+                           std::to_string(puerto_cluster));
+
+                while (running) {
+                    tcp::socket socket{ioc};
+                    acceptor.accept(socket);
+                    socket.set_option(tcp::no_delay(true));
+                    std::thread([this, sock = std::move(socket)]() mutable {
+                        manejar_enlace_peer(std::move(sock), false);
+                    }).detach();
+                }
+            } catch (const std::exception& e) {
+                logger.log("Error en listener de federación: " + std::string(e.what()));
+            }
+        }).detach();
+
+        for (const auto& direccion : direcciones_peers) {
+            std::thread([this, direccion]() {
+                conectar_peer(direccion);
+            }).detach();
+        }
+    }
+
+    void replicar(std::vector<uint8_t> entrada) {
+        {
+            std::lock_guard<std::mutex> lock(replicacion_mutex);
+            registro_replicacion.push_back({siguiente_seq_replicacion++, std::chrono::steady_clock::now(),
+                                            std::move(entrada)});
+            if (registro_replicacion.size() > 100000) {
+                registro_replicacion.pop_front();
+            }
+        }
+        replicacion_cv.notify_all();
+    }
+
+    void replicar_presencia(const std::string& nombre, EstadoUsuario estado, const std::string& ip) {
+        if (!replicacion_activa) return;
+
+        std::vector<uint8_t> entrada = {REPL_PRESENCIA};
+        agregar_cadena(entrada, nombre);
+        entrada.push_back(static_cast<uint8_t>(estado));
+        agregar_cadena(entrada, ip);
+        replicar(std::move(entrada));
+    }
+
+    std::vector<uint8_t> crear_lote_replicacion(uint64_t primer_seq, const std::vector<const std::vector<uint8_t>*>& entradas) {
+        std::vector<uint8_t> lote = {REPL_BATCH};
+        agregar_entero(lote, primer_seq, 8);
+        agregar_entero(lote, a_milisegundos(std::chrono::system_clock::now()), 8);
+        agregar_entero(lote, entradas.size(), 2);
+        for (const auto* entrada : entradas) {
+            agregar_entero(lote, entrada->size(), 2);
+            lote.insert(lote.end(), entrada->begin(), entrada->end());
+        }
+        return lote;
+    }
+
+    uint64_t enviar_snapshot_replicacion(EnlacePeer& enlace) {
+        std::vector<std::vector<uint8_t>> entradas;
+        uint64_t seq_inicio;
+        {
+            // Orden de bloqueo: usuarios_mutex, chat_general_mutex, salas_mutex, sala->mutex y por
+            // último replicacion_mutex, el mismo que siguen los envíos a salas (agregar_historial_sala
+            // replica con sala->mutex tomado). Las salas se bloquean todas antes de fijar seq_inicio
+            // para que ningún mensaje quede a la vez en el snapshot y en el registro
+            std::lock_guard<std::mutex> lock(usuarios_mutex);
+            std::lock_guard<std::mutex> lock_general(chat_general_mutex);
+            std::lock_guard<std::mutex> lock_salas(salas_mutex);
+            std::vector<std::unique_lock<std::mutex>> locks_salas;
+            for (const auto& [nombre, sala] : salas) {
+                locks_salas.emplace_back(sala->mutex);
+            }
+            std::lock_guard<std::mutex> lock_replicacion(replicacion_mutex);
+            seq_inicio = siguiente_seq_replicacion;
+
+            // Un mensaje directo entre dos usuarios locales, activos o fríos, se indexa
+            // solo desde el historial del destinatario
+            for (const auto& [nombre, usuario] : usuarios) {
+                std::vector<uint8_t> presencia = {REPL_PRESENCIA};
+                agregar_cadena(presencia, nombre);
+                presencia.push_back(static_cast<uint8_t>(usuario->estado));
+                agregar_cadena(presencia, usuario->ip_address.to_string());
+                entradas.push_back(std::move(presencia));
+
+                for (const auto& msg : usuario->historial_mensajes) {
+                    bool indexar = msg.destino() == nombre || !existe_usuario(msg.destino());
+                    entradas.push_back(crear_entrada_historial(nombre, msg, indexar));
+                }
+            }
+
+            // Los usuarios fríos llegan al seguidor como desconectados; allí se vuelven a
+            // enfriar con su propio temporizador
+            for (const auto& [nombre, frio] : usuarios_frios) {
+                std::vector<uint8_t> presencia = {REPL_PRESENCIA};
+                agregar_cadena(presencia, nombre);
+                presencia.push_back(static_cast<uint8_t>(EstadoUsuario::DESCONECTADO));
+                agregar_cadena(presencia, "");
+                entradas.push_back(std::move(presencia));
+
+                leer_historial_frio(frio, [&](Mensaje msg) {
+                    bool indexar = msg.destino() == nombre || !existe_usuario(msg.destino());
+                    entradas.push_back(crear_entrada_historial(nombre, msg, indexar));
+                });
+            }
+
+            for (const auto& msg : chat_general) {
+                entradas.push_back(crear_entrada_general(msg));
+            }
+
+            for (const auto& [nombre, sala] : salas) {
+                for (size_t i = 0; i < sala->historial.size(); i++) {
+                    entradas.push_back(crear_entrada_sala(sala->historial[i]));
+                }
+            }
+        }
+
+        std::vector<uint8_t> inicio = {REPL_SNAPSHOT};
+        agregar_entero(inicio, seq_inicio, 8);
+        enlace.enviar(inicio);
+
+        for (size_t i = 0; i < entradas.size(); i += 256) {
+            std::vector<const std::vector<uint8_t>*> lote;
+            for (size_t j = i; j < std::min(entradas.size(), i + 256); j++) {
+                lote.push_back(&entradas[j]);
+            }
+            enlace.enviar(crear_lote_replicacion(0, lote));
+        }
+
+        logger.log("Snapshot de replicación enviado a " + enlace.id + ": " + std::to_string(entradas.size()) +
+                   " entradas, continúa en seq " + std::to_string(seq_inicio));
+        return seq_inicio;
+    }
+
+    void servir_seguidor(tcp::socket socket) {
+        auto enlace = std::make_shared<EnlacePeer>(std::move(socket), false);
+        std::atomic<bool> activo{true};
+        std::atomic<uint64_t> confirmado{0};
+        std::thread lector;
+
+        try {
+            enlace->id = enlace->socket.remote_endpoint().address().to_string() + ":" +
+                         std::to_string(enlace->socket.remote_endpoint().port());
+            uint64_t seq = enviar_snapshot_replicacion(*enlace);
+            confirmado = seq - 1;
+
+            lector = std::thread([this, enlace, &confirmado, &activo]() {
+                try {
+                    while (true) {
+                        auto trama = leer_trama_tcp(enlace->socket);
+                        size_t offset = 1;
+                        uint64_t ultimo;
+                        if (!trama.empty() && trama[0] == REPL_ACK && leer_entero(trama, offset, ultimo, 8)) {
+                            confirmado = ultimo;
+                        }
+                    }
+                } catch (const std::exception&) {
+                }
+                activo = false;
+                replicacion_cv.notify_all();
+            });
+
+            auto ultima_metrica = std::chrono::steady_clock::now();
+            while (running && activo) {
+                std::vector<uint8_t> lote;
+                uint64_t publicado;
+                {
+                    std::unique_lock<std::mutex> lock(replicacion_mutex);
+                    replicacion_cv.wait_for(lock, std::chrono::seconds(1), [&]() {
+                        return !running || !activo || siguiente_seq_replicacion > seq;
+                    });
+
+                    if (siguiente_seq_replicacion > seq && siguiente_seq_replicacion - seq < 256) {
+                        replicacion_cv.wait_for(lock, std::chrono::milliseconds(20), [&]() {
+                            return !running || !activo || siguiente_seq_replicacion - seq >= 256;
+                        });
+                    }
+
+                    publicado = siguiente_seq_replicacion - 1;
+                    if (seq <= publicado) {
+                        if (registro_replicacion.empty() || registro_replicacion.front().seq > seq) {
+                            throw std::runtime_error("seguidor demasiado atrasado, requiere nuevo snapshot");
+                        }
+
+                        std::vector<const std::vector<uint8_t>*> entradas;
+                        size_t indice = seq - registro_replicacion.front().seq;
+                        for (; indice < registro_replicacion.size() && entradas.size() < 256; indice++) {
+                            entradas.push_back(&registro_replicacion[indice].datos);
+                        }
+                        lote = crear_lote_replicacion(seq, entradas);
+                        seq += entradas.size();
+                    }
+                }
+
+                if (!lote.empty()) {
+                    enlace->enviar(lote);
+                }
+
+                auto ahora = std::chrono::steady_clock::now();
+                if (ahora - ultima_metrica >= std::chrono::seconds(10)) {
+                    ultima_metrica = ahora;
+                    reportar_lag_replicacion(enlace->id, publicado, confirmado);
+                }
+            }
+            logger.log("Seguidor de replicación " + enlace->id + " desconectado");
+        } catch (const std::exception& e) {
+            logger.log("Replicación hacia " + enlace->id + " terminada: " + e.what());
+        }
+
+        activo = false;
+        enlace->cerrar();
+        if (lector.joinable()) {
+            lector.join();
+        }
+    }
+
+    void reportar_lag_replicacion(const std::string& seguidor, uint64_t publicado, uint64_t confirmado) {
+        int64_t lag_ms = 0;
+        {
+            std::lock_guard<std::mutex> lock(replicacion_mutex);
+            if (confirmado < publicado && !registro_replicacion.empty() &&
+                confirmado + 1 >= registro_replicacion.front().seq) {
+                size_t indice = confirmado + 1 - registro_replicacion.front().seq;
+                if (indice < registro_replicacion.size()) {
+                    lag_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - registro_replicacion[indice].publicada).count();
+                }
+            }
+        }
+
+        logger.log("Métricas replicación " + seguidor + ": publicado=" + std::to_string(publicado) +
+                   " confirmado=" + std::to_string(confirmado) +
+                   " lag_entradas=" + std::to_string(publicado - std::min(publicado, confirmado)) +
+                   " lag_ms=" + std::to_string(lag_ms));
+    }
+
+    void iniciar_replicacion(unsigned short puerto_replicacion) {
+        replicacion_activa = true;
+
+        std::thread([this, puerto_replicacion]() {
+            net::io_context ioc{1};
+            tcp::acceptor acceptor{ioc};
+            while (running && !acceptor.is_open()) {
+                try {
+                    acceptor = tcp::acceptor{ioc, {tcp::v4(), puerto_replicacion}};
+                } catch (const std::exception& e) {
+                    logger.log("Puerto de replicación " + std::to_string(puerto_replicacion) +
+                               " no disponible: " + e.what());
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                }
+            }
+            logger.log("Aceptando seguidores de replicación en puerto " + std::to_string(puerto_replicacion));
+
+            try {
+                while (running) {
+                    tcp::socket socket{ioc};
+                    acceptor.accept(socket);
+                    socket.set_option(tcp::no_delay(true));
+                    std::thread([this, sock = std::move(socket)]() mutable {
+                        servir_seguidor(std::move(sock));
+                    }).detach();
+                }
+            } catch (const std::exception& e) {
+                logger.log("Error en listener de replicación: " + std::string(e.what()));
+            }
+        }).detach();
+    }
+
+    std::shared_ptr<Usuario> obtener_usuario_replicado(const std::string& nombre) {
+        auto it = despertar_usuario(nombre);
+        if (it != usuarios.end()) {
+            return it->second;
+        }
+        auto usuario = std::make_shared<Usuario>(siguiente_id_usuario++, nombre, nullptr, net::ip::address());
+        usuario->estado = EstadoUsuario::DESCONECTADO;
+        usuarios.emplace(nombre, usuario);
+        return usuario;
+    }
+
+    void aplicar_entrada_replicacion(const std::vector<uint8_t>& entrada) {
+        if (entrada.empty()) return;
+
+        size_t offset = 1;
+        switch (entrada[0]) {
+            case REPL_GENERAL: {
+                std::string origen, contenido;
+                uint64_t ts;
+                if (!leer_cadena(entrada, offset, origen) || !leer_cadena(entrada, offset, contenido) ||
+                    !leer_entero(entrada, offset, ts, 8)) break;
+                Mensaje mensaje(origen, "~", contenido, desde_milisegundos(ts));
+                uint64_t id = 0;
+                leer_entero(entrada, offset, id, 4);
+                mensaje.id = static_cast<uint32_t>(id);
+                std::lock_guard<std::mutex> lock(chat_general_mutex);
+                agregar_historial_general(std::move(mensaje));
+                break;
+            }
+
+            case REPL_HISTORIAL: {
+                std::string nombre, origen, destino, contenido;
+                uint64_t ts;
+                if (!leer_cadena(entrada, offset, nombre) || !leer_cadena(entrada, offset, origen) ||
+                    !leer_cadena(entrada, offset, destino) || !leer_cadena(entrada, offset, contenido) ||
+                    !leer_entero(entrada, offset, ts, 8)) break;
+                bool indexar = offset >= entrada.size() || entrada[offset++] != 0;
+                Mensaje mensaje(origen, destino, contenido, desde_milisegundos(ts));
+                uint64_t id = 0;
+                leer_entero(entrada, offset, id, 4);
+                mensaje.id = static_cast<uint32_t>(id);
+                std::lock_guard<std::mutex> lock(usuarios_mutex);
+                agregar_historial_usuario(*obtener_usuario_replicado(nombre), std::move(mensaje), indexar);
+                break;
+            }
+
+            case REPL_SALA: {
+                std::string sala, origen, contenido;
+                uint64_t ts;
+                if (!leer_cadena(entrada, offset, sala) || !leer_cadena(entrada, offset, origen) ||
+                    !leer_cadena(entrada, offset, contenido) || !leer_entero(entrada, offset, ts, 8)) break;
+                auto destino = obtener_sala(sala, true);
+                std::lock_guard<std::mutex> lock(destino->mutex);
+                agregar_historial_sala(*destino, Mensaje(origen, sala, contenido, desde_milisegundos(ts)));
+                break;
+            }
+
+            case REPL_PRESENCIA: {
+                std::string nombre, ip;
+                if (!leer_cadena(entrada, offset, nombre) || offset >= entrada.size()) break;
+                uint8_t estado = entrada[offset++];
+                if (estado > 3 || !leer_cadena(entrada, offset, ip)) break;
+                std::lock_guard<std::mutex> lock(usuarios_mutex);
+                auto usuario = obtener_usuario_replicado(nombre);
+                usuario->estado = static_cast<EstadoUsuario>(estado);
+                if (!ip.empty()) {
+                    beast::error_code ec;
+                    usuario->ip_address = net::ip::make_address(ip, ec);
+                }
+                replicar_presencia(nombre, usuario->estado, ip);
+                break;
+            }
+
+            default:
+                logger.log("Entrada de replicación desconocida: tipo " + std::to_string(entrada[0]));
+                break;
+        }
+    }
+
+    void seguir_primario(const std::string& direccion) {
+        auto separador = direccion.rfind(':');
+        if (separador == std::string::npos) {
+            logger.log("Dirección de primario inválida: " + direccion);
+            return;
+        }
+        std::string host = direccion.substr(0, separador);
+        std::string puerto = direccion.substr(separador + 1);
+
+        modo_seguidor = true;
+        int intentos_fallidos = 0;
+        uint64_t aplicado = 0;
+
+        while (running && intentos_fallidos < 3) {
+            try {
+                net::io_context ioc;
+                tcp::resolver resolver(ioc);
+                tcp::socket socket(ioc);
+                net::connect(socket, resolver.resolve(host, puerto));
+                socket.set_option(tcp::no_delay(true));
+                EnlacePeer enlace(std::move(socket), true);
+                enlace.id = direccion;
+                logger.log("Siguiendo al primario " + direccion);
+
+                auto ultima_metrica = std::chrono::steady_clock::now();
+                while (running) {
+                    auto trama = leer_trama_tcp(enlace.socket);
+                    intentos_fallidos = 0;
+                    size_t offset = 1;
+
+                    if (!trama.empty() && trama[0] == REPL_SNAPSHOT) {
+                        uint64_t seq_inicio;
+                        if (!leer_entero(trama, offset, seq_inicio, 8)) continue;
+                        {
+                            std::lock_guard<std::mutex> lock(usuarios_mutex);
+                            usuarios.clear();
+                            usuarios_frios.clear();
+                            orden_frios.clear();
+                            memoria_fria = 0;
+                            indice_busqueda.vaciar();
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(chat_general_mutex);
+                            chat_general.clear();
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(salas_mutex);
+                            salas.clear();
+                        }
+                        aplicado = seq_inicio - 1;
+                        logger.log("Snapshot de replicación recibido, continúa en seq " + std::to_string(seq_inicio));
+                        continue;
+                    }
+
+                    uint64_t primer_seq, enviado_ms, cantidad;
+                    if (trama.empty() || trama[0] != REPL_BATCH || !leer_entero(trama, offset, primer_seq, 8) ||
+                        !leer_entero(trama, offset, enviado_ms, 8) || !leer_entero(trama, offset, cantidad, 2)) {
+                        continue;
+                    }
+
+                    for (uint64_t i = 0; i < cantidad; i++) {
+                        uint64_t len;
+                        if (!leer_entero(trama, offset, len, 2) || offset + len > trama.size()) break;
+                        std::vector<uint8_t> entrada(trama.begin() + offset, trama.begin() + offset + len);
+                        offset += len;
+                        aplicar_entrada_replicacion(entrada);
+                    }
+
+                    if (primer_seq > 0) {
+                        aplicado = primer_seq + cantidad - 1;
+                        std::vector<uint8_t> ack = {REPL_ACK};
+                        agregar_entero(ack, aplicado, 8);
+                        enlace.enviar(ack);
+                    }
+
+                    auto ahora = std::chrono::steady_clock::now();
+                    if (ahora - ultima_metrica >= std::chrono::seconds(10)) {
+                        ultima_metrica = ahora;
+                        logger.log("Métricas replicación (seguidor): aplicado=" + std::to_string(aplicado) +
+                                   " lag_ms=" + std::to_string(a_milisegundos(std::chrono::system_clock::now()) -
+                                                               static_cast<int64_t>(enviado_ms)));
+                    }
+                }
+            } catch (const std::exception& e) {
+                intentos_fallidos++;
+                logger.log("Enlace con primario " + direccion + " perdido (" + std::to_string(intentos_fallidos) +
+                           "/3): " + e.what());
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(usuarios_mutex);
+            for (auto& [nombre, usuario] : usuarios) {
+                usuario->estado = EstadoUsuario::DESCONECTADO;
+                usuario->ws_stream.reset();
+            }
+        }
+        modo_seguidor = false;
+        logger.log("Primario no disponible, el seguidor toma el control con historial hasta seq " +
+                   std::to_string(aplicado));
+    }
+
+    std::vector<uint8_t> crear_entrada_sala(const Mensaje& mensaje) {
+        std::vector<uint8_t> entrada = {REPL_SALA};
+        agregar_cadena(entrada, mensaje.destino());
+        agregar_cadena(entrada, mensaje.origen());
+        agregar_cadena(entrada, mensaje.contenido());
+        agregar_entero(entrada, a_milisegundos(mensaje.timestamp), 8);
+        return entrada;
+    }
+
+    void agregar_historial_sala(Sala& sala, Mensaje mensaje) {
+        if (replicacion_activa) {
+            replicar(crear_entrada_sala(mensaje));
+        }
+        sala.historial.push(std::move(mensaje));
+    }
+
+    std::shared_ptr<Sala> obtener_sala(const std::string& nombre, bool crear) {
+        std::lock_guard<std::mutex> lock(salas_mutex);
+        auto it = salas.find(nombre);
+        if (it != salas.end()) {
+            return it->second;
+        }
+        if (!crear) {
+            return nullptr;
+        }
+        auto sala = std::make_shared<Sala>(nombre);
+        salas[nombre] = sala;
+        return sala;
+    }
+
+    std::shared_ptr<Usuario> buscar_usuario(const std::string& nombre) {
+        std::lock_guard<std::mutex> lock(usuarios_mutex);
+        auto it = usuarios.find(nombre);
+        return it != usuarios.end() ? it->second : nullptr;
+    }
+
+    std::vector<uint8_t> crear_mensaje_sala(const std::string& sala, const std::string& origen, const std::string& contenido) {
+        auto mensaje = PoolBuffers::trama(SERVER_ROOM_MESSAGE, 4 + sala.size() + origen.size() + contenido.size());
+        agregar_cadena(mensaje, sala);
+        agregar_cadena(mensaje, origen);
+        agregar_cadena(mensaje, contenido);
+        return mensaje;
+    }
+
+    std::vector<uint8_t> crear_mensaje_actualizacion_sala(const std::string& sala, const std::string& usuario, bool unido) {
+        auto mensaje = PoolBuffers::trama(SERVER_ROOM_UPDATE, 4 + sala.size() + usuario.size());
+        agregar_cadena(mensaje, sala);
+        agregar_cadena(mensaje, usuario);
+        mensaje.push_back(unido ? 1 : 0);
+        return mensaje;
+    }
+
+    void enviar_a_miembros(const std::vector<std::shared_ptr<Usuario>>& miembros, const std::vector<uint8_t>& mensaje,
+                           uint32_t excluir_id = 0) {
+        for (const auto& miembro : miembros) {
+            if (miembro->id == excluir_id || !miembro->ws_stream || !miembro->ws_stream->is_open()) {
+                continue;
+            }
+            try {
+                miembro->enviar(mensaje);
+            } catch (const std::exception& e) {
+                logger.log("Error enviando mensaje de sala a " + miembro->nombre + ": " + e.what());
+            }
+        }
+    }
+
+    void enviar_a_miembros(const std::vector<std::shared_ptr<Usuario>>& miembros, std::vector<uint8_t>&& mensaje,
+                           uint32_t excluir_id = 0) {
+        enviar_a_miembros(miembros, static_cast<const std::vector<uint8_t>&>(mensaje), excluir_id);
+        PoolBuffers::devolver(mensaje);
+    }
+
+    bool leer_nombre_sala(const std::vector<uint8_t>& datos, std::string& sala) {
+        size_t offset = 1;
+        return leer_cadena(datos, offset, sala) && sala.size() > 1 && sala[0] == '#';
+    }
+
+    void procesar_unirse_sala(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+        std::string nombre_sala;
+        auto usuario = buscar_usuario(nombre_cliente);
+        if (!usuario || !leer_nombre_sala(datos, nombre_sala)) {
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_INVALID_ROOM));
+            return;
+        }
+
+        auto sala = obtener_sala(nombre_sala, true);
+        std::vector<std::shared_ptr<Usuario>> miembros;
+        {
+            std::lock_guard<std::mutex> lock(sala->mutex);
+            if (!sala->agregar(usuario)) {
+                return;
+            }
+            miembros = sala->conectados();
+        }
+
+        logger.log("Usuario " + nombre_cliente + " se unió a la sala " + nombre_sala +
+                   " (" + std::to_string(miembros.size()) + " miembros conectados)");
+        enviar_a_miembros(miembros, crear_mensaje_actualizacion_sala(nombre_sala, nombre_cliente, true));
+    }
+
+    void procesar_salir_sala(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+        std::string nombre_sala;
+        auto usuario = buscar_usuario(nombre_cliente);
+        if (!usuario || !leer_nombre_sala(datos, nombre_sala)) {
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_INVALID_ROOM));
+            return;
+        }
+
+        auto sala = obtener_sala(nombre_sala, false);
+        std::vector<std::shared_ptr<Usuario>> miembros;
+        if (sala) {
+            std::lock_guard<std::mutex> lock(sala->mutex);
+            if (sala->quitar(usuario->id)) {
+                miembros = sala->conectados();
+                miembros.push_back(usuario);
+            }
+        }
+
+        if (miembros.empty()) {
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_NOT_IN_ROOM));
+            return;
+        }
+
+        logger.log("Usuario " + nombre_cliente + " salió de la sala " + nombre_sala);
+        enviar_a_miembros(miembros, crear_mensaje_actualizacion_sala(nombre_sala, nombre_cliente, false));
+    }
+
+    void enviar_a_sala(const std::shared_ptr<Usuario>& remitente, const std::string& nombre_sala,
+                       const std::string& contenido) {
+        auto sala = obtener_sala(nombre_sala, false);
+        std::vector<std::shared_ptr<Usuario>> miembros;
+        if (sala) {
+            std::lock_guard<std::mutex> lock(sala->mutex);
+            if (sala->contiene(remitente->id)) {
+                agregar_historial_sala(*sala, Mensaje(remitente->nombre, nombre_sala, contenido));
+                miembros = sala->conectados();
+            }
+        }
+
+        if (miembros.empty()) {
+            enviar_mensaje_a_usuario(remitente->nombre, crear_mensaje_error(ERROR_NOT_IN_ROOM));
+            return;
+        }
+
+        logger.log("Cliente " + remitente->nombre + " envía mensaje a la sala " + nombre_sala + " (" +
+                   std::to_string(miembros.size()) + " miembros conectados)");
+        enviar_a_miembros(miembros, crear_mensaje_sala(nombre_sala, remitente->nombre, contenido), remitente->id);
+    }
+
+    void enviar_historial_sala(const std::string& nombre_cliente, const std::string& nombre_sala) {
+        auto usuario = buscar_usuario(nombre_cliente);
+        auto sala = obtener_sala(nombre_sala, false);
+        if (!usuario || !sala) {
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_NOT_IN_ROOM, CLIENT_GET_HISTORY));
+            return;
+        }
+
+        std::vector<uint8_t> mensaje = {SERVER_HISTORY, 0};
+        {
+            std::lock_guard<std::mutex> lock(sala->mutex);
+            if (!sala->contiene(usuario->id)) {
+                mensaje.clear();
+            } else {
+                size_t count = std::min(sala->historial.size(), size_t(255));
+                mensaje[1] = static_cast<uint8_t>(count);
+                for (size_t i = sala->historial.size() - count; i < sala->historial.size(); i++) {
+                    agregar_cadena(mensaje, sala->historial[i].origen());
+                    agregar_cadena(mensaje, sala->historial[i].contenido());
+                }
+                // Sin IDs, pero con el nombre de la sala para que el cliente sepa de qué conversación es
+                agregar_cadena(mensaje, nombre_sala);
+            }
+        }
+
+        if (mensaje.empty()) {
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_NOT_IN_ROOM, CLIENT_GET_HISTORY));
+            return;
+        }
+        enviar_mensaje_a_usuario(nombre_cliente, mensaje);
+    }
+
+    void procesar_buscar(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+        size_t offset = 1;
+        std::string consulta;
+        if (!leer_cadena(datos, offset, consulta)) {
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_EMPTY_MESSAGE));
+            return;
+        }
+
+        uint64_t antes_de = 0;
+        leer_entero(datos, offset, antes_de, 4);
+        size_t limite = offset < datos.size() ? datos[offset] : 20;
+        limite = std::min<size_t>(std::max<size_t>(limite, 1), 50);
+
+        auto inicio = std::chrono::steady_clock::now();
+        std::vector<uint8_t> mensaje = {SERVER_SEARCH_RESULTS, 0};
+        uint8_t count = 0;
+        uint32_t siguiente = indice_busqueda.buscar(consulta, nombre_cliente, static_cast<uint32_t>(antes_de), limite,
+            [&](const ResultadoBusqueda& resultado) {
+                const Mensaje& encontrado = *resultado.mensaje;
+                const std::string& chat = encontrado.destino() == "~" ? encontrado.destino()
+                                        : encontrado.origen() == nombre_cliente ? encontrado.destino() : encontrado.origen();
+                agregar_entero(mensaje, resultado.id, 4);
+                agregar_cadena(mensaje, chat);
+                agregar_cadena(mensaje, encontrado.destino() == "~" ? std::string("Anónimo") : encontrado.origen());
+                agregar_cadena(mensaje, encontrado.contenido());
+                agregar_entero(mensaje, a_milisegundos(encontrado.timestamp), 8);
+                count++;
+            });
+        mensaje[1] = count;
+        agregar_entero(mensaje, siguiente, 4);
+
+        auto duracion = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - inicio);
+        logger.log("Cliente " + nombre_cliente + " busca \"" + consulta + "\": " + std::to_string(count) +
+                   " resultados en " + std::to_string(duracion.count()) + " us");
+        enviar_mensaje_a_usuario(nombre_cliente, mensaje);
+    }
+
+    // Eco de la carga del cliente por la misma escritura serializada que el resto de
+    // mensajes. Los ping de control de WebSocket los respondería read() desde el hilo
+    // lector, fuera de escritura_mutex. No cuenta como actividad del usuario.
+    // Solo se devuelve la carga de 8 bytes del protocolo, no una de tamaño arbitrario
+    void procesar_ping(Usuario& usuario, std::vector<uint8_t>& datos) {
+        if (datos.size() != 9) return;
+        datos[0] = SERVER_PONG;
+        usuario.enviar(datos);
+    }
+
+    void procesar_confirmacion(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+        if (datos.size() < 2) return;
+
+        size_t offset = 2;
+        std::lock_guard<std::mutex> lock(usuarios_mutex);
+        auto it = usuarios.find(nombre_cliente);
+        if (it == usuarios.end()) return;
+
+        // Solo se guardan conversaciones que existen, así el cliente no puede crear entradas a voluntad
+        for (uint8_t i = 0; i < datos[1]; i++) {
+            std::string chat;
+            uint64_t id;
+            if (!leer_cadena(datos, offset, chat) || !leer_entero(datos, offset, id, 4)) break;
+            uint32_t ultimo = chat == "~" ? UINT32_MAX : ultima_secuencia_directa(nombre_cliente, chat);
+            if (ultimo == 0) continue;
+            uint32_t& confirmado = it->second->confirmados[chat];
+            confirmado = std::max(confirmado, std::min(static_cast<uint32_t>(id), ultimo));
+        }
+    }
+
+    // Reenvía de cada conversación solo los mensajes posteriores al último ID
+    // que tiene el cliente (o al último confirmado si el cliente envía 0).
+    void procesar_reanudar(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+        if (datos.size() < 2) return;
+
+        std::vector<std::pair<std::string, uint32_t>> pedidos;
+        size_t offset = 2;
+        for (uint8_t i = 0; i < datos[1]; i++) {
+            std::string chat;
+            uint64_t id;
+            if (!leer_cadena(datos, offset, chat) || !leer_entero(datos, offset, id, 4)) break;
+            pedidos.emplace_back(chat, static_cast<uint32_t>(id));
+        }
+
+        std::vector<uint8_t> mensaje = {SERVER_RESUME, 0};
+        size_t total = 0;
+        uint8_t respondidas = 0;
+
+        auto agregar_delta = [&](const std::string& chat, uint32_t desde, uint32_t ultimo, auto&& recorrer) {
+            agregar_cadena(mensaje, chat);
+            size_t pos_completo = mensaje.size();
+            mensaje.push_back(1);
+            size_t pos_count = mensaje.size();
+            agregar_entero(mensaje, 0, 2);
+
+            uint16_t count = 0;
+            bool primero = true;
+            recorrer([&](const Mensaje& msg, const std::string& origen) {
+                if (primero && msg.id > desde + 1) {
+                    mensaje[pos_completo] = 0;
+                }
+                primero = false;
+                if (msg.id <= desde || count == UINT16_MAX) {
+                    return;
+                }
+                agregar_entero(mensaje, msg.id, 4);
+                agregar_cadena(mensaje, origen);
+                agregar_cadena(mensaje, msg.contenido());
+                count++;
+            });
+            if (primero && ultimo > desde) {
+                mensaje[pos_completo] = 0;
+            }
+            mensaje[pos_count] = static_cast<uint8_t>(count >> 8);
+            mensaje[pos_count + 1] = static_cast<uint8_t>(count);
+            total += count;
+            respondidas++;
+        };
+
+        for (auto& [chat, desde] : pedidos) {
+            if (desde == 0) {
+                std::lock_guard<std::mutex> lock(usuarios_mutex);
+                auto it = usuarios.find(nombre_cliente);
+                if (it != usuarios.end()) {
+                    auto it_conf = it->second->confirmados.find(chat);
+                    if (it_conf != it->second->confirmados.end()) {
+                        desde = it_conf->second;
+                    }
+                }
+            }
+
+            if (chat == "~") {
+                std::lock_guard<std::mutex> lock(chat_general_mutex);
+                agregar_delta(chat, desde, secuencia_general, [&](auto&& visitar) {
+                    for (const auto& msg : chat_general) {
+                        visitar(msg, std::string("Anónimo"));
+                    }
+                });
+            } else {
+                // Las conversaciones sin mensajes se omiten de la respuesta
+                std::lock_guard<std::mutex> lock(usuarios_mutex);
+                uint32_t ultimo = ultima_secuencia_directa(nombre_cliente, chat);
+                if (ultimo == 0) continue;
+                auto it = usuarios.find(nombre_cliente);
+                agregar_delta(chat, desde, ultimo, [&](auto&& visitar) {
+                    if (it == usuarios.end()) return;
+                    for (const auto& msg : it->second->historial_mensajes) {
+                        if (msg.origen() == chat || msg.destino() == chat) {
+                            visitar(msg, msg.origen());
+                        }
+                    }
+                });
+            }
+        }
+
+        mensaje[1] = respondidas;
+        logger.log("Cliente " + nombre_cliente + " reanuda " + std::to_string(respondidas) +
+                   " conversaciones: " + std::to_string(total) + " mensajes reenviados");
+        enviar_mensaje_a_usuario(nombre_cliente, mensaje);
+    }
+
     void procesar_listar_usuarios(const std::string& nombre_cliente) {
         logger.log("Cliente " + nombre_cliente + " solicita lista de usuarios");
         auto mensaje = crear_mensaje_lista_usuarios();
@@ -385,8 +2763,8 @@ public:
             return;
         }
         
-        std::string nombre_buscado(datos.begin() + 2, datos.begin() + 2 + len);
-        logger.log("Cliente " + nombre_cliente + " solicita info de usuario " + nombre_buscado);
+        std::string_view nombre_buscado(reinterpret_cast<const char*>(datos.data()) + 2, len);
+        logger.log("Cliente " + nombre_cliente + " solicita info de usuario " + std::string(nombre_buscado));
         
         auto mensaje = crear_mensaje_info_usuario(nombre_buscado);
         enviar_mensaje_a_usuario(nombre_cliente, mensaje);
@@ -436,12 +2814,12 @@ public:
                    " a " + std::to_string(static_cast<int>(it->second->estado)));
     
         try {
-            auto mensaje = crear_mensaje_cambio_estado(nombre_usuario, it->second->estado);
             logger.log("PREPARANDO BROADCAST: Cambio de estado de usuario " + nombre_usuario +
                 " de " + std::to_string(static_cast<int>(estadoAnterior)) +
                 " a " + std::to_string(static_cast<int>(it->second->estado)));
-            broadcast_mensaje(mensaje, true); 
+            notificar_cambio_estado(nombre_usuario, it->second->estado, true);
             logger.log("BROADCAST COMPLETADO: Notificación de cambio de estado enviada a todos los usuarios conectados");
+            entregar_buzon(*it->second);
         } catch (const std::exception& e) {
             logger.log("ERROR durante creación o envío de broadcast: " + std::string(e.what()));
         } catch (...) {
@@ -449,7 +2827,8 @@ public:
         }
     }
 
-    void procesar_enviar_mensaje(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
+    void procesar_enviar_mensaje(const std::string& nombre_cliente, const std::vector<uint8_t>& datos,
+                                 ArenaSolicitud& arena) {
         if (datos.size() < 2) {
             enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_EMPTY_MESSAGE));
             return;
@@ -461,7 +2840,8 @@ public:
             return;
         }
         
-        std::string destino(datos.begin() + 2, datos.begin() + 2 + len_dest);
+        std::string& destino = arena.cadena();
+        destino.assign(datos.begin() + 2, datos.begin() + 2 + len_dest);
         
         uint8_t len_msg = datos[2 + len_dest];
         if (datos.size() < 3 + len_dest + len_msg) {
@@ -469,13 +2849,19 @@ public:
             return;
         }
         
-        std::string contenido(datos.begin() + 3 + len_dest, datos.begin() + 3 + len_dest + len_msg);
+        std::string& contenido = arena.cadena();
+        contenido.assign(datos.begin() + 3 + len_dest, datos.begin() + 3 + len_dest + len_msg);
+
+        size_t offset = 3 + len_dest + len_msg;
+        uint64_t id_cliente = 0;
+        leer_entero(datos, offset, id_cliente, 4);
         
-        if (contenido.empty()) {
+        if (contenido.empty() || destino.empty()) {
             enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_EMPTY_MESSAGE));
             return;
         }
         
+        std::shared_ptr<Usuario> remitente;
         {
             std::lock_guard<std::mutex> lock(usuarios_mutex);
             auto it_origen = usuarios.find(nombre_cliente);
@@ -491,75 +2877,133 @@ public:
                 return;
             }
             
+            if (it_origen->second->es_envio_repetido(static_cast<uint32_t>(id_cliente))) {
+                logger.log("Envío repetido " + std::to_string(id_cliente) + " de " + nombre_cliente + " descartado");
+                return;
+            }
+
             it_origen->second->actualizar_actividad();
+            if (destino[0] == '#') {
+                remitente = it_origen->second;
+            }
+        }
+
+        if (remitente) {
+            enviar_a_sala(remitente, destino, contenido);
+            return;
         }
         
         logger.log("Cliente " + nombre_cliente + " envía mensaje a " + destino + ": " + contenido);
         
-        auto mensaje_respuesta = crear_mensaje_recibido(nombre_cliente, contenido);
-        
         if (destino == "~") {
+            uint32_t id_mensaje;
             {
                 std::lock_guard<std::mutex> lock(chat_general_mutex);
-                chat_general.emplace_back(nombre_cliente, destino, contenido);
-                if (chat_general.size() > 1000) {
-                    chat_general.pop_front();
-                }
+                id_mensaje = agregar_historial_general(Mensaje(nombre_cliente, destino, contenido));
             }
     
-            auto mensaje_anonimo = crear_mensaje_recibido("Anónimo", contenido);
+            auto mensaje_anonimo = crear_mensaje_recibido("Anónimo", contenido, id_mensaje, destino);
             
-            std::thread([this, mensaje_anonimo, nombre_cliente]() {
+            std::thread([this, mensaje_anonimo = std::move(mensaje_anonimo), nombre_cliente]() mutable {
                 logger.log("Iniciando thread para broadcasting de mensaje");
                 broadcast_mensaje(mensaje_anonimo, false, nombre_cliente);
+                PoolBuffers::devolver(mensaje_anonimo);
                 logger.log("Thread de broadcasting finalizado");
             }).detach();
             
             logger.log("Thread de broadcasting creado para mensaje de " + nombre_cliente + " al chat general");
+
+            if (!id_nodo.empty()) {
+                std::vector<uint8_t> trama = {PEER_BROADCAST};
+                agregar_cadena(trama, nombre_cliente);
+                agregar_cadena(trama, contenido);
+                difundir_a_peers(trama);
+            }
         } else {
             std::shared_ptr<Usuario> usuario_destino;
-            std::shared_ptr<Usuario> usuario_origen;
+            std::shared_ptr<Usuario> destino_desconectado;
+            Mensaje mensaje(nombre_cliente, destino, contenido);
             
             {
                 std::lock_guard<std::mutex> lock(usuarios_mutex);
                 
-                auto it_dest = usuarios.find(destino);
-                if (it_dest == usuarios.end() || it_dest->second->estado == EstadoUsuario::DESCONECTADO) {
+                auto it_dest = despertar_usuario(destino);
+                if (it_dest != usuarios.end() && it_dest->second->estado == EstadoUsuario::DESCONECTADO) {
+                    destino_desconectado = it_dest->second;
+                } else if (it_dest != usuarios.end()) {
+                    mensaje.id = ++secuencia_directa(nombre_cliente, destino);
+                    auto it_origen = usuarios.find(nombre_cliente);
+                    if (it_origen != usuarios.end()) {
+                        agregar_historial_usuario(*it_origen->second, mensaje, false);
+                    }
+                    
+                    agregar_historial_usuario(*it_dest->second, mensaje);
+                    usuario_destino = it_dest->second;
+                    if (!usuario_destino->puede_recibir_mensajes()) {
+                        guardar_en_buzon(*usuario_destino, mensaje);
+                    }
+                }
+            }
+
+            std::string nodo_destino = usuario_destino ? "" : nodo_de_usuario_remoto(destino);
+
+            if (!usuario_destino && nodo_destino.empty() && destino_desconectado && buzon_max_mensajes > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(usuarios_mutex);
+                    mensaje.id = ++secuencia_directa(nombre_cliente, destino);
+                    auto it_origen = usuarios.find(nombre_cliente);
+                    if (it_origen != usuarios.end()) {
+                        agregar_historial_usuario(*it_origen->second, mensaje, false);
+                    }
+                    agregar_historial_usuario(*destino_desconectado, mensaje);
+                    guardar_en_buzon(*destino_desconectado, mensaje);
+                }
+                enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_recibido(nombre_cliente, contenido, mensaje.id, destino));
+                return;
+            }
+
+            if (!usuario_destino) {
+                if (nodo_destino.empty()) {
                     logger.log("Error: Destinatario " + destino + " no encontrado o desconectado");
                     enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_DISCONNECTED_USER));
                     return;
                 }
-                
-                auto it_origen = usuarios.find(nombre_cliente);
-                if (it_origen != usuarios.end()) {
-                    it_origen->second->historial_mensajes.emplace_back(nombre_cliente, destino, contenido);
-                    if (it_origen->second->historial_mensajes.size() > 1000) {
-                        it_origen->second->historial_mensajes.pop_front();
-                    }
-                    usuario_origen = it_origen->second;
+
+                std::vector<uint8_t> trama = {PEER_MESSAGE};
+                agregar_cadena(trama, nombre_cliente);
+                agregar_cadena(trama, destino);
+                agregar_cadena(trama, contenido);
+                if (!enviar_a_peer(nodo_destino, trama)) {
+                    logger.log("Error: nodo " + nodo_destino + " de " + destino + " no disponible");
+                    enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_DISCONNECTED_USER));
+                    return;
                 }
-                
-                it_dest->second->historial_mensajes.emplace_back(nombre_cliente, destino, contenido);
-                if (it_dest->second->historial_mensajes.size() > 1000) {
-                    it_dest->second->historial_mensajes.pop_front();
+
+                {
+                    std::lock_guard<std::mutex> lock(usuarios_mutex);
+                    auto it_origen = usuarios.find(nombre_cliente);
+                    if (it_origen != usuarios.end()) {
+                        mensaje.id = agregar_historial_usuario(*it_origen->second, mensaje);
+                    }
                 }
-                
-                usuario_destino = it_dest->second;
+                logger.log("Mensaje de " + nombre_cliente + " para " + destino + " reenviado al nodo " + nodo_destino);
             }
-            
-            if (usuario_destino->puede_recibir_mensajes()) {
-                std::thread([this, usuario_destino, mensaje_respuesta, destino]() {
+
+            auto mensaje_respuesta = crear_mensaje_recibido(nombre_cliente, contenido, mensaje.id, nombre_cliente);
+            auto mensaje_confirmacion = crear_mensaje_recibido(nombre_cliente, contenido, mensaje.id, destino);
+
+            if (usuario_destino && usuario_destino->puede_recibir_mensajes()) {
+                std::thread([this, usuario_destino, mensaje_respuesta = std::move(mensaje_respuesta), destino]() mutable {
                     logger.log("Iniciando thread para envío directo a " + destino);
                     try {
                         if (usuario_destino->ws_stream && usuario_destino->ws_stream->is_open()) {
-                            usuario_destino->ws_stream->write(net::buffer(mensaje_respuesta));
+                            usuario_destino->enviar(mensaje_respuesta);
                             logger.log("Mensaje enviado con éxito a " + destino + " en thread separado");
                         } else {
                             logger.log("Error: WebSocket no está abierto para " + destino);
                             std::lock_guard<std::mutex> lock(usuarios_mutex);
                             usuario_destino->estado = EstadoUsuario::DESCONECTADO;
-                            auto notificacion = crear_mensaje_cambio_estado(destino, EstadoUsuario::DESCONECTADO);
-                            broadcast_mensaje(notificacion);
+                            notificar_cambio_estado(destino, EstadoUsuario::DESCONECTADO, true);
                             logger.log("Usuario " + destino + " marcado como DESCONECTADO por WebSocket cerrado");
                         }
                     } catch (const std::exception& e) {
@@ -568,23 +3012,27 @@ public:
                         std::lock_guard<std::mutex> lock(usuarios_mutex);
                         if (usuario_destino->estado != EstadoUsuario::DESCONECTADO) {
                             usuario_destino->estado = EstadoUsuario::DESCONECTADO;
-                            auto notificacion = crear_mensaje_cambio_estado(destino, EstadoUsuario::DESCONECTADO);
-                            broadcast_mensaje(notificacion);
+                            notificar_cambio_estado(destino, EstadoUsuario::DESCONECTADO, true);
                             logger.log("Usuario " + destino + " marcado como DESCONECTADO por error de comunicación");
                         }
                     }
+                    PoolBuffers::devolver(mensaje_respuesta);
                     logger.log("Thread de envío directo a " + destino + " finalizado");
                 }).detach();
                 
                 logger.log("Thread de envío directo creado para mensaje de " + nombre_cliente + " a " + destino);
             } else {
-                logger.log("No se envía mensaje a " + destino + " porque su estado no lo permite");
+                PoolBuffers::devolver(mensaje_respuesta);
+                if (usuario_destino) {
+                    logger.log("No se envía mensaje a " + destino + " porque su estado no lo permite, queda en su " +
+                               (buzon_max_mensajes > 0 ? "buzón" : "historial"));
+                }
             }
             
-            std::thread([this, nombre_cliente, mensaje_respuesta]() {
+            std::thread([this, nombre_cliente, mensaje_confirmacion = std::move(mensaje_confirmacion)]() mutable {
                 logger.log("Iniciando thread para envío de confirmación a " + nombre_cliente);
                 try {
-                    bool remitente_enviado = enviar_mensaje_a_usuario(nombre_cliente, mensaje_respuesta);
+                    bool remitente_enviado = enviar_mensaje_a_usuario(nombre_cliente, std::move(mensaje_confirmacion));
                     if (!remitente_enviado) {
                         logger.log("No se pudo enviar confirmación al remitente " + nombre_cliente);
                     }
@@ -597,92 +3045,206 @@ public:
     }
     void procesar_obtener_historial(const std::string& nombre_cliente, const std::vector<uint8_t>& datos) {
         if (datos.size() < 2) {
-            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_USER_NOT_FOUND));
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_USER_NOT_FOUND, CLIENT_GET_HISTORY));
             return;
         }
         
         uint8_t len = datos[1];
         if (datos.size() < 2 + len) {
-            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_USER_NOT_FOUND));
+            enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_USER_NOT_FOUND, CLIENT_GET_HISTORY));
             return;
         }
         
         std::string chat(datos.begin() + 2, datos.begin() + 2 + len);
-        logger.log("Cliente " + nombre_cliente + " solicita historial de chat " + chat);
+        size_t offset = 2 + len;
+        uint64_t id_anterior = 0;
+        leer_entero(datos, offset, id_anterior, 4);
+        logger.log("Cliente " + nombre_cliente + " solicita historial de chat " + chat +
+                   (id_anterior != 0 ? " anterior a " + std::to_string(id_anterior) : ""));
+
+        if (!chat.empty() && chat[0] == '#') {
+            enviar_historial_sala(nombre_cliente, chat);
+            return;
+        }
 
         if (chat != "~") {
-            std::lock_guard<std::mutex> lock(usuarios_mutex);
-            if (usuarios.find(chat) == usuarios.end()) {
-                enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_USER_NOT_FOUND));
+            bool existe;
+            {
+                std::lock_guard<std::mutex> lock(usuarios_mutex);
+                existe = existe_usuario(chat);
+            }
+            if (!existe && nodo_de_usuario_remoto(chat).empty()) {
+                enviar_mensaje_a_usuario(nombre_cliente, crear_mensaje_error(ERROR_USER_NOT_FOUND, CLIENT_GET_HISTORY));
                 return;
             }
         }
         
-        auto mensaje = crear_mensaje_historial(chat);
+        auto mensaje = crear_mensaje_historial(chat, nombre_cliente, static_cast<uint32_t>(id_anterior));
         enviar_mensaje_a_usuario(nombre_cliente, mensaje);
     }
 
+    bool configurar_limite(const std::string& especificacion, bool por_ip) {
+        static const std::unordered_map<std::string, uint8_t> tipos = {
+            {"lista", CLIENT_LIST_USERS},
+            {"usuario", CLIENT_GET_USER},
+            {"estado", CLIENT_CHANGE_STATUS},
+            {"mensaje", CLIENT_SEND_MESSAGE},
+            {"historial", CLIENT_GET_HISTORY},
+            {"presencia", CLIENT_SUBSCRIBE_PRESENCE},
+            {"busqueda", CLIENT_SEARCH},
+            {"salas", CLIENT_JOIN_ROOM},
+            {"confirmacion", CLIENT_ACK},
+            {"ping", CLIENT_PING},
+            {"general", LIMITE_CHAT_GENERAL}
+        };
+
+        auto igual = especificacion.find('=');
+        auto dos_puntos = especificacion.find(':', igual);
+        if (igual == std::string::npos || dos_puntos == std::string::npos) {
+            return false;
+        }
+
+        auto it = tipos.find(especificacion.substr(0, igual));
+        if (it == tipos.end()) {
+            return false;
+        }
+
+        try {
+            LimiteTasa limite{std::stod(especificacion.substr(igual + 1, dos_puntos - igual - 1)),
+                              std::stod(especificacion.substr(dos_puntos + 1))};
+            auto& config = por_ip ? limites_ip : limites_usuario;
+            config.por_tipo[it->second] = limite;
+            if (por_ip) {
+                limites_ip_explicitos[it->second] = true;
+            }
+            if (it->second == CLIENT_JOIN_ROOM) {
+                config.por_tipo[CLIENT_LEAVE_ROOM] = limite;
+                limites_ip_explicitos[CLIENT_LEAVE_ROOM] = limites_ip_explicitos[CLIENT_JOIN_ROOM];
+            }
+            if (it->second == CLIENT_GET_HISTORY) {
+                config.por_tipo[CLIENT_RESUME] = limite;
+                limites_ip_explicitos[CLIENT_RESUME] = limites_ip_explicitos[CLIENT_GET_HISTORY];
+            }
+            logger.log(std::string("Límite ") + (por_ip ? "por IP" : "por usuario") + " para " + it->first +
+                       ": " + std::to_string(limite.tasa) + "/s, ráfaga " + std::to_string(limite.rafaga));
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // Se llama una vez leídas las opciones: los tipos sin --limite-ip toman 4 veces el
+    // límite por usuario ya configurado, para que una IP nunca quede por debajo de él
+    void completar_limites_ip() {
+        for (size_t i = 0; i < limites_ip.por_tipo.size(); i++) {
+            if (!limites_ip_explicitos[i]) {
+                limites_ip.por_tipo[i] = {limites_usuario.por_tipo[i].tasa * 4, limites_usuario.por_tipo[i].rafaga * 4};
+            }
+        }
+    }
+
+    std::shared_ptr<LimitadorIp> obtener_limitador_ip(const net::ip::address& ip) {
+        std::lock_guard<std::mutex> lock(limitadores_ip_mutex);
+        auto& entrada = limitadores_ip[ip.to_string()];
+        auto limitador = entrada.lock();
+        if (!limitador) {
+            limitador = std::make_shared<LimitadorIp>(limites_ip);
+            entrada = limitador;
+        }
+
+        if (limitadores_ip.size() > 1024) {
+            for (auto it = limitadores_ip.begin(); it != limitadores_ip.end();) {
+                it = it->second.expired() ? limitadores_ip.erase(it) : std::next(it);
+            }
+        }
+        return limitador;
+    }
+
+    uint8_t tipo_limite(const std::vector<uint8_t>& datos) {
+        if (datos[0] == CLIENT_SEND_MESSAGE && datos.size() >= 3 && datos[1] == 1 && datos[2] == '~') {
+            return LIMITE_CHAT_GENERAL;
+        }
+        return datos[0];
+    }
+
     void set_timeout_inactividad(int seconds) {
         timeout_inactividad = std::chrono::seconds(seconds);
         logger.log("Timeout de inactividad establecido a " + std::to_string(seconds) + " segundos");
     }
 
-    void manejar_conexion(tcp::socket socket, const std::string& query_string) {
+    void rechazar_conexion(socket_cliente& socket, const std::string& motivo) {
+        http::response<http::string_body> res{http::status::bad_request, 11};
+        res.set(http::field::server, "ChatServer");
+        res.set(http::field::content_type, "text/plain");
+        res.body() = motivo;
+        res.prepare_payload();
+        
+        http::write(socket, res);
+    }
+
+    // Los clientes locales por socket Unix se tratan como si llegaran por
+    // loopback, así que comparten los límites por IP de 127.0.0.1.
+    net::ip::address direccion_remota(const socket_cliente& socket) {
+        auto endpoint = socket.remote_endpoint();
+        if (endpoint.protocol().family() != AF_INET && endpoint.protocol().family() != AF_INET6) {
+            return net::ip::address_v4::loopback();
+        }
+        tcp::endpoint endpoint_tcp;
+        std::memcpy(endpoint_tcp.data(), endpoint.data(), endpoint.size());
+        endpoint_tcp.resize(endpoint.size());
+        return endpoint_tcp.address();
+    }
+
+    void manejar_conexion(socket_cliente socket, const http::request<http::string_body>& req, 
+                          const std::string& query_string) {
         try {
             std::string nombre_usuario = parse_nombre_usuario(query_string);
 
             if (nombre_usuario.empty()) {
                 logger.log("Conexión rechazada: nombre de usuario vacío");
-
-                http::response<http::string_body> 
-                res{http::status::bad_request, 11};
-                res.set(http::field::server, "ChatServer");
-                res.set(http::field::content_type, "text/plain");
-                res.body() = "Nombre de usuario vacío";
-                res.prepare_payload();
-                
-                http::write(socket, res);
+                rechazar_conexion(socket, "Nombre de usuario vacío");
                 return;
             }
             
-            if (nombre_usuario == "~") {
+            if (nombre_usuario == "~" || nombre_usuario[0] == '#') {
                 logger.log("Conexión rechazada: nombre de usuario reservado");
-
-                http::response<http::string_body> res{http::status::bad_request, 11};
-                res.set(http::field::server, "ChatServer");
-                res.set(http::field::content_type, "text/plain");
-                res.body() = "Nombre de usuario reservado";
-                res.prepare_payload();
-                
-                http::write(socket, res);
+                rechazar_conexion(socket, "Nombre de usuario reservado");
                 return;
             }
             
+            std::string token = parse_token_sesion(query_string);
+            bool usuario_ya_conectado = false;
+            bool reanudar = false;
             {
                 std::lock_guard<std::mutex> lock(usuarios_mutex);
                 auto it = usuarios.find(nombre_usuario);
-                if (it != usuarios.end() && it->second->estado != EstadoUsuario::DESCONECTADO) {
-                    logger.log("Conexión rechazada: usuario ya conectado: " + nombre_usuario);
-
-                    http::response<http::string_body> res{http::status::bad_request, 11};
-                    res.set(http::field::server, "ChatServer");
-                    res.set(http::field::content_type, "text/plain");
-                    res.body() = "Usuario ya conectado";
-                    res.prepare_payload();
-                    
-                    http::write(socket, res);
-                    return;
+                if (it != usuarios.end()) {
+                    reanudar = !token.empty() && token == it->second->token_sesion &&
+                               (it->second->en_gracia || it->second->estado != EstadoUsuario::DESCONECTADO);
+                    usuario_ya_conectado = it->second->estado != EstadoUsuario::DESCONECTADO && !reanudar;
                 }
             }
 
-            auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(socket));
+            if (usuario_ya_conectado || !nodo_de_usuario_remoto(nombre_usuario).empty()) {
+                logger.log("Conexión rechazada: usuario ya conectado: " + nombre_usuario);
+                rechazar_conexion(socket, "Usuario ya conectado");
+                return;
+            }
+
+            auto ws = std::make_shared<websocket::stream<socket_cliente>>(std::move(socket));
 
-            net::ip::address ip_address = ws->next_layer().remote_endpoint().address();
+            net::ip::address ip_address;
+            try {
+                ip_address = direccion_remota(ws->next_layer());
+            } catch (const std::exception& e) {
+                logger.log("Error obteniendo IP para " + nombre_usuario + ": " + e.what());
+            }
 
             ws->set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+            ws->binary(true);
 
             try {
-                ws->accept();
+                ws->accept(req);
                 logger.log("WebSocket handshake aceptado para: " + nombre_usuario);
             } 
             catch (const std::exception& e) {
@@ -692,41 +3254,92 @@ public:
 
             logger.log("Conexión aceptada: " + nombre_usuario + " desde " + ip_address.to_string());
             
+            auto limitador_ip = obtener_limitador_ip(ip_address);
+            std::shared_ptr<Usuario> usuario;
+            bool reanudada = false;
             {
                 std::lock_guard<std::mutex> lock(usuarios_mutex);
-                auto it = usuarios.find(nombre_usuario);
+                auto it = despertar_usuario(nombre_usuario);
                 if (it != usuarios.end()) {
-                    it->second->ws_stream = ws;
-                    it->second->estado = EstadoUsuario::ACTIVO;
+                    reanudada = reanudar && !token.empty() && token == it->second->token_sesion &&
+                                (it->second->en_gracia || it->second->estado != EstadoUsuario::DESCONECTADO);
+                    std::shared_ptr<websocket::stream<socket_cliente>> anterior;
+                    {
+                        std::lock_guard<std::mutex> lock_escritura(it->second->escritura_mutex);
+                        anterior = it->second->ws_stream;
+                        it->second->ws_stream = ws;
+                    }
+                    if (reanudada) {
+                        if (it->second->en_gracia) {
+                            it->second->estado = it->second->estado_previo;
+                        }
+                        if (anterior && anterior != ws) {
+                            beast::error_code ec;
+                            anterior->next_layer().shutdown(tcp::socket::shutdown_both, ec);
+                        }
+                    } else {
+                        it->second->estado = EstadoUsuario::ACTIVO;
+                        it->second->token_sesion = generar_token_sesion();
+                    }
+                    it->second->en_gracia = false;
                     it->second->actualizar_actividad();
                     it->second->ip_address = ip_address;
                 } else {
-                    usuarios[nombre_usuario] = std::make_shared<Usuario>(nombre_usuario, ws, ip_address);
+                    it = usuarios.emplace(nombre_usuario, std::make_shared<Usuario>(siguiente_id_usuario++, nombre_usuario, ws, ip_address)).first;
+                    it->second->token_sesion = generar_token_sesion();
                 }
+                usuario = it->second;
+                // El limitador sigue al usuario entre reconexiones para que reconectar no
+                // recargue la ráfaga; uno recién creado o despertado del nivel frío (horas
+                // sin actividad, con los buckets ya llenos) lo recibe aquí
+                if (!usuario->limitador.configurado()) {
+                    usuario->limitador = LimitadorTasa(limites_usuario);
+                }
+                usuario->limitador_ip = limitador_ip;
             }
 
-            std::vector<uint8_t> notificacion = {
-                SERVER_NEW_USER, 
-                static_cast<uint8_t>(nombre_usuario.size())
-            };
-            notificacion.insert(notificacion.end(), nombre_usuario.begin(), nombre_usuario.end());
-            notificacion.push_back(static_cast<uint8_t>(EstadoUsuario::ACTIVO));
-            
-            broadcast_mensaje(notificacion);
+            if (reanudada) {
+                logger.log("Sesión de " + nombre_usuario + " reanudada sin difundir presencia");
+            } else {
+                suscribir_presencia(nombre_usuario, {"~"});
+                notificar_nuevo_usuario(nombre_usuario, ip_address.to_string());
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(usuarios_mutex);
+                try {
+                    usuario->enviar(crear_mensaje_sesion(usuario->token_sesion));
+                } catch (const std::exception& e) {
+                    logger.log("Error enviando token de sesión a " + nombre_usuario + ": " + e.what());
+                }
+                entregar_buzon(*usuario);
+            }
 
+            // El buffer de lectura, la trama decodificada y la arena de la
+            // solicitud se reutilizan en cada solicitud de la conexión.
             beast::flat_buffer buffer;
+            std::vector<uint8_t> datos;
+            ArenaSolicitud arena;
             
             while (true) {
                 try {
                     ws->read(buffer);
                     
-                    auto data = beast::buffers_to_string(buffer.data());
-                    std::vector<uint8_t> datos(data.begin(), data.end());
+                    auto bytes = static_cast<const uint8_t*>(buffer.data().data());
+                    datos.assign(bytes, bytes + buffer.size());
                     buffer.consume(buffer.size());
+                    arena.reiniciar();
                     
                     if (datos.empty()) {
                         continue;
                     }
+
+                    if (!usuario->permitir_solicitud(tipo_limite(datos))) {
+                        logger.log("Solicitud tipo " + std::to_string(datos[0]) + " de " + nombre_usuario +
+                                   " rechazada por límite de tasa");
+                        enviar_mensaje_a_usuario(nombre_usuario, crear_mensaje_error(ERROR_RATE_LIMITED, datos[0]));
+                        continue;
+                    }
                     
                     switch (datos[0]) {
                         case CLIENT_LIST_USERS:
@@ -742,12 +3355,40 @@ public:
                             break;
                             
                         case CLIENT_SEND_MESSAGE:
-                            procesar_enviar_mensaje(nombre_usuario, datos);
+                            procesar_enviar_mensaje(nombre_usuario, datos, arena);
                             break;
                             
                         case CLIENT_GET_HISTORY:
                             procesar_obtener_historial(nombre_usuario, datos);
                             break;
+
+                        case CLIENT_JOIN_ROOM:
+                            procesar_unirse_sala(nombre_usuario, datos);
+                            break;
+
+                        case CLIENT_LEAVE_ROOM:
+                            procesar_salir_sala(nombre_usuario, datos);
+                            break;
+
+                        case CLIENT_SUBSCRIBE_PRESENCE:
+                            procesar_suscribir_presencia(nombre_usuario, datos);
+                            break;
+
+                        case CLIENT_SEARCH:
+                            procesar_buscar(nombre_usuario, datos);
+                            break;
+
+                        case CLIENT_RESUME:
+                            procesar_reanudar(nombre_usuario, datos);
+                            break;
+
+                        case CLIENT_ACK:
+                            procesar_confirmacion(nombre_usuario, datos);
+                            break;
+
+                        case CLIENT_PING:
+                            procesar_ping(*usuario, datos);
+                            break;
                             
                         default:
                             logger.log("Mensaje desconocido de " + nombre_usuario + ": tipo " + 
@@ -755,14 +3396,13 @@ public:
                             break;
                     }
                     
-                } catch (const beast::error_code& ec) {
-                    if (ec == websocket::error::closed) {
+                } catch (const beast::system_error& se) {
+                    if (se.code() == websocket::error::closed) {
                         logger.log("Conexión cerrada por cliente: " + nombre_usuario);
-                        break;
                     } else {
-                        logger.log("Error leyendo de cliente " + nombre_usuario + ": " + ec.message());
-                        break;
+                        logger.log("Error leyendo de cliente " + nombre_usuario + ": " + se.code().message());
                     }
+                    break;
                 } catch (const std::exception& e) {
                     logger.log("Error procesando mensaje de " + nombre_usuario + ": " + e.what());
                     break;
@@ -772,15 +3412,28 @@ public:
             {
                 std::lock_guard<std::mutex> lock(usuarios_mutex);
                 auto it = usuarios.find(nombre_usuario);
-                if (it != usuarios.end()) {
+                if (it == usuarios.end()) {
+                    return;
+                }
+                if (it->second->ws_stream != ws) {
+                    logger.log("Conexión anterior de " + nombre_usuario + " cerrada tras reanudar la sesión");
+                    return;
+                }
+                if (gracia_sesion.count() > 0 && !it->second->token_sesion.empty()) {
+                    it->second->estado_previo = it->second->estado;
                     it->second->estado = EstadoUsuario::DESCONECTADO;
-                    logger.log("Usuario " + nombre_usuario + " marcado como DESCONECTADO");
+                    it->second->en_gracia = true;
+                    it->second->gracia_hasta = std::chrono::steady_clock::now() + gracia_sesion;
+                    logger.log("Usuario " + nombre_usuario + " en gracia de sesión durante " +
+                               std::to_string(gracia_sesion.count()) + " s");
+                    return;
                 }
+                it->second->estado = EstadoUsuario::DESCONECTADO;
+                logger.log("Usuario " + nombre_usuario + " marcado como DESCONECTADO");
             }
 
-            std::vector<uint8_t> notificacion_desconexion = crear_mensaje_cambio_estado(
-                nombre_usuario, EstadoUsuario::DESCONECTADO);
-            broadcast_mensaje(notificacion_desconexion);
+            cancelar_suscripciones(nombre_usuario);
+            notificar_cambio_estado(nombre_usuario, EstadoUsuario::DESCONECTADO);
             
         } catch (const std::exception& e) {
             logger.log("Error en manejo de conexión: " + std::string(e.what()));
@@ -796,24 +3449,199 @@ std::string extract_query_string(boost::string_view target) {
     return "";
 }
 
+void atender_conexion(ChatServer& servidor, socket_cliente sock) {
+    std::thread([&servidor, sock = std::move(sock)]() mutable {
+        try {
+
+            beast::flat_buffer buffer;
+            http::request<http::string_body> req;
+            
+
+            http::read(sock, buffer, req);
+            
+            std::cout << "Thread: Petición HTTP recibida: " << req.target() << std::endl;
+            std::string query_string = extract_query_string(req.target());
+            std::cout << "Thread: Query string: " << query_string << std::endl;
+
+            servidor.manejar_conexion(std::move(sock), req, query_string);
+            
+        } catch (const std::exception& e) {
+            std::cerr << "Thread: Error en manejo de conexión: " << e.what() << std::endl;
+        }
+    }).detach();
+}
+
+// Escucha en un socket Unix para bots y puentes en la misma máquina; habla
+// el mismo HTTP + WebSocket que el puerto TCP. Devuelve false si la ruta ya
+// existe y no es un socket: solo se borra el socket de una ejecución anterior.
+bool escuchar_unix(ChatServer& servidor, const std::string& ruta) {
+    struct stat info;
+    if (::lstat(ruta.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            std::cerr << "La ruta " << ruta << " ya existe y no es un socket" << std::endl;
+            return false;
+        }
+        ::unlink(ruta.c_str());
+    }
+
+    std::thread([&servidor, ruta]() {
+        try {
+            net::io_context ioc{1};
+            net::local::stream_protocol::acceptor acceptor{ioc, net::local::stream_protocol::endpoint(ruta)};
+            std::cout << "Escuchando clientes locales en " << ruta << std::endl;
+
+            while (true) {
+                net::local::stream_protocol::socket socket{ioc};
+                acceptor.accept(socket);
+                atender_conexion(servidor, socket_cliente(std::move(socket)));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error en listener Unix " << ruta << ": " << e.what() << std::endl;
+        }
+    }).detach();
+    return true;
+}
+
 
+// Las pruebas de rendimiento que necesitan el servidor completo lo incluyen
+// con CHAT_SIN_MAIN definido y arman sus propias conexiones.
+#ifndef CHAT_SIN_MAIN
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 2) {
-            std::cerr << "Uso: " << argv[0] << " <puerto>" << std::endl;
+        if (argc < 2) {
+            std::cerr << "Uso: " << argv[0] << " <puerto> [--nodo <id>] [--cluster-puerto <puerto>]"
+                      << " [--peer <host:puerto>]... [--replicacion-puerto <puerto>]"
+                      << " [--seguir <host:puerto>] [--limite <tipo>=<tasa>:<rafaga>]..."
+                      << " [--limite-ip <tipo>=<tasa>:<rafaga>]... [--presencia-ventana <ms>]"
+                      << " [--buzon-mensajes <n>] [--buzon-horas <h>] [--gracia-sesion <s>]"
+                      << " [--frio-minutos <m>] [--frio-mb <mb>] [--unix <ruta>]"
+                      << " [--busqueda-mensajes <n>]" << std::endl;
             return 1;
         }
         
         int puerto = std::stoi(argv[1]);
-        
+        std::string id_nodo = "nodo-" + std::to_string(puerto);
+        int puerto_cluster = 0;
+        std::vector<std::string> peers;
+        int puerto_replicacion = 0;
+        std::string primario;
+        std::vector<std::pair<std::string, bool>> limites;
+        int ventana_presencia = 1500;
+        int buzon_mensajes = 200;
+        int buzon_horas = 72;
+        int gracia_sesion = 30;
+        int frio_minutos = 30;
+        int frio_mb = 64;
+        int busqueda_mensajes = 100000;
+        std::string ruta_unix;
+
+        for (int i = 2; i < argc; i++) {
+            std::string opcion = argv[i];
+            if (i + 1 >= argc) {
+                std::cerr << "Falta el valor de la opción " << opcion << std::endl;
+                return 1;
+            }
+            std::string valor = argv[++i];
+
+            if (opcion == "--nodo") {
+                id_nodo = valor;
+            } else if (opcion == "--cluster-puerto") {
+                puerto_cluster = std::stoi(valor);
+            } else if (opcion == "--peer") {
+                peers.push_back(valor);
+            } else if (opcion == "--replicacion-puerto") {
+                puerto_replicacion = std::stoi(valor);
+            } else if (opcion == "--seguir") {
+                primario = valor;
+            } else if (opcion == "--limite" || opcion == "--limite-ip") {
+                limites.emplace_back(valor, opcion == "--limite-ip");
+            } else if (opcion == "--presencia-ventana") {
+                ventana_presencia = std::stoi(valor);
+            } else if (opcion == "--buzon-mensajes") {
+                buzon_mensajes = std::stoi(valor);
+            } else if (opcion == "--buzon-horas") {
+                buzon_horas = std::stoi(valor);
+            } else if (opcion == "--gracia-sesion") {
+                gracia_sesion = std::stoi(valor);
+            } else if (opcion == "--frio-minutos") {
+                frio_minutos = std::stoi(valor);
+            } else if (opcion == "--frio-mb") {
+                frio_mb = std::stoi(valor);
+            } else if (opcion == "--busqueda-mensajes") {
+                busqueda_mensajes = std::stoi(valor);
+            } else if (opcion == "--unix") {
+                ruta_unix = valor;
+            } else {
+                std::cerr << "Opción desconocida: " << opcion << std::endl;
+                return 1;
+            }
+        }
+
+        // Se guardan como size_t y horas: un valor negativo daría un buzón, presupuesto o índice enorme.
+        // --buzon-mensajes 0 desactiva el buzón
+        if (buzon_mensajes < 0) {
+            std::cerr << "Valor inválido para --buzon-mensajes: " << buzon_mensajes << " (debe ser 0 o mayor)" << std::endl;
+            return 1;
+        }
+        for (const auto& [opcion, valor] : {std::pair<const char*, int>{"--buzon-horas", buzon_horas},
+                                            {"--frio-mb", frio_mb}, {"--busqueda-mensajes", busqueda_mensajes}}) {
+            if (valor <= 0) {
+                std::cerr << "Valor inválido para " << opcion << ": " << valor << " (debe ser mayor que 0)" << std::endl;
+                return 1;
+            }
+        }
+
+        ChatServer servidor;
+        servidor.set_timeout_inactividad(120);
+        servidor.configurar_ventana_presencia(ventana_presencia);
+        servidor.configurar_buzon(buzon_mensajes, buzon_horas);
+        servidor.configurar_gracia_sesion(gracia_sesion);
+        servidor.configurar_nivel_frio(frio_minutos, frio_mb);
+        servidor.configurar_busqueda(busqueda_mensajes);
+
+        for (const auto& [especificacion, por_ip] : limites) {
+            if (!servidor.configurar_limite(especificacion, por_ip)) {
+                std::cerr << "Límite inválido: " << especificacion
+                          << " (tipos: lista, usuario, estado, mensaje, historial, general, salas, presencia, busqueda,"
+                          << " confirmacion, ping)" << std::endl;
+                return 1;
+            }
+        }
+        servidor.completar_limites_ip();
+
+        if (!primario.empty()) {
+            std::cout << "Modo seguidor: replicando historial desde " << primario << std::endl;
+            servidor.seguir_primario(primario);
+        }
+
         net::io_context ioc{1};
-        tcp::acceptor acceptor{ioc, {tcp::v4(), static_cast<unsigned short>(puerto)}};
+        tcp::acceptor acceptor{ioc};
+        while (!acceptor.is_open()) {
+            try {
+                acceptor = tcp::acceptor{ioc, {tcp::v4(), static_cast<unsigned short>(puerto)}};
+            } catch (const std::exception& e) {
+                if (primario.empty()) {
+                    throw;
+                }
+                std::cerr << "Puerto " << puerto << " aún ocupado, reintentando: " << e.what() << std::endl;
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
         acceptor.set_option(boost::asio::socket_base::reuse_address(true));
         
-        std::cout << "Servidor iniciado en puerto " << puerto << std::endl;
-        
-        ChatServer servidor;
-        servidor.set_timeout_inactividad(120);
+        std::cout << "Servidor iniciado en puerto " << puerto << " (backend de E/S: " << backend_io() << ")" << std::endl;
+
+        if (puerto_replicacion > 0) {
+            servidor.iniciar_replicacion(static_cast<unsigned short>(puerto_replicacion));
+        }
+
+        if (puerto_cluster > 0) {
+            servidor.iniciar_federacion(id_nodo, static_cast<unsigned short>(puerto_cluster), peers);
+        }
+
+        if (!ruta_unix.empty() && !escuchar_unix(servidor, ruta_unix)) {
+            return 1;
+        }
         
 
         while (true) {
@@ -827,195 +3655,7 @@ int main(int argc, char* argv[]) {
             
             socket.set_option(tcp::socket::keep_alive(true));
             
-
-            std::thread([&servidor, sock = std::move(socket)]() mutable {
-                try {
-
-                    beast::flat_buffer buffer;
-                    http::request<http::string_body> req;
-                    
-
-                    http::read(sock, buffer, req);
-                    
-                    std::cout << "Thread: Petición HTTP recibida: " << req.target() << std::endl;
-                    std::string query_string = extract_query_string(req.target());
-                    std::cout << "Thread: Query string: " << query_string << std::endl;
-                    
-
-                    std::string nombre_usuario = servidor.parse_nombre_usuario(query_string);
-                    std::cout << "Thread: Procesando conexión para usuario: " << nombre_usuario << std::endl;
-                    
-
-                    if (nombre_usuario.empty()) {
-                        http::response<http::string_body> res{http::status::bad_request, 11};
-                        res.set(http::field::server, "ChatServer");
-                        res.set(http::field::content_type, "text/plain");
-                        res.body() = "Nombre de usuario vacío";
-                        res.prepare_payload();
-                        http::write(sock, res);
-                        std::cout << "Thread: Conexión rechazada: nombre de usuario vacío" << std::endl;
-                        return;
-                    }
-                    
-                    if (nombre_usuario == "~") {
-                        http::response<http::string_body> res{http::status::bad_request, 11};
-                        res.set(http::field::server, "ChatServer");
-                        res.set(http::field::content_type, "text/plain");
-                        res.body() = "Nombre de usuario reservado";
-                        res.prepare_payload();
-                        http::write(sock, res);
-                        std::cout << "Thread: Conexión rechazada: nombre de usuario reservado" << std::endl;
-                        return;
-                    }
-                    
-
-                    bool usuario_ya_conectado = false;
-                    {
-                        std::lock_guard<std::mutex> lock(servidor.get_usuarios_mutex());
-                        auto& usuarios = servidor.get_usuarios();
-                        auto it = usuarios.find(nombre_usuario);
-                        if (it != usuarios.end() && it->second->estado != EstadoUsuario::DESCONECTADO) {
-                            usuario_ya_conectado = true;
-                        }
-                    }
-                    
-                    if (usuario_ya_conectado) {
-                        http::response<http::string_body> res{http::status::bad_request, 11};
-                        res.set(http::field::server, "ChatServer");
-                        res.set(http::field::content_type, "text/plain");
-                        res.body() = "Usuario ya conectado";
-                        res.prepare_payload();
-                        http::write(sock, res);
-                        std::cout << "Thread: Conexión rechazada: usuario ya conectado: " << nombre_usuario << std::endl;
-                        return;
-                    }
-                    
-
-                    auto ws = std::make_shared<websocket::stream<tcp::socket>>(std::move(sock));
-                    ws->set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
-                    
-                    try {
-
-                        ws->accept(req);
-                        std::cout << "Thread: WebSocket handshake aceptado para: " << nombre_usuario << std::endl;
-                    }
-                    catch (const std::exception& e) {
-                        std::cerr << "Thread: Error aceptando WebSocket para " << nombre_usuario 
-                                  << ": " << e.what() << std::endl;
-                        return;
-                    }
-                    
-
-                    net::ip::address ip_address;
-                    try {
-                        ip_address = ws->next_layer().remote_endpoint().address();
-                    }
-                    catch (const std::exception& e) {
-                        std::cerr << "Thread: Error obteniendo IP para " << nombre_usuario 
-                                  << ": " << e.what() << std::endl;
-
-                    }
-
-                    {
-                        std::lock_guard<std::mutex> lock(servidor.get_usuarios_mutex());
-                        auto& usuarios = servidor.get_usuarios();
-                        auto it = usuarios.find(nombre_usuario);
-                        if (it != usuarios.end()) {
-                            it->second->ws_stream = ws;
-                            it->second->estado = EstadoUsuario::ACTIVO;
-                            it->second->actualizar_actividad();
-                            it->second->ip_address = ip_address;
-                        } else {
-                            usuarios[nombre_usuario] = std::make_shared<Usuario>(nombre_usuario, ws, ip_address);
-                        }
-                    }
-                    
-
-                    std::vector<uint8_t> notificacion = {
-                        SERVER_NEW_USER, 
-                        static_cast<uint8_t>(nombre_usuario.size())
-                    };
-                    notificacion.insert(notificacion.end(), nombre_usuario.begin(), nombre_usuario.end());
-                    notificacion.push_back(static_cast<uint8_t>(EstadoUsuario::ACTIVO));
-                    
-                    servidor.broadcast_mensaje(notificacion);
-                    std::cout << "Thread: Usuario " << nombre_usuario << " conectado y notificado" << std::endl;
-
-                    beast::flat_buffer msg_buffer;
-                    
-                    while (true) {
-                        try {
-                            ws->read(msg_buffer);
-                            
-                            auto data = beast::buffers_to_string(msg_buffer.data());
-                            std::vector<uint8_t> datos(data.begin(), data.end());
-                            msg_buffer.consume(msg_buffer.size());
-                            
-                            if (datos.empty()) {
-                                continue;
-                            }
-                            
-                            switch (datos[0]) {
-                                case CLIENT_LIST_USERS:
-                                    servidor.procesar_listar_usuarios(nombre_usuario);
-                                    break;
-                                    
-                                case CLIENT_GET_USER:
-                                    servidor.procesar_obtener_usuario(nombre_usuario, datos);
-                                    break;
-                                    
-                                case CLIENT_CHANGE_STATUS:
-                                    servidor.procesar_cambiar_estado(nombre_usuario, datos);
-                                    break;
-                                    
-                                case CLIENT_SEND_MESSAGE:
-                                    servidor.procesar_enviar_mensaje(nombre_usuario, datos);
-                                    break;
-                                    
-                                case CLIENT_GET_HISTORY:
-                                    servidor.procesar_obtener_historial(nombre_usuario, datos);
-                                    break;
-                                    
-                                default:
-                                    std::cout << "Thread " << nombre_usuario << ": Mensaje desconocido tipo " 
-                                              << (int)datos[0] << std::endl;
-                                    break;
-                            }
-                            
-                        } catch (const beast::error_code& ec) {
-                            if (ec == websocket::error::closed) {
-                                std::cout << "Thread: Conexión cerrada por cliente: " << nombre_usuario << std::endl;
-                                break;
-                            } else {
-                                std::cout << "Thread: Error leyendo de cliente " << nombre_usuario << ": " << ec.message() << std::endl;
-                                break;
-                            }
-                        } catch (const std::exception& e) {
-                            std::cout << "Thread: Error procesando mensaje de " << nombre_usuario << ": " << e.what() << std::endl;
-                            break;
-                        }
-                    }
-                    
-
-                    {
-                        std::lock_guard<std::mutex> lock(servidor.get_usuarios_mutex());
-                        auto& usuarios = servidor.get_usuarios();
-                        auto it = usuarios.find(nombre_usuario);
-                        if (it != usuarios.end()) {
-                            it->second->estado = EstadoUsuario::DESCONECTADO;
-                            std::cout << "Thread: Usuario " << nombre_usuario << " marcado como DESCONECTADO" << std::endl;
-                        }
-                    }
-                    
-
-                    std::vector<uint8_t> notificacion_desconexion = servidor.crear_mensaje_cambio_estado(
-                        nombre_usuario, EstadoUsuario::DESCONECTADO);
-                    servidor.broadcast_mensaje(notificacion_desconexion);
-                    
-                } catch (const std::exception& e) {
-                    std::cerr << "Thread: Error en manejo de conexión: " << e.what() << std::endl;
-                }
-            }).detach();
+            atender_conexion(servidor, socket_cliente(std::move(socket)));
         }
     } catch (const std::exception& e) {
         std::cerr << "Error en el servidor: " << e.what() << std::endl;
@@ -1023,4 +3663,5 @@ int main(int argc, char* argv[]) {
     }
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,465 @@
+// Núcleo del servidor sin red: el mensaje almacenado, el índice de búsqueda y el
+// registro por nombre. Lo comparten el servidor (servidor.cpp) y las pruebas de
+// rendimiento (bench_*.cpp).
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+// Los textos de un mensaje no cambian una vez creado y se reservan en un solo
+// bloque compartido: copiarlo al historial del otro usuario, al buzón o al
+// índice no vuelve a reservar memoria.
+struct Mensaje {
+    struct Textos {
+        std::string origen;
+        std::string destino;
+        std::string contenido;
+    };
+
+    std::shared_ptr<const Textos> textos;
+    std::chrono::system_clock::time_point timestamp;
+    uint32_t id = 0;
+
+    Mensaje(std::string org, std::string dest, std::string cont)
+        : Mensaje(std::move(org), std::move(dest), std::move(cont), std::chrono::system_clock::now()) {}
+
+    Mensaje(std::string org, std::string dest, std::string cont, std::chrono::system_clock::time_point ts)
+        : textos(std::make_shared<const Textos>(Textos{std::move(org), std::move(dest), std::move(cont)})),
+          timestamp(ts) {}
+
+    const std::string& origen() const { return textos->origen; }
+    const std::string& destino() const { return textos->destino; }
+    const std::string& contenido() const { return textos->contenido; }
+};
+
+// Lista de IDs de mensaje ordenada, codificada como deltas varint. Cada
+// bloque de 128 IDs guarda su offset y su primer ID para poder saltar
+// directamente a él sin decodificar la lista completa.
+class ListaPostings {
+public:
+    static constexpr size_t BLOQUE = 128;
+
+    struct Bloque {
+        uint32_t offset;
+        uint32_t primer_id;
+    };
+
+    std::vector<uint8_t> datos;
+    std::vector<Bloque> bloques;
+    uint32_t ultimo_id = 0;
+    size_t cantidad = 0;
+
+    void agregar(uint32_t id) {
+        if (cantidad % BLOQUE == 0) {
+            bloques.push_back(Bloque{static_cast<uint32_t>(datos.size()), id});
+        } else {
+            uint32_t delta = id - ultimo_id;
+            while (delta >= 0x80) {
+                datos.push_back(static_cast<uint8_t>(delta | 0x80));
+                delta >>= 7;
+            }
+            datos.push_back(static_cast<uint8_t>(delta));
+        }
+        ultimo_id = id;
+        cantidad++;
+    }
+
+    void decodificar_bloque(size_t indice, std::vector<uint32_t>& ids) const {
+        ids.clear();
+        size_t offset = bloques[indice].offset;
+        size_t fin = indice + 1 < bloques.size() ? bloques[indice + 1].offset : datos.size();
+        uint32_t id = bloques[indice].primer_id;
+        ids.push_back(id);
+        while (offset < fin) {
+            uint32_t delta = 0;
+            int desplazamiento = 0;
+            uint8_t byte;
+            do {
+                byte = datos[offset++];
+                delta |= static_cast<uint32_t>(byte & 0x7F) << desplazamiento;
+                desplazamiento += 7;
+            } while ((byte & 0x80) && offset < fin);
+            id += delta;
+            ids.push_back(id);
+        }
+    }
+
+    // Quita los bloques cuyos IDs son todos menores que id. El primer bloque que
+    // quede puede conservar algunos; quien recorre la lista los salta.
+    size_t descartar_antes_de(uint32_t id) {
+        size_t n = 0;
+        while (n + 1 < bloques.size() && bloques[n + 1].primer_id <= id) {
+            n++;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        uint32_t inicio = bloques[n].offset;
+        datos.erase(datos.begin(), datos.begin() + inicio);
+        bloques.erase(bloques.begin(), bloques.begin() + n);
+        for (auto& bloque : bloques) {
+            bloque.offset -= inicio;
+        }
+        cantidad -= n * BLOQUE;
+        return inicio + n * sizeof(Bloque);
+    }
+
+    size_t bloque_de(uint32_t id) const {
+        auto it = std::upper_bound(bloques.begin(), bloques.end(), id,
+                                   [](uint32_t valor, const Bloque& b) { return valor < b.primer_id; });
+        return it == bloques.begin() ? bloques.size() : static_cast<size_t>(it - bloques.begin() - 1);
+    }
+};
+
+struct ResultadoBusqueda {
+    uint32_t id;
+    const Mensaje* mensaje;
+};
+
+// Índice invertido incremental sobre el chat general y los mensajes directos.
+// Los IDs empiezan en 1 y crecen con cada mensaje indexado. Igual que los
+// historiales, solo retiene los mensajes más recientes: al pasar de la capacidad
+// se olvida el más antiguo, y las listas se compactan cada cuarto de capacidad.
+class IndiceBusqueda {
+private:
+    std::deque<Mensaje> mensajes;
+    std::unordered_map<std::string, ListaPostings> postings;
+    uint32_t primer_id = 1;
+    size_t capacidad = 100000;
+    size_t descartados = 0;
+    size_t bytes_mensajes = 0;
+    size_t bytes_postings = 0;
+    std::mutex mutex;
+
+    static size_t bytes_de(const Mensaje& mensaje) {
+        return sizeof(Mensaje) + sizeof(Mensaje::Textos) + mensaje.origen().capacity() + mensaje.destino().capacity() +
+               mensaje.contenido().capacity();
+    }
+
+    void compactar() {
+        for (auto it = postings.begin(); it != postings.end();) {
+            ListaPostings& lista = it->second;
+            if (lista.ultimo_id < primer_id) {
+                bytes_postings -= it->first.size() + sizeof(ListaPostings) + lista.datos.size() +
+                                  lista.bloques.size() * sizeof(ListaPostings::Bloque);
+                it = postings.erase(it);
+                continue;
+            }
+            bytes_postings -= lista.descartar_antes_de(primer_id);
+            ++it;
+        }
+        descartados = 0;
+    }
+
+    struct Cursor {
+        const ListaPostings* lista;
+        size_t bloque = SIZE_MAX;
+        std::vector<uint32_t> ids;
+
+        explicit Cursor(const ListaPostings* lista) : lista(lista) {}
+
+        bool contiene(uint32_t id) {
+            size_t indice = lista->bloque_de(id);
+            if (indice >= lista->bloques.size()) {
+                return false;
+            }
+            if (indice != bloque) {
+                lista->decodificar_bloque(indice, ids);
+                bloque = indice;
+            }
+            return std::binary_search(ids.begin(), ids.end(), id);
+        }
+    };
+
+    static bool visible(const Mensaje& mensaje, const std::string& solicitante) {
+        return mensaje.destino() == "~" || mensaje.origen() == solicitante || mensaje.destino() == solicitante;
+    }
+
+public:
+    static std::vector<std::string> tokenizar(const std::string& texto) {
+        std::vector<std::string> tokens;
+        std::string actual;
+        for (size_t i = 0; i <= texto.size(); i++) {
+            unsigned char c = i < texto.size() ? static_cast<unsigned char>(texto[i]) : ' ';
+            if (std::isalnum(c) || c >= 0x80) {
+                if (actual.size() < 32) {
+                    actual.push_back(static_cast<char>(std::tolower(c)));
+                }
+            } else if (!actual.empty()) {
+                tokens.push_back(std::move(actual));
+                actual.clear();
+            }
+        }
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+        return tokens;
+    }
+
+    void configurar_capacidad(size_t maximo) {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacidad = std::max<size_t>(maximo, 1);
+    }
+
+    // Memoria aproximada de los mensajes retenidos y las listas de postings
+    size_t bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytes_mensajes + bytes_postings;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return mensajes.size();
+    }
+
+    void vaciar() {
+        std::lock_guard<std::mutex> lock(mutex);
+        primer_id += static_cast<uint32_t>(mensajes.size());
+        mensajes.clear();
+        postings.clear();
+        descartados = 0;
+        bytes_mensajes = 0;
+        bytes_postings = 0;
+    }
+
+    // Olvida los mensajes más antiguos hasta ocupar como mucho max_bytes; devuelve cuántos
+    size_t recortar(size_t max_bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t recortados = 0;
+        while (!mensajes.empty() && bytes_mensajes + bytes_postings > max_bytes) {
+            bytes_mensajes -= bytes_de(mensajes.front());
+            mensajes.pop_front();
+            primer_id++;
+            recortados++;
+            if (++descartados >= mensajes.size() / 4 + 1) {
+                compactar();
+            }
+        }
+        compactar();
+        return recortados;
+    }
+
+    uint32_t indexar(const Mensaje& mensaje) {
+        auto tokens = tokenizar(mensaje.contenido());
+        std::lock_guard<std::mutex> lock(mutex);
+        mensajes.push_back(mensaje);
+        bytes_mensajes += bytes_de(mensajes.back());
+        uint32_t id = primer_id + static_cast<uint32_t>(mensajes.size()) - 1;
+        for (const auto& token : tokens) {
+            auto [it, nueva] = postings.try_emplace(token);
+            ListaPostings& lista = it->second;
+            size_t antes = lista.datos.size() + lista.bloques.size() * sizeof(ListaPostings::Bloque);
+            lista.agregar(id);
+            bytes_postings += lista.datos.size() + lista.bloques.size() * sizeof(ListaPostings::Bloque) - antes;
+            if (nueva) {
+                bytes_postings += token.size() + sizeof(ListaPostings);
+            }
+        }
+
+        while (mensajes.size() > capacidad) {
+            bytes_mensajes -= bytes_de(mensajes.front());
+            mensajes.pop_front();
+            primer_id++;
+            descartados++;
+        }
+        if (descartados >= capacidad / 4 + 1) {
+            compactar();
+        }
+        return id;
+    }
+
+    template <typename F>
+    uint32_t buscar(const std::string& consulta, const std::string& solicitante, uint32_t antes_de,
+                    size_t limite, F&& recibir) {
+        auto tokens = tokenizar(consulta);
+        if (tokens.empty() || limite == 0) {
+            return 0;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Cursor> cursores;
+        for (const auto& token : tokens) {
+            auto it = postings.find(token);
+            if (it == postings.end()) {
+                return 0;
+            }
+            cursores.emplace_back(&it->second);
+        }
+        std::sort(cursores.begin(), cursores.end(),
+                  [](const Cursor& a, const Cursor& b) { return a.lista->cantidad < b.lista->cantidad; });
+
+        const ListaPostings& guia = *cursores[0].lista;
+        size_t entregados = 0;
+        std::vector<uint32_t> ids;
+        size_t inicio = guia.bloques.size();
+        if (antes_de != 0) {
+            size_t indice = guia.bloque_de(antes_de - 1);
+            if (indice >= guia.bloques.size()) {
+                return 0;
+            }
+            inicio = indice + 1;
+        }
+
+        for (size_t b = inicio; b-- > 0;) {
+            guia.decodificar_bloque(b, ids);
+            for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+                uint32_t id = *it;
+                if (antes_de != 0 && id >= antes_de) {
+                    continue;
+                }
+                if (id < primer_id) {
+                    return 0;
+                }
+                const Mensaje& mensaje = mensajes[id - primer_id];
+                if (!visible(mensaje, solicitante)) {
+                    continue;
+                }
+                bool coincide = true;
+                for (size_t c = 1; c < cursores.size() && coincide; c++) {
+                    coincide = cursores[c].contiene(id);
+                }
+                if (!coincide) {
+                    continue;
+                }
+                recibir(ResultadoBusqueda{id, &mensaje});
+                if (++entregados == limite) {
+                    return id;
+                }
+            }
+        }
+        return 0;
+    }
+};
+
+// Registro por nombre con direccionamiento abierto. Las entradas viven en un
+// arreglo denso, así que recorrerlas no persigue nodos, y el índice guarda el
+// hash y la posición de cada una. Las búsquedas aceptan string_view, por lo
+// que buscar un nombre leído de una trama no crea un std::string.
+template <typename T>
+class RegistroNombres {
+public:
+    using Entrada = std::pair<std::string, T>;
+    using iterator = typename std::vector<Entrada>::iterator;
+
+private:
+    struct Ranura {
+        uint32_t hash = 0;
+        uint32_t indice = 0;
+    };
+
+    std::vector<Entrada> entradas;
+    std::vector<Ranura> ranuras = std::vector<Ranura>(16);
+
+    static uint32_t calcular_hash(std::string_view nombre) {
+        return static_cast<uint32_t>(std::hash<std::string_view>{}(nombre));
+    }
+
+    size_t buscar_ranura(std::string_view nombre, uint32_t hash) const {
+        size_t mascara = ranuras.size() - 1;
+        for (size_t i = hash & mascara;; i = (i + 1) & mascara) {
+            const Ranura& ranura = ranuras[i];
+            if (ranura.indice == 0 || (ranura.hash == hash && entradas[ranura.indice - 1].first == nombre)) {
+                return i;
+            }
+        }
+    }
+
+    void vaciar_ranura(size_t hueco) {
+        size_t mascara = ranuras.size() - 1;
+        for (size_t i = (hueco + 1) & mascara; ranuras[i].indice != 0; i = (i + 1) & mascara) {
+            size_t ideal = ranuras[i].hash & mascara;
+            if (((i - ideal) & mascara) >= ((i - hueco) & mascara)) {
+                ranuras[hueco] = ranuras[i];
+                hueco = i;
+            }
+        }
+        ranuras[hueco] = Ranura{};
+    }
+
+    void reconstruir(size_t capacidad) {
+        ranuras.assign(capacidad, Ranura{});
+        for (size_t i = 0; i < entradas.size(); i++) {
+            uint32_t hash = calcular_hash(entradas[i].first);
+            ranuras[buscar_ranura(entradas[i].first, hash)] = {hash, static_cast<uint32_t>(i + 1)};
+        }
+    }
+
+public:
+    iterator begin() { return entradas.begin(); }
+    iterator end() { return entradas.end(); }
+    size_t size() const { return entradas.size(); }
+
+    iterator find(std::string_view nombre) {
+        const Ranura& ranura = ranuras[buscar_ranura(nombre, calcular_hash(nombre))];
+        return ranura.indice == 0 ? entradas.end() : entradas.begin() + (ranura.indice - 1);
+    }
+
+    std::pair<iterator, bool> emplace(std::string nombre, T valor) {
+        if ((entradas.size() + 1) * 2 > ranuras.size()) {
+            reconstruir(ranuras.size() * 2);
+        }
+        uint32_t hash = calcular_hash(nombre);
+        Ranura& ranura = ranuras[buscar_ranura(nombre, hash)];
+        if (ranura.indice != 0) {
+            return {entradas.begin() + (ranura.indice - 1), false};
+        }
+        entradas.emplace_back(std::move(nombre), std::move(valor));
+        ranura = {hash, static_cast<uint32_t>(entradas.size())};
+        return {entradas.end() - 1, true};
+    }
+
+    // La última entrada ocupa el hueco, así que el iterador devuelto apunta a
+    // la siguiente entrada por visitar.
+    iterator erase(iterator it) {
+        size_t indice = it - entradas.begin();
+        vaciar_ranura(buscar_ranura(it->first, calcular_hash(it->first)));
+        size_t ultimo = entradas.size() - 1;
+        if (indice != ultimo) {
+            ranuras[buscar_ranura(entradas[ultimo].first, calcular_hash(entradas[ultimo].first))].indice =
+                static_cast<uint32_t>(indice + 1);
+            entradas[indice] = std::move(entradas[ultimo]);
+        }
+        entradas.pop_back();
+        return entradas.begin() + indice;
+    }
+
+    void clear() {
+        entradas.clear();
+        ranuras.assign(16, Ranura{});
+    }
+};
+
+// Memoria de paso de una solicitud: las cadenas que se leen de una trama y se
+// descartan al terminar de atenderla. Cada sesión tiene la suya y la reinicia
+// después de cada solicitud; las cadenas conservan su capacidad, así que leer
+// no reserva memoria una vez que la sesión vio tramas de ese tamaño.
+class ArenaSolicitud {
+public:
+    std::string& cadena() {
+        if (usadas == cadenas.size()) {
+            cadenas.emplace_back();
+        }
+        std::string& texto = cadenas[usadas++];
+        texto.clear();
+        return texto;
+    }
+
+    void reiniciar() {
+        usadas = 0;
+    }
+
+private:
+    // deque: las referencias ya entregadas siguen siendo válidas al crecer
+    std::deque<std::string> cadenas;
+    size_t usadas = 0;
+};